@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "generator.h"
+
+#include "compiler/pipeline.h"
+#include "lexer/fused.h"
+#include "lexer/lexer.h"
+#include "lexer/symimage.h"
+#include "lexer/symbol.h"
+#include "lexer/symtab.h"
+#include "lexer/token.h"
+#include "lexer/xref.h"
+#include "parser/parser.h"
+#include "preprocessor/preprocessor.h"
+
+#include "hashmap.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double benchPreprocess(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  double start = now();
+  skipCommentsAndDirectives(fp, path, NULL);
+  double elapsed = now() - start;
+
+  fclose(fp);
+  return elapsed;
+}
+
+static void countBlock(const char *block, size_t len, void *ctx) {
+  (void)block;
+  *(size_t *)ctx += len;
+}
+
+static double benchStream(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  size_t out = 0;
+  double start = now();
+  preprocessStream(fd, countBlock, &out);
+  double elapsed = now() - start;
+
+  close(fd);
+  return elapsed;
+}
+
+static double benchLines(const char *path) {
+  FILE *fp = fopen(path, "r");
+  FILE *out = fopen("/dev/null", "w");
+  if (!fp || !out)
+    return -1;
+
+  PPState state = PP_STATE_INIT;
+  double start = now();
+  while (preprocessLine(fp, out, &state))
+    ;
+  double elapsed = now() - start;
+
+  fclose(out);
+  fclose(fp);
+  return elapsed;
+}
+
+static double benchLex(const char *path, long *tokens) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return -1;
+
+  resetLexer(1, 1, 0);
+  *tokens = 0;
+
+  double start = now();
+
+  Token *tok;
+  while ((tok = getNextToken(fp)) && strcmp(tok->type, "EOF") != 0) {
+    (*tokens)++;
+    token_destroy(tok);
+  }
+
+  double elapsed = now() - start;
+
+  token_destroy(tok);
+  fclose(fp);
+  return elapsed;
+}
+
+static double benchFused(const char *path, long *tokens) {
+  *tokens = 0;
+
+  double start = now();
+
+  FusedLexer *lx = openFusedLexer(path);
+  if (!lx)
+    return -1;
+
+  Token *tok;
+  while ((tok = getNextFusedToken(lx)) && strcmp(tok->type, "EOF") != 0) {
+    (*tokens)++;
+    token_destroy(tok);
+  }
+
+  token_destroy(tok);
+  closeFusedLexer(lx);
+
+  return now() - start;
+}
+
+static Token *nextFused(void *ctx) { return getNextFusedToken(ctx); }
+
+static double benchParse(const char *path, long *nodes) {
+  double start = now();
+
+  FusedLexer *lx = openFusedLexer(path);
+  if (!lx)
+    return -1;
+
+  Ast *ast = parseTranslationUnit(nextFused, lx, NULL);
+  closeFusedLexer(lx);
+
+  double elapsed = now() - start;
+
+  *nodes = ast->count - 1;
+  ast_destroy(ast);
+  return elapsed;
+}
+
+static Token *nextPipelined(void *ctx) { return pipelineToken(ctx); }
+
+/* The same parse with preprocessing and lexing on threads of their own */
+static double benchPipeline(const char *path, long *nodes) {
+  double start = now();
+
+  Pipeline *p = startPipeline(path);
+  if (!p)
+    return -1;
+
+  Ast *ast = parseTranslationUnit(nextPipelined, p, NULL);
+  finishPipeline(p);
+
+  double elapsed = now() - start;
+
+  *nodes = ast->count - 1;
+  ast_destroy(ast);
+  return elapsed;
+}
+
+/* Builds an index of the file's identifiers, then walks every name's list */
+static void benchXref(const char *path, GenShape shape, double rescan) {
+  FusedLexer *lx = openFusedLexer(path);
+  if (!lx)
+    return;
+
+  XrefIndex *index = xref_create();
+  uint32_t file = xref_file(index, path);
+  long occurrences = 0;
+
+  double start = now();
+
+  Token *tok;
+  while ((tok = getNextFusedToken(lx)) && strcmp(tok->type, "EOF") != 0) {
+    if (strcmp(tok->type, "IDENTIFIER") == 0) {
+      xref_add(index, xref_name(index, tok->token_name), file, tok->row,
+               tok->col);
+      occurrences++;
+    }
+    token_destroy(tok);
+  }
+
+  double build = now() - start;
+
+  token_destroy(tok);
+  closeFusedLexer(lx);
+
+  size_t bytes = 0;
+  long walked = 0;
+  start = now();
+  for (uint32_t i = 0; i < index->names.count; i++) {
+    XrefCursor cursor;
+    XrefOccurrence at;
+
+    xref_begin(index, i, &cursor);
+    while (xref_next(&cursor, &at))
+      walked++;
+    bytes += index->lists[i].len;
+  }
+  double query = now() - start;
+
+  printf("{\"bench\": \"xref\", \"shape\": \"%s\", \"names\": %u, "
+         "\"occurrences\": %ld, \"walked\": %ld, "
+         "\"bytes_per_occurrence\": %.2f, \"build_seconds\": %.6f, "
+         "\"query_all_seconds\": %.6f, \"rescan_seconds\": %.6f}\n",
+         generator_shapeName(shape), index->names.count, occurrences, walked,
+         occurrences ? (double)bytes / occurrences : 0.0, build, query,
+         rescan);
+
+  xref_destroy(index);
+}
+
+static void benchSource(GenShape shape, size_t size, unsigned int seed,
+                        int repeats) {
+  char path[64];
+  snprintf(path, sizeof(path), "bench_%s.c", generator_shapeName(shape));
+
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    perror(path);
+    return;
+  }
+
+  GenOptions opts = {shape, size, seed, 8};
+  size_t bytes = generator_write(out, &opts);
+  fclose(out);
+
+  double best_pp = -1, best_stream = -1, best_lines = -1, best_lex = -1;
+  double best_fused = -1, best_parse = -1, best_pipeline = -1;
+  long tokens = 0, fused_tokens = 0, nodes = 0, pipeline_nodes = 0;
+
+  for (int i = 0; i < repeats; i++) {
+    double t = benchPreprocess(path);
+    if (best_pp < 0 || t < best_pp)
+      best_pp = t;
+
+    t = benchStream(path);
+    if (best_stream < 0 || t < best_stream)
+      best_stream = t;
+
+    t = benchLines(path);
+    if (best_lines < 0 || t < best_lines)
+      best_lines = t;
+  }
+
+  FILE *temp = fopen("temp.c", "r");
+  fseek(temp, 0, SEEK_END);
+  long temp_bytes = ftell(temp);
+  fclose(temp);
+
+  for (int i = 0; i < repeats; i++) {
+    double t = benchLex("temp.c", &tokens);
+    if (best_lex < 0 || t < best_lex)
+      best_lex = t;
+
+    t = benchFused(path, &fused_tokens);
+    if (best_fused < 0 || t < best_fused)
+      best_fused = t;
+
+    t = benchParse(path, &nodes);
+    if (best_parse < 0 || t < best_parse)
+      best_parse = t;
+
+    t = benchPipeline(path, &pipeline_nodes);
+    if (best_pipeline < 0 || t < best_pipeline)
+      best_pipeline = t;
+  }
+
+  printf("{\"bench\": \"skipCommentsAndDirectives\", \"shape\": \"%s\", "
+         "\"bytes\": %zu, \"seconds\": %.6f, \"mb_per_s\": %.2f}\n",
+         generator_shapeName(shape), bytes, best_pp, bytes / best_pp / 1e6);
+  printf("{\"bench\": \"preprocessStream\", \"shape\": \"%s\", "
+         "\"bytes\": %zu, \"seconds\": %.6f, \"mb_per_s\": %.2f}\n",
+         generator_shapeName(shape), bytes, best_stream,
+         bytes / best_stream / 1e6);
+  printf("{\"bench\": \"preprocessLine\", \"shape\": \"%s\", "
+         "\"bytes\": %zu, \"seconds\": %.6f, \"mb_per_s\": %.2f}\n",
+         generator_shapeName(shape), bytes, best_lines,
+         bytes / best_lines / 1e6);
+  printf("{\"bench\": \"getNextToken\", \"shape\": \"%s\", \"bytes\": %ld, "
+         "\"tokens\": %ld, \"seconds\": %.6f, \"mb_per_s\": %.2f, "
+         "\"tokens_per_s\": %.0f}\n",
+         generator_shapeName(shape), temp_bytes, tokens, best_lex,
+         temp_bytes / best_lex / 1e6, tokens / best_lex);
+  printf("{\"bench\": \"getNextFusedToken\", \"shape\": \"%s\", "
+         "\"bytes\": %zu, \"tokens\": %ld, \"seconds\": %.6f, "
+         "\"mb_per_s\": %.2f, \"two_pass_seconds\": %.6f}\n",
+         generator_shapeName(shape), bytes, fused_tokens, best_fused,
+         bytes / best_fused / 1e6, best_pp + best_lex);
+  printf("{\"bench\": \"parseTranslationUnit\", \"shape\": \"%s\", "
+         "\"bytes\": %zu, \"nodes\": %ld, \"seconds\": %.6f, "
+         "\"mb_per_s\": %.2f, \"lex_seconds\": %.6f}\n",
+         generator_shapeName(shape), bytes, nodes, best_parse,
+         bytes / best_parse / 1e6, best_fused);
+  printf("{\"bench\": \"pipeline\", \"shape\": \"%s\", \"bytes\": %zu, "
+         "\"nodes\": %ld, \"seconds\": %.6f, \"mb_per_s\": %.2f, "
+         "\"sequential_seconds\": %.6f}\n",
+         generator_shapeName(shape), bytes, pipeline_nodes, best_pipeline,
+         bytes / best_pipeline / 1e6, best_parse);
+
+  benchXref(path, shape, best_fused);
+  remove(path);
+}
+
+static void benchHashMap(int bucket_limit, int count) {
+  char name[20];
+  Symbol **probes = malloc(sizeof(Symbol *) * count);
+
+  for (int i = 0; i < count; i++) {
+    snprintf(name, sizeof(name), "sym_%d", i);
+    probes[i] = symbol_create(name, 4, "int", "global");
+  }
+
+  HashMap *map = hashmap_create(bucket_limit, symbol_getIndex, symbol_compare);
+
+  double start = now();
+  for (int i = 0; i < count; i++)
+    hashmap_insert(map, symbol_create(probes[i]->lexeme, 4, "int", "global"));
+  double insert = now() - start;
+
+  int found = 0;
+  start = now();
+  for (int i = 0; i < count; i++)
+    found += hashmap_find(map, probes[i]) != NULL;
+  double find = now() - start;
+
+  printf("{\"bench\": \"hashmap_insert\", \"bucket_limit\": %d, \"ops\": %d, "
+         "\"global_depth\": %d, \"seconds\": %.6f, \"ops_per_s\": %.0f}\n",
+         bucket_limit, count, map->global_depth, insert, count / insert);
+  printf("{\"bench\": \"hashmap_find\", \"bucket_limit\": %d, \"ops\": %d, "
+         "\"found\": %d, \"seconds\": %.6f, \"ops_per_s\": %.0f}\n",
+         bucket_limit, count, found, find, count / find);
+
+  hashmap_destroy(map);
+  for (int i = 0; i < count; i++)
+    symbol_destroy(probes[i]);
+  free(probes);
+}
+
+static void benchSymbolMap(int bucket_limit, int count) {
+  Symbol *symbols = malloc(sizeof(Symbol) * count);
+  char name[20];
+
+  for (int i = 0; i < count; i++) {
+    snprintf(name, sizeof(name), "sym_%d", i);
+    symbol_init(&symbols[i], name, 4, "int", "global");
+  }
+
+  SymbolMap *map = SymbolMap_create(bucket_limit);
+
+  double start = now();
+  for (int i = 0; i < count; i++)
+    SymbolMap_insert(map, &symbols[i]);
+  double insert = now() - start;
+
+  int found = 0;
+  start = now();
+  for (int i = 0; i < count; i++)
+    found += SymbolMap_find(map, symbols[i].lexeme) != NULL;
+  double find = now() - start;
+
+  printf("{\"bench\": \"symbolmap_insert\", \"bucket_limit\": %d, "
+         "\"ops\": %d, \"global_depth\": %d, \"seconds\": %.6f, "
+         "\"ops_per_s\": %.0f}\n",
+         bucket_limit, count, map->global_depth, insert, count / insert);
+  printf("{\"bench\": \"symbolmap_find\", \"bucket_limit\": %d, "
+         "\"ops\": %d, \"found\": %d, \"seconds\": %.6f, "
+         "\"ops_per_s\": %.0f}\n",
+         bucket_limit, count, found, find, count / find);
+
+  SymbolMap_destroy(map);
+  free(symbols);
+}
+
+static size_t symbolMapBytes(const SymbolMap *map) {
+  size_t bytes =
+      sizeof(SymbolMap) + sizeof(SymbolMapBucket *) * map->dir_size;
+
+  for (int i = 0; i < map->dir_size; i++) {
+    if (SymbolMap_isFirst(map, i))
+      bytes += sizeof(SymbolMapBucket) +
+               sizeof(SymbolMapSlot) * map->bucket_limit;
+  }
+
+  return bytes;
+}
+
+static void benchSymbolTable(int bucket_limit, int count) {
+  char (*names)[24] = malloc(sizeof(*names) * count);
+  char scope[16];
+
+  for (int i = 0; i < count; i++)
+    snprintf(names[i], sizeof(names[i]), "sym_%d", i);
+
+  SymbolTable *table = symtab_create(bucket_limit);
+
+  double start = now();
+  for (int i = 0; i < count; i++) {
+    snprintf(scope, sizeof(scope), "fn_%d", i / 16);
+    symtab_insert(table, names[i], 4, "int", scope);
+  }
+  double insert = now() - start;
+
+  int found = 0;
+  start = now();
+  for (int i = 0; i < count; i++)
+    found += symtab_find(table, names[i]) != STRTAB_NONE;
+  double find = now() - start;
+
+  long long sum = 0;
+  start = now();
+  for (uint32_t i = 0; i < symtab_count(table); i++)
+    sum += table->sizes[i] + table->scopes[i];
+  double scan = now() - start;
+
+  SymbolMap *map = SymbolMap_create(bucket_limit);
+  Symbol sym;
+  for (int i = 0; i < count; i++) {
+    snprintf(scope, sizeof(scope), "fn_%d", i / 16);
+    symbol_init(&sym, names[i], 4, "int", scope);
+    SymbolMap_insert(map, &sym);
+  }
+
+  printf("{\"bench\": \"symtab_insert\", \"bucket_limit\": %d, "
+         "\"ops\": %d, \"seconds\": %.6f, \"ops_per_s\": %.0f}\n",
+         bucket_limit, count, insert, count / insert);
+  printf("{\"bench\": \"symtab_find\", \"bucket_limit\": %d, "
+         "\"ops\": %d, \"found\": %d, \"seconds\": %.6f, "
+         "\"ops_per_s\": %.0f}\n",
+         bucket_limit, count, found, find, count / find);
+  printf("{\"bench\": \"symtab_scan\", \"bucket_limit\": %d, "
+         "\"symbols\": %d, \"checksum\": %lld, \"seconds\": %.6f, "
+         "\"bytes_per_symbol\": %.1f, \"symbolmap_bytes_per_symbol\": %.1f}\n",
+         bucket_limit, count, sum, scan,
+         (double)symtab_bytes(table) / count,
+         (double)symbolMapBytes(map) / count);
+
+  SymbolMap_destroy(map);
+  symtab_destroy(table);
+  free(names);
+}
+
+/* Interning into a lexeme index sized by its limit and an expected count */
+static void benchStringIndex(int bucket_limit, size_t expected, int count) {
+  char (*names)[24] = malloc(sizeof(*names) * count);
+  StringTable t;
+
+  for (int i = 0; i < count; i++)
+    snprintf(names[i], sizeof(names[i]), "sym_%d", i);
+
+  double start = now();
+  strtab_init(&t, bucket_limit, expected);
+  for (int i = 0; i < count; i++)
+    strtab_intern(&t, names[i]);
+  double insert = now() - start;
+
+  int found = 0;
+  start = now();
+  for (int i = 0; i < count; i++)
+    found += strtab_find(&t, names[i]) != STRTAB_NONE;
+  double find = now() - start;
+
+  const StringIndex *index = t.index;
+  printf("{\"bench\": \"strtab_intern\", \"bucket_limit\": %d, "
+         "\"expected\": %zu, \"ops\": %d, \"found\": %d, \"splits\": %d, "
+         "\"doublings\": %d, \"global_depth\": %d, \"seconds\": %.6f, "
+         "\"ops_per_s\": %.0f, \"find_seconds\": %.6f}\n",
+         index->bucket_limit, expected, count, found, index->splits,
+         index->doublings, index->global_depth, insert, count / insert, find);
+
+  strtab_free(&t);
+  free(names);
+}
+
+/* Rebuilding a table insert by insert against mapping its image */
+static void benchSymbolImage(int bucket_limit, int count) {
+  char (*names)[24] = malloc(sizeof(*names) * count);
+  char scope[16];
+  const char *path = "bench_symbols.img";
+
+  for (int i = 0; i < count; i++)
+    snprintf(names[i], sizeof(names[i]), "sym_%d", i);
+
+  double start = now();
+  SymbolTable *table = symtab_create(bucket_limit);
+  for (int i = 0; i < count; i++) {
+    snprintf(scope, sizeof(scope), "fn_%d", i / 16);
+    symtab_insert(table, names[i], 4, "int", scope);
+  }
+  double rebuild = now() - start;
+
+  FILE *out = fopen(path, "wb");
+  if (!out || symimage_write(table, out) < 0) {
+    perror(path);
+    if (out)
+      fclose(out);
+    symtab_destroy(table);
+    free(names);
+    return;
+  }
+  long bytes = ftell(out);
+  fclose(out);
+  symtab_destroy(table);
+
+  start = now();
+  SymbolImage *img = symimage_open(path);
+  double open_time = now() - start;
+
+  int found = 0;
+  start = now();
+  for (int i = 0; img && i < count; i++)
+    found += symimage_find(img, names[i]) != STRTAB_NONE;
+  double find = now() - start;
+
+  printf("{\"bench\": \"symimage\", \"bucket_limit\": %d, "
+         "\"symbols\": %d, \"found\": %d, \"image_bytes\": %ld, "
+         "\"open_seconds\": %.6f, \"find_seconds\": %.6f, "
+         "\"rebuild_seconds\": %.6f}\n",
+         bucket_limit, count, found, bytes, open_time, find, rebuild);
+
+  symimage_close(img);
+  remove(path);
+  free(names);
+}
+
+int main(int argc, char *argv[]) {
+  size_t size = (argc > 1 ? atol(argv[1]) : 1024) * 1024;
+  unsigned int seed = argc > 2 ? atoi(argv[2]) : 42;
+  int repeats = argc > 3 ? atoi(argv[3]) : 3;
+
+  if (argc > 4 || size == 0 || repeats <= 0) {
+    printf("Use as ./bench [size-kb] [seed] [repeats]\n");
+    return 1;
+  }
+
+  for (int shape = 0; shape < GEN_SHAPE_COUNT; shape++)
+    benchSource(shape, size, seed, repeats);
+
+  static const int limits[] = {2, 4, 8, 16, 32, 64};
+  for (size_t i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+    benchHashMap(limits[i], 20000);
+    benchSymbolMap(limits[i], 20000);
+    benchSymbolTable(limits[i], 20000);
+    benchSymbolImage(limits[i], 20000);
+  }
+
+  /* The fixed limit compile() used to pass, against fitting a cache line */
+  static const int counts[] = {20000, 200000};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    benchStringIndex(3, 0, counts[i]);
+    benchStringIndex(HASHMAP_BUCKET_AUTO, 0, counts[i]);
+    benchStringIndex(HASHMAP_BUCKET_AUTO, counts[i], counts[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "generator.h"
+
+#include <stdarg.h>
+
+static const char *types[] = {"int", "char", "float", "double", "long"};
+static const char *words[] = {"lorem", "ipsum", "dolor", "sit",    "amet",
+                              "alpha", "beta",  "gamma", "delta",  "value",
+                              "count", "index", "total", "buffer", "node"};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct Gen {
+  FILE *out;
+  size_t written;
+  unsigned int state;
+  int next_id;
+} Gen;
+
+static unsigned int nextRandom(Gen *g) {
+  g->state ^= g->state << 13;
+  g->state ^= g->state >> 17;
+  g->state ^= g->state << 5;
+  return g->state;
+}
+
+static int pick(Gen *g, int n) { return nextRandom(g) % n; }
+
+static void emit(Gen *g, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vfprintf(g->out, fmt, args);
+  va_end(args);
+
+  if (n > 0)
+    g->written += n;
+}
+
+static void indent(Gen *g, int depth) {
+  for (int i = 0; i < depth; i++)
+    emit(g, "  ");
+}
+
+static void sentence(Gen *g, int words_count) {
+  for (int i = 0; i < words_count; i++)
+    emit(g, "%s%s", i ? " " : "", words[pick(g, COUNT(words))]);
+}
+
+static void blockComment(Gen *g) {
+  int lines = 1 + pick(g, 12);
+
+  emit(g, "/*");
+  for (int i = 0; i < lines; i++) {
+    emit(g, " * ");
+    sentence(g, 4 + pick(g, 10));
+    emit(g, "\n");
+  }
+  emit(g, " */\n");
+}
+
+static void lineComment(Gen *g) {
+  emit(g, "// ");
+  sentence(g, 3 + pick(g, 12));
+  emit(g, "\n");
+}
+
+static void declaration(Gen *g, int depth) {
+  indent(g, depth);
+  emit(g, "%s %s_%d = %d;\n", types[pick(g, COUNT(types))],
+       words[pick(g, COUNT(words))], g->next_id++, pick(g, 1000));
+}
+
+static void stringCall(Gen *g, int depth) {
+  indent(g, depth);
+  emit(g, "printf(\"");
+  sentence(g, 2 + pick(g, 8));
+  emit(g, pick(g, 2) ? " \\\"%%d\\\"\\n\", " : " %%s\\t%%d\\n\", ");
+  emit(g, "\"");
+  sentence(g, 1 + pick(g, 4));
+  emit(g, "\", %d);\n", pick(g, 100));
+}
+
+static void expression(Gen *g) {
+  int id = g->next_id ? pick(g, g->next_id) : 0;
+
+  emit(g, "%s_%d %s %d", words[id % COUNT(words)], id,
+       pick(g, 2) ? "<=" : "!=", pick(g, 100));
+}
+
+static void assignment(Gen *g, int depth) {
+  int a = g->next_id ? pick(g, g->next_id) : 0;
+  int b = g->next_id ? pick(g, g->next_id) : 0;
+
+  indent(g, depth);
+  emit(g, "%s_%d += %s_%d * %d;\n", words[a % COUNT(words)], a,
+       words[b % COUNT(words)], b, 1 + pick(g, 9));
+}
+
+static void nested(Gen *g, int depth, int max_depth) {
+  if (depth >= max_depth) {
+    assignment(g, depth);
+    return;
+  }
+
+  indent(g, depth);
+  emit(g, pick(g, 2) ? "if (" : "while (");
+  expression(g);
+  emit(g, " && ");
+  expression(g);
+  emit(g, ") {\n");
+
+  nested(g, depth + 1, max_depth);
+  if (pick(g, 2))
+    assignment(g, depth + 1);
+
+  indent(g, depth);
+  emit(g, "}\n");
+}
+
+static void function(Gen *g, GenShape shape, int max_depth) {
+  emit(g, "%s fn_%d(int a, int b) {\n", types[pick(g, COUNT(types))],
+       g->next_id++);
+
+  int statements = 4 + pick(g, 8);
+  for (int i = 0; i < statements; i++) {
+    GenShape s = shape == GEN_MIXED ? (GenShape)pick(g, GEN_SHAPE_COUNT) : shape;
+
+    switch (s) {
+    case GEN_COMMENTS:
+      indent(g, 1);
+      if (pick(g, 2))
+        lineComment(g);
+      else
+        blockComment(g);
+      break;
+    case GEN_STRINGS:
+      stringCall(g, 1);
+      break;
+    case GEN_NESTING:
+      nested(g, 1, 2 + pick(g, max_depth));
+      break;
+    default:
+      declaration(g, 1);
+      break;
+    }
+  }
+
+  emit(g, "  return a + b;\n}\n\n");
+}
+
+const char *generator_shapeName(GenShape shape) {
+  static const char *names[] = {"mixed", "comments", "strings", "identifiers",
+                                "nesting"};
+
+  if (shape < 0 || shape >= GEN_SHAPE_COUNT)
+    return "unknown";
+
+  return names[shape];
+}
+
+size_t generator_write(FILE *out, const GenOptions *opts) {
+  Gen g = {out, 0, opts->seed ? opts->seed : 1, 0};
+  int max_depth = opts->depth > 0 ? opts->depth : 8;
+
+  emit(&g, "#include <stdio.h>\n#define LIMIT %d\n\n", pick(&g, 1000));
+
+  while (g.written < opts->size) {
+    switch (opts->shape) {
+    case GEN_COMMENTS:
+      blockComment(&g);
+      break;
+    case GEN_IDENTIFIERS:
+      declaration(&g, 0);
+      break;
+    default:
+      break;
+    }
+
+    function(&g, opts->shape, max_depth);
+  }
+
+  return g.written;
+}
@@ -0,0 +1,26 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef enum GenShape {
+  GEN_MIXED,
+  GEN_COMMENTS,
+  GEN_STRINGS,
+  GEN_IDENTIFIERS,
+  GEN_NESTING,
+  GEN_SHAPE_COUNT
+} GenShape;
+
+typedef struct GenOptions {
+  GenShape shape;
+  size_t size;
+  unsigned int seed;
+  int depth;
+} GenOptions;
+
+const char *generator_shapeName(GenShape shape);
+size_t generator_write(FILE *out, const GenOptions *opts);
+
+#endif
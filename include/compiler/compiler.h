@@ -1,6 +1,35 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 
-void compile(const char *input_file);
+#include <stddef.h>
+
+typedef struct CompileOptions {
+  int fused;    /* lex with a FusedLexer instead of going through temp.c */
+  int dump_ast; /* print the parsed tree before the symbol table */
+
+  /* preprocess, lex and parse on three threads; ignored for buffers and
+   * with xref, where the line map is filled as the preprocessor goes */
+  int pipelined;
+
+  /* compile this buffer instead of reading input_file; implies fused */
+  const char *source;
+  size_t source_len;
+
+  /* if set, input_file's identifier occurrences replace its old ones here */
+  struct XrefIndex *xref;
+
+  /* names in this image are taken as declared and not collected again */
+  const struct SymbolImage *symbol_base;
+  /* if set, the finished symbol table is written here as an image */
+  const char *symbol_image;
+} CompileOptions;
+
+/*
+ * Preprocesses, lexes and parses `input_file`, printing the tokens as they
+ * are read, then fills the symbol table from the AST. Both lexing paths
+ * produce the same tokens. Returns 1 if the file cannot be read, has syntax
+ * errors or its symbol image cannot be written, and 0 otherwise.
+ */
+int compile(const char *input_file, const CompileOptions *options);
 
 #endif // !COMPILER_H
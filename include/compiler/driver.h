@@ -0,0 +1,15 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <stddef.h>
+
+/*
+ * Runs one `compile` command line (argv[0] is the program name) and returns
+ * its exit status. An input file of "-" is read from stdin, or is `source`
+ * when that is not NULL. Include paths and stats are reset per call; the
+ * header cache is kept unless --memory asks for a leak check.
+ */
+int runCompiler(int argc, char *argv[], const char *source,
+                size_t source_len);
+
+#endif
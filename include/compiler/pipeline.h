@@ -0,0 +1,27 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "compiler/stats.h"
+#include "lexer/token.h"
+
+typedef struct Pipeline Pipeline;
+
+/*
+ * Preprocesses and lexes `path` on two threads of their own while the caller
+ * takes the tokens: the preprocessor hands blocks of its output to a stream
+ * lexer, which hands batches of tokens on. Both hand-offs are bounded SPSC
+ * rings, so a stage that gets ahead waits instead of buffering the file.
+ * Returns NULL if the file or a thread cannot be opened.
+ */
+Pipeline *startPipeline(const char *path);
+
+/*
+ * The next token, in the order a FusedLexer would return them, with rows
+ * counted from the top of the file each token was written in
+ */
+Token *pipelineToken(Pipeline *p);
+
+/* Joins the stages and adds their stats to the caller's */
+void finishPipeline(Pipeline *p);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+#include "lexer/token.h"
+
+typedef enum Phase {
+  PHASE_PREPROCESS,
+  PHASE_LEX,
+  PHASE_PARSE, /* includes the lexing it pulls tokens from */
+  PHASE_SYMBOLS,
+  PHASE_TOTAL,
+  PHASE_COUNT
+} Phase;
+
+extern const char *phase_names[PHASE_COUNT];
+
+#define TOKEN_KIND_COUNT 13
+
+typedef struct Stats {
+  double phase_time[PHASE_COUNT];
+
+  long bytes_read;
+  long headers_read, includes_skipped;
+  long macro_expansions, bytes_skipped;
+  long tokens[TOKEN_KIND_COUNT];
+  long chars_pushed, chars_unread;
+  long ast_nodes;
+
+  long hashmap_splits, hashmap_doublings;
+  long max_chain;
+
+  long mallocs;
+} Stats;
+
+#ifdef COMPILER_STATS
+
+/* Per thread; a stage running on its own thread hands its copy back */
+extern _Thread_local Stats stats;
+
+double stats_now(void);
+void stats_countToken(const Token *tok);
+void stats_countHashMap(int splits, int doublings, int max_chain);
+void stats_merge(const Stats *from);
+
+#define STAT_RESET() (stats = (Stats){0})
+#define STAT_SAVE(to) ((to) = stats)
+#define STAT_MERGE(from) stats_merge(&(from))
+#define STAT_INC(field) (stats.field++)
+#define STAT_ADD(field, n) (stats.field += (n))
+#define STAT_TOKEN(tok) stats_countToken(tok)
+#define STAT_HASHMAP(map, max_chain)                                           \
+  stats_countHashMap((map)->splits, (map)->doublings, max_chain)
+#define STAT_BEGIN(phase) double stat_start_##phase = stats_now()
+#define STAT_END(phase)                                                        \
+  (stats.phase_time[phase] += stats_now() - stat_start_##phase)
+
+#else
+
+#define STAT_RESET() ((void)0)
+#define STAT_SAVE(to) ((void)0)
+#define STAT_MERGE(from) ((void)0)
+#define STAT_INC(field) ((void)0)
+#define STAT_ADD(field, n) ((void)0)
+#define STAT_TOKEN(tok) ((void)0)
+#define STAT_HASHMAP(map, max_chain) ((void)0)
+#define STAT_BEGIN(phase) ((void)0)
+#define STAT_END(phase) ((void)0)
+
+#endif
+
+int stats_print(FILE *out, int json);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include <stddef.h>
+
+#include "lexer/token.h"
+#include "preprocessor/linemap.h"
+
+typedef struct FusedLexer FusedLexer;
+
+/*
+ * Lexes a source file in one pass: comments and directive lines are skipped
+ * by the lexer itself while rows and columns are tracked as in the original,
+ * and no temp.c is written. Tokens are identical to running
+ * skipCommentsAndDirectives() and then getNextToken() over temp.c.
+ */
+FusedLexer *openFusedLexer(const char *path);
+
+/*
+ * Lexes a copy of `len` bytes of `text` as if it were the file `name`, which
+ * quoted includes are resolved against. `name` must outlive the lexer.
+ */
+FusedLexer *openFusedLexerBuffer(const char *name, const char *text,
+                                 size_t len);
+
+/* Returns the next block, valid until the next call, or NULL at the end */
+typedef const char *(*FusedBlockSource)(size_t *len, void *ctx);
+
+/*
+ * Lexes text that has been preprocessed already, such as the output of
+ * preprocessUnit(), as it is produced. Only the part of it the current token
+ * spans is kept.
+ */
+FusedLexer *openFusedLexerStream(FusedBlockSource next_block, void *ctx);
+
+Token *getNextFusedToken(FusedLexer *lx);
+
+/* Records in `lines` where included headers went; call before lexing */
+void trackFusedLines(FusedLexer *lx, LineMap *lines);
+void closeFusedLexer(FusedLexer *lx);
+
+#endif
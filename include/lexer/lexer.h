@@ -19,6 +19,7 @@ Token *isAddop(FILE *fp, int *row, int *col);
 Token *isLogicalop(FILE *fp, int *row, int *col);
 Token *isRelop(FILE *fp, int *row, int *col);
 
+void resetLexer(int row, int col, int index);
 Token *getNextToken(FILE *fp);
 
 #endif
@@ -1,6 +1,10 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 
+#include <string.h>
+
+#include "hashmap_typed.h"
+
 typedef struct Symbol {
     char lexeme[20];
     int size;
@@ -8,7 +12,23 @@ typedef struct Symbol {
     char scope[20];
 } Symbol;
 
+static inline unsigned int symbol_hash(const char *lexeme) {
+    unsigned int hash = 5381;
+    while (*lexeme)
+        hash = ((hash << 5) + hash) + *lexeme++;
+    return hash;
+}
+
+#define SYMBOL_KEY(sym) ((sym)->lexeme)
+#define SYMBOL_EQUAL(a, b) (strcmp((a), (b)) == 0)
+
+HASHMAP_DEFINE(SymbolMap, const char *, Symbol, SYMBOL_KEY, symbol_hash,
+               SYMBOL_EQUAL)
+
+void symbol_init(Symbol *sym, const char *lexeme, int size, const char *type,
+                 const char *scope);
 Symbol *symbol_create(char lexeme[], int size, char type[], char scope[]);
+void symbol_destroy(Symbol *sym);
 int symbol_compare(const Symbol *a, const Symbol *b);
 int symbol_getIndex(const Symbol *sym, int depth);
 
@@ -0,0 +1,85 @@
+#ifndef SYMIMAGE_H
+#define SYMIMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lexer/symtab.h"
+
+/*
+ * A finished SymbolTable laid out as one relocatable file: the string pools
+ * and their offsets, the size, type and scope columns, then the lexeme
+ * index's directory (bucket numbers) and its buckets of {hash, id} slots.
+ * Everything is a 32-bit word or an offset from the start, so the file is
+ * mapped and queried in place: opening it allocates only the handle and
+ * nothing is rehashed. Words are in the writer's byte order.
+ *
+ * Opening checks only the header and that each section lies in the file, so
+ * its cost does not grow with the table. Ids, offsets and buckets are checked
+ * as a lookup reaches them: a corrupt entry is not found, and reads as the
+ * empty string through the accessors.
+ */
+typedef struct SymbolImageHeader {
+  char magic[4];
+  uint32_t byte_order;
+  uint32_t size;
+
+  uint32_t count, name_count;
+  uint32_t global_depth, bucket_limit, bucket_count;
+
+  uint32_t lexeme_pool, lexeme_pool_len, lexeme_offsets;
+  uint32_t name_pool, name_pool_len, name_offsets;
+  uint32_t sizes, types, scopes;
+  uint32_t directory, buckets;
+} SymbolImageHeader;
+
+typedef struct SymbolImage {
+  void *base;
+  size_t size;
+
+  const char *lexeme_pool, *name_pool;
+  uint32_t lexeme_pool_len, name_pool_len, name_count;
+  const uint32_t *lexeme_offsets, *name_offsets;
+  const int32_t *sizes;
+  const uint32_t *types, *scopes;
+
+  const uint32_t *directory, *buckets;
+  uint32_t count, mask, bucket_count, bucket_limit, bucket_words;
+} SymbolImage;
+
+int symimage_write(const SymbolTable *t, FILE *out);
+
+/* Returns NULL if `path` cannot be mapped or is not a valid image */
+SymbolImage *symimage_open(const char *path);
+void symimage_close(SymbolImage *img);
+
+uint32_t symimage_find(const SymbolImage *img, const char *lexeme);
+
+static inline uint32_t symimage_count(const SymbolImage *img) {
+  return img->count;
+}
+
+/* `id` must be below symimage_count() */
+static inline const char *symimage_lexeme(const SymbolImage *img,
+                                          uint32_t id) {
+  uint32_t at = img->lexeme_offsets[id];
+  return at < img->lexeme_pool_len ? img->lexeme_pool + at : "";
+}
+
+static inline const char *symimage_name(const SymbolImage *img,
+                                        uint32_t name) {
+  uint32_t at = name < img->name_count ? img->name_offsets[name] : UINT32_MAX;
+  return at < img->name_pool_len ? img->name_pool + at : "";
+}
+
+static inline const char *symimage_type(const SymbolImage *img, uint32_t id) {
+  return symimage_name(img, img->types[id]);
+}
+
+static inline const char *symimage_scope(const SymbolImage *img,
+                                         uint32_t id) {
+  return symimage_name(img, img->scopes[id]);
+}
+
+#endif
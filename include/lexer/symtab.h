@@ -0,0 +1,84 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashmap_typed.h"
+#include "lexer/symbol.h"
+
+#define STRTAB_NONE UINT32_MAX
+
+/*
+ * Interns strings into one pool and hands out dense 32-bit IDs in insertion
+ * order. The index maps a string to its ID; its slots hold only the ID and
+ * the cached hash, the key is looked up through the table.
+ */
+typedef struct StringTable {
+  char *pool;
+  uint32_t pool_len, pool_capacity;
+
+  uint32_t *offsets;
+  uint32_t count, capacity;
+
+  struct StringIndex *index;
+} StringTable;
+
+#define STRTAB_KEY(table, id) ((table)->pool + (table)->offsets[*(id)])
+
+HASHMAP_DEFINE_CTX(StringIndex, const char *, uint32_t, StringTable,
+                   STRTAB_KEY, symbol_hash, SYMBOL_EQUAL)
+
+void strtab_init(StringTable *t, int bucket_limit, size_t expected);
+void strtab_free(StringTable *t);
+uint32_t strtab_intern(StringTable *t, const char *s);
+uint32_t strtab_find(const StringTable *t, const char *s);
+
+static inline const char *strtab_get(const StringTable *t, uint32_t id) {
+  return t->pool + t->offsets[id];
+}
+
+/*
+ * Symbols stored by column. A symbol's ID is its lexeme's ID, so inserting a
+ * lexeme that is already present keeps the first entry. Types and scopes
+ * share one interned table and are stored as its IDs. A lexeme found in the
+ * read-only `parent` image counts as present too.
+ */
+typedef struct SymbolTable {
+  StringTable lexemes;
+  StringTable names;
+
+  int32_t *sizes;
+  uint32_t *types;
+  uint32_t *scopes;
+  uint32_t capacity;
+
+  const struct SymbolImage *parent;
+} SymbolTable;
+
+SymbolTable *symtab_create(int bucket_limit);
+/* Sizes the lexeme index for about `expected` symbols up front */
+SymbolTable *symtab_createSized(int bucket_limit, size_t expected);
+void symtab_destroy(SymbolTable *t);
+int symtab_insert(SymbolTable *t, const char *lexeme, int size,
+                  const char *type, const char *scope);
+uint32_t symtab_find(const SymbolTable *t, const char *lexeme);
+size_t symtab_bytes(const SymbolTable *t);
+
+static inline uint32_t symtab_count(const SymbolTable *t) {
+  return t->lexemes.count;
+}
+
+static inline const char *symtab_lexeme(const SymbolTable *t, uint32_t id) {
+  return strtab_get(&t->lexemes, id);
+}
+
+static inline const char *symtab_type(const SymbolTable *t, uint32_t id) {
+  return strtab_get(&t->names, t->types[id]);
+}
+
+static inline const char *symtab_scope(const SymbolTable *t, uint32_t id) {
+  return strtab_get(&t->names, t->scopes[id]);
+}
+
+#endif
@@ -12,5 +12,9 @@ typedef struct Token {
 } Token;
 
 Token *token_create(char token_name[], int row, int col, int index, char type[]);
+void token_destroy(Token *tok);
+
+/* Whether `name` is one of the keywords both lexers recognize */
+int token_isKeyword(const char *name);
 
 #endif
@@ -0,0 +1,48 @@
+#ifndef TOKENSTREAM_H
+#define TOKENSTREAM_H
+
+#include <stddef.h>
+
+#include "lexer/token.h"
+#include "preprocessor/preprocessor.h"
+
+typedef struct LineInfo {
+  long offset;
+  PPState state;
+} LineInfo;
+
+/*
+ * Tokens of a source being edited, as getNextToken() reads them from what
+ * preprocessLine() leaves: comments and directive lines are blanked but
+ * nothing is expanded or included. Macro uses stay identifiers and headers
+ * add no tokens, so the stream matches the compiler's only for sources with
+ * neither; re-lexing a window cannot tell what a #define earlier in the file
+ * or in a header would do to it.
+ *
+ * The text, line starts and tokens are gap buffers with the gap left where
+ * the last edit was, so an edit costs its distance from the previous one and
+ * the re-lexed window, not the size of the file. Entries past a gap are kept
+ * relative to the end: a line's offset counts back from the end of the text,
+ * a token's row from line_count and its index from the identifier total.
+ */
+typedef struct TokenStream {
+  char *text;
+  size_t len, gap, gap_len;
+
+  Token **tokens;
+  int count, capacity, token_gap;
+  int identifiers;
+
+  LineInfo *lines;
+  int line_count, line_capacity, line_gap;
+} TokenStream;
+
+TokenStream *tokenstream_create(const char *text, size_t len);
+void tokenstream_edit(TokenStream *ts, size_t offset, size_t removed,
+                      const char *inserted, size_t inserted_len);
+void tokenstream_destroy(TokenStream *ts);
+
+/* Token `i` of `count`; moves the token gap past it to make it absolute */
+Token *tokenstream_token(TokenStream *ts, int i);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef XREF_H
+#define XREF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lexer/symtab.h"
+
+/*
+ * Inverted index from identifier to every place it occurs. Names and file
+ * paths are interned; each name keeps its occurrences in the order they were
+ * added, delta-encoded as zigzag varints: the file ID delta, then the row
+ * delta (from 0 after a file change), then the column delta (absolute after a
+ * row change). A typical occurrence takes three bytes.
+ */
+typedef struct XrefOccurrence {
+  uint32_t file;
+  uint32_t row, col;
+} XrefOccurrence;
+
+typedef struct XrefList {
+  uint8_t *data;
+  uint32_t len, capacity;
+  uint32_t count;
+  XrefOccurrence last;
+  uint32_t stamp;
+} XrefList;
+
+/* IDs of the names that occur in one file; may repeat */
+typedef struct XrefNames {
+  uint32_t *ids;
+  uint32_t count, capacity;
+} XrefNames;
+
+typedef struct XrefIndex {
+  StringTable names;
+  StringTable files;
+
+  XrefList *lists; /* by name ID */
+  uint32_t list_capacity;
+
+  XrefNames *file_names; /* by file ID */
+  uint32_t file_capacity;
+  uint32_t stamp;
+} XrefIndex;
+
+typedef struct XrefCursor {
+  const uint8_t *p, *end;
+  XrefOccurrence at;
+} XrefCursor;
+
+XrefIndex *xref_create(void);
+void xref_destroy(XrefIndex *index);
+
+uint32_t xref_file(XrefIndex *index, const char *path);
+uint32_t xref_name(XrefIndex *index, const char *name);
+void xref_add(XrefIndex *index, uint32_t name, uint32_t file, uint32_t row,
+              uint32_t col);
+
+/*
+ * Drops every occurrence in a file whose flag is set; indexed by file ID.
+ * Only the lists of names that occur in a flagged file are re-encoded.
+ */
+void xref_removeFiles(XrefIndex *index, const uint8_t *files);
+
+uint32_t xref_find(const XrefIndex *index, const char *name);
+uint32_t xref_count(const XrefIndex *index, uint32_t name);
+void xref_begin(const XrefIndex *index, uint32_t name, XrefCursor *cursor);
+int xref_next(XrefCursor *cursor, XrefOccurrence *out);
+
+static inline const char *xref_fileName(const XrefIndex *index,
+                                        uint32_t file) {
+  return strtab_get(&index->files, file);
+}
+
+/*
+ * Binary image: "XRF2", the offsets of the directory and of the lists, the
+ * file and name tables, a directory of the names sorted by spelling with
+ * each one's list offset, length and count, then each name's encoded list as
+ * is. xref_load() returns NULL for a malformed file.
+ *
+ * xref_loadName() reads only the file table, a binary search of the
+ * directory and the one list of `name`, which gets ID 0. The index it
+ * returns is meant for queries, not for adding to and saving.
+ */
+int xref_save(const XrefIndex *index, FILE *out);
+XrefIndex *xref_load(FILE *in);
+XrefIndex *xref_loadName(FILE *in, const char *name);
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Nodes live in one growable array and refer to each other by index, so the
+ * tree survives reallocation and is freed with a single ast_destroy(). Index
+ * 0 is a dummy node standing for "no node". Names and literals are kept in a
+ * string pool and referenced by offset; offset 0 is the empty string.
+ *
+ * AstNode pointers are invalidated by ast_add(); hold indices instead.
+ */
+typedef uint32_t AstIndex;
+
+#define AST_NULL 0
+
+typedef enum AstKind {
+  AST_NONE,
+  AST_TRANSLATION_UNIT, /* a: first declaration */
+
+  AST_DECLARATION, /* flags: storage, a: type, b: first declarator */
+  AST_TYPE,        /* op: type bits, text: tag or typedef name, a: members */
+  AST_ENUMERATOR,  /* text: name, a: value */
+  AST_VARIABLE,    /* text, flags: pointers, op: function pointer, a: init,
+                      b: dims, c: params */
+  AST_FUNCTION,    /* text, flags: pointers, a: first param, b: body */
+  AST_ARRAY,       /* a: size */
+  AST_PARAM,       /* a: type, b: declarator (its text may be empty) */
+  AST_ELLIPSIS,
+
+  AST_COMPOUND,  /* a: first item */
+  AST_IF,        /* a: cond, b: then, c: else */
+  AST_WHILE,     /* a: cond, b: body */
+  AST_DO,        /* a: body, b: cond */
+  AST_FOR,       /* a: AST_FOR_HEAD, b: body */
+  AST_FOR_HEAD,  /* a: init, b: cond, c: step */
+  AST_SWITCH,    /* a: expr, b: body */
+  AST_CASE,      /* a: value, b: statement */
+  AST_DEFAULT,   /* a: statement */
+  AST_LABEL,     /* text, a: statement */
+  AST_GOTO,      /* text */
+  AST_RETURN,    /* a: value */
+  AST_BREAK,
+  AST_CONTINUE,
+  AST_EXPR_STMT, /* a: expr */
+  AST_EMPTY,
+
+  AST_IDENT,  /* text */
+  AST_NUMBER, /* text */
+  AST_STRING, /* text, adjacent literals concatenated */
+  AST_CHAR,   /* text */
+  AST_UNARY,  /* op, a */
+  AST_POSTFIX,
+  AST_BINARY,      /* op, a, b */
+  AST_ASSIGN,      /* op, a, b */
+  AST_TERNARY,     /* a: cond, b, c */
+  AST_CALL,        /* a: callee, b: first argument */
+  AST_INDEX,       /* a, b */
+  AST_MEMBER,      /* text: field, flags: 1 for ->, a: object */
+  AST_CAST,        /* a: AST_PARAM type name, b: expr */
+  AST_SIZEOF,      /* a: expr or AST_PARAM type name */
+  AST_INIT_LIST,   /* a: first element */
+  AST_DESIGNATION, /* a: AST_MEMBER or AST_INDEX with no object, b: value */
+
+  AST_KIND_COUNT
+} AstKind;
+
+typedef enum AstOp {
+  OP_NONE,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_SHL,
+  OP_SHR,
+  OP_LT,
+  OP_GT,
+  OP_LE,
+  OP_GE,
+  OP_EQ,
+  OP_NE,
+  OP_BIT_AND,
+  OP_BIT_OR,
+  OP_BIT_XOR,
+  OP_AND,
+  OP_OR,
+  OP_COMMA,
+  OP_NOT,
+  OP_BIT_NOT,
+  OP_NEG,
+  OP_PLUS,
+  OP_DEREF,
+  OP_ADDR,
+  OP_INC,
+  OP_DEC,
+  OP_COUNT
+} AstOp;
+
+/* AST_TYPE op: the base type in the low bits, modifiers above */
+enum {
+  TYPE_NONE,
+  TYPE_VOID,
+  TYPE_CHAR,
+  TYPE_INT,
+  TYPE_FLOAT,
+  TYPE_DOUBLE,
+  TYPE_STRUCT,
+  TYPE_UNION,
+  TYPE_ENUM,
+  TYPE_NAME,
+  TYPE_FILE,
+  TYPE_SIZE_T,
+
+  TYPE_BASE_MASK = 0x0f,
+  TYPE_UNSIGNED = 0x10,
+  TYPE_SIGNED = 0x20,
+  TYPE_SHORT = 0x40,
+  TYPE_LONG = 0x80,
+  TYPE_LONG_LONG = 0x100,
+  TYPE_CONST = 0x200,
+  TYPE_VOLATILE = 0x400,
+  TYPE_DEFINED = 0x800 /* struct/union/enum with a body */
+};
+
+/* AST_DECLARATION flags */
+enum {
+  STORAGE_TYPEDEF = 0x01,
+  STORAGE_EXTERN = 0x02,
+  STORAGE_STATIC = 0x04,
+  STORAGE_AUTO = 0x08,
+  STORAGE_REGISTER = 0x10,
+  STORAGE_INLINE = 0x20
+};
+
+typedef struct AstNode {
+  uint8_t kind;
+  uint8_t flags;
+  uint16_t op;
+  uint32_t text;
+  uint32_t row, col;
+  AstIndex a, b, c;
+  AstIndex next;
+} AstNode;
+
+typedef struct Ast {
+  AstNode *nodes;
+  uint32_t count, capacity;
+
+  char *strings;
+  uint32_t strings_len, strings_capacity;
+
+  AstIndex root;
+} Ast;
+
+Ast *ast_create(void);
+void ast_destroy(Ast *ast);
+
+AstIndex ast_add(Ast *ast, AstKind kind, int row, int col);
+uint32_t ast_addText(Ast *ast, const char *text, size_t len);
+
+static inline AstNode *ast_node(const Ast *ast, AstIndex i) {
+  return &ast->nodes[i];
+}
+
+static inline const char *ast_text(const Ast *ast, AstIndex i) {
+  return ast->strings + ast->nodes[i].text;
+}
+
+const char *ast_kindName(AstKind kind);
+const char *ast_opName(AstOp op);
+void ast_print(FILE *out, const Ast *ast);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "lexer/token.h"
+#include "parser/ast.h"
+
+typedef Token *(*TokenSource)(void *ctx);
+
+/*
+ * Recursive-descent parser for the C subset the lexer recognizes. Tokens are
+ * pulled from `next` until its EOF token and destroyed once consumed; pieces
+ * the lexer splits (->, <<, !=, 0x1f, character literals, ...) are joined back
+ * when they are adjacent. Syntax errors are reported on stderr and parsing
+ * resumes at the next statement or declaration. If `errors` is not NULL it
+ * receives the number of errors.
+ */
+Ast *parseTranslationUnit(TokenSource next, void *ctx, int *errors);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef DIRECTIVE_H
+#define DIRECTIVE_H
+
+#include <stddef.h>
+
+#include "preprocessor/macro.h"
+
+typedef struct Header Header;
+
+typedef struct PPCondition {
+  int active, taken;
+  int parent_active;
+} PPCondition;
+
+/* `path` is the header being entered, or NULL on returning from one */
+typedef void (*PPIncludeHook)(const char *path, void *ctx);
+
+/*
+ * Per translation unit half of the preprocessor. It takes comment-stripped
+ * text and the directives found by a PPStream (or replayed from the header
+ * cache), tracks conditionals, keeps the macro table and expands macros.
+ * Disabled regions are reduced to their newlines without being scanned.
+ */
+typedef struct PPUnit {
+  MacroExpander expander;
+
+  PPCondition *conditions;
+  int condition_count, condition_capacity;
+  int skipping;
+
+  int include_depth;
+
+  /* Called with the output flushed, so the consumer knows where it is */
+  PPIncludeHook on_include;
+  void *include_ctx;
+} PPUnit;
+
+void initPPUnit(PPUnit *u, PPConsumer consume, void *ctx);
+void feedPPUnit(PPUnit *u, const char *text, size_t len);
+
+/*
+ * `from` is the file the directive came from. For #include, `target` (if not
+ * NULL) memoizes the resolved header.
+ */
+void handleDirective(PPUnit *u, const char *directive, size_t len,
+                     const char *from, Header **target);
+void finishPPUnit(PPUnit *u);
+
+#endif
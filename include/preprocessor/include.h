@@ -0,0 +1,34 @@
+#ifndef INCLUDE_H
+#define INCLUDE_H
+
+#include <stddef.h>
+
+#include "preprocessor/directive.h"
+
+#define PP_MAX_INCLUDE_DEPTH 200
+
+void addIncludePath(const char *dir);
+void clearIncludePaths(void);
+
+/*
+ * Resolves `name` against the directory of `from` (quoted form only) and then
+ * the include paths, and replays the header into `u`. Headers are read and
+ * comment-stripped once per process; their directives are kept with the text
+ * so conditionals and macros see the state of the including unit. #pragma
+ * once and classic #ifndef guards make repeat inclusions free. Returns 1 if
+ * the header was found, 0 for a missing <header>, -1 for a missing "header".
+ */
+int includeFile(PPUnit *u, const char *name, size_t len, int angled,
+                const char *from, Header **target);
+
+void resetIncludedHeaders(void);
+void clearHeaderCache(void);
+
+/*
+ * For long-running processes: if any cached header changed on disk since it
+ * was read, drops the whole cache (headers point at each other) and returns
+ * how many headers were dropped.
+ */
+int refreshHeaderCache(void);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef LINEMAP_H
+#define LINEMAP_H
+
+#include <stdint.h>
+
+/*
+ * Maps rows of the preprocessed text back to the file they came from. Each
+ * entry starts a run of rows from one file; within it the file's row is the
+ * preprocessed row minus `delta`. Included headers are spliced in whole, so
+ * a run is started on entering a header and again on returning from it. Of
+ * runs starting on the same row, the last one holds.
+ */
+typedef struct LineMapEntry {
+  uint32_t row;
+  int32_t delta;
+  const char *path;
+} LineMapEntry;
+
+typedef struct LineMapFrame {
+  const char *path;
+  uint32_t start;
+  int32_t delta;
+} LineMapFrame;
+
+typedef struct LineMap {
+  LineMapEntry *entries;
+  int count, capacity;
+
+  LineMapFrame *frames;
+  int depth, frame_capacity;
+} LineMap;
+
+/* `path` and every header path must outlive the map */
+void initLineMap(LineMap *m, const char *path);
+void freeLineMap(LineMap *m);
+
+/* `row` is the preprocessed row the header's text starts (or resumes) at */
+void enterLineMap(LineMap *m, const char *path, uint32_t row);
+void leaveLineMap(LineMap *m, uint32_t row);
+
+/* Adds entries copied from another map, as it grows, after those of `m` */
+void appendLineMap(LineMap *m, const LineMapEntry *entries, int count);
+
+/* The run `row` is in, looking on from `*at`; rows must not go back */
+static inline const LineMapEntry *lineMapFind(const LineMap *m, int *at,
+                                             uint32_t row) {
+  int i = *at;
+
+  while (i + 1 < m->count && m->entries[i + 1].row <= row)
+    i++;
+
+  *at = i;
+  return &m->entries[i];
+}
+
+static inline uint32_t lineMapRow(const LineMapEntry *e, uint32_t row) {
+  return row - e->delta;
+}
+
+#endif
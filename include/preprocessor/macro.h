@@ -0,0 +1,118 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "hashmap_typed.h"
+#include "preprocessor/preprocessor.h"
+
+typedef enum PPTokenKind {
+  PPT_IDENT,
+  PPT_NUMBER,
+  PPT_STRING,
+  PPT_CHAR,
+  PPT_PUNCT,
+  PPT_SPACE,
+  PPT_NEWLINE,
+
+  PPT_PARAM,
+  PPT_STRINGIFY,
+  PPT_PASTE,
+  PPT_END
+} PPTokenKind;
+
+typedef struct Macro Macro;
+
+typedef struct PPToken {
+  const char *text;
+  int len;
+
+  unsigned char kind;
+  unsigned char space;
+  unsigned char noexpand;
+
+  int param;
+  Macro *macro;
+} PPToken;
+
+typedef struct PPTokenList {
+  PPToken *items;
+  int count, capacity;
+} PPTokenList;
+
+typedef struct PPName {
+  const char *text;
+  int len;
+} PPName;
+
+struct Macro {
+  char *name;
+  int name_len;
+
+  char *text;
+  PPToken *body;
+  int body_count;
+
+  int param_count;
+  int variadic;
+  int pastes;
+  int active;
+};
+
+static inline unsigned int macro_hash(PPName name) {
+  unsigned int hash = 5381;
+  for (int i = 0; i < name.len; i++)
+    hash = ((hash << 5) + hash) + name.text[i];
+  return hash;
+}
+
+#define MACRO_KEY(m) ((PPName){(m)->name, (m)->name_len})
+#define MACRO_EQUAL(a, b)                                                      \
+  ((a).len == (b).len && memcmp((a).text, (b).text, (a).len) == 0)
+
+HASHMAP_DEFINE(MacroMap, PPName, Macro, MACRO_KEY, macro_hash, MACRO_EQUAL)
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct MacroExpander {
+  MacroMap *macros;
+  int macro_count;
+
+  PPConsumer consume;
+  void *ctx;
+
+  char *pending;
+  size_t pending_len, pending_capacity;
+
+  char *out;
+  size_t out_len, out_capacity;
+  char last;
+
+  ArenaChunk *arena;
+  int newlines;
+} MacroExpander;
+
+/*
+ * Scans one preprocessing token at `p`. Returns its length, or -1 when the
+ * token may continue past `end` and more input is expected (`final` is 0).
+ */
+int scanPPToken(const char *p, const char *end, int final, PPToken *tok);
+void pushPPToken(PPTokenList *list, PPToken tok);
+void freePPTokens(PPTokenList *list);
+
+void initExpander(MacroExpander *e, PPConsumer consume, void *ctx);
+void feedExpander(MacroExpander *e, const char *text, size_t len);
+void flushExpander(MacroExpander *e);
+void destroyExpander(MacroExpander *e);
+
+int defineMacro(MacroExpander *e, const char *text, size_t len);
+int undefineMacro(MacroExpander *e, const char *name, size_t len);
+Macro *findMacro(MacroExpander *e, const char *name, size_t len);
+
+/* Fully macro-expands `in` into `out`, as done for #if and arguments. */
+void expandPPTokens(MacroExpander *e, const PPToken *in, int count,
+                    PPTokenList *out);
+const char *copyToArena(MacroExpander *e, const char *text, size_t len);
+
+#endif
@@ -1,8 +1,50 @@
 #ifndef PREPROCESSOR_H
 #define PREPROCESSOR_H
 
+#include <stddef.h>
 #include <stdio.h>
 
-void skipCommentsAndDirectives(FILE *fp);
+#include "preprocessor/linemap.h"
+#include "preprocessor/scanner.h"
+
+#define PP_BLOCK_SIZE (64 * 1024)
+
+typedef void (*PPConsumer)(const char *block, size_t len, void *ctx);
+typedef void (*PPDirectiveHook)(const char *directive, size_t len, void *ctx);
+
+typedef struct PPStream {
+  PPScanner scan;
+
+  PPConsumer consume;
+  PPDirectiveHook on_directive;
+  void *ctx;
+
+  char *directive; /* grown as needed, freed by finishPPStream */
+  size_t directive_capacity;
+
+  size_t out_len;
+  char out[PP_BLOCK_SIZE];
+} PPStream;
+
+int preprocessLine(FILE *fp, FILE *out, PPState *state);
+
+void initPPStream(PPStream *s, PPConsumer consume, void *ctx);
+void feedPPStream(PPStream *s, const char *buf, size_t len);
+/* Passes on the output held so far without waiting for a full block */
+void flushPPStream(PPStream *s);
+void finishPPStream(PPStream *s);
+int readPPStream(PPStream *s, int fd);
+int preprocessStream(int fd, PPConsumer consume, void *ctx);
+
+/*
+ * Runs the whole preprocessor over the file `fd` (named `path`): comments,
+ * directives, includes and macros. The output goes to `consume` in blocks.
+ * `lines`, if not NULL, records where each header went.
+ */
+int preprocessUnit(int fd, const char *path, PPConsumer consume, void *ctx,
+                   LineMap *lines);
+
+/* Writes temp.c; `lines`, if not NULL, records where each header went */
+void skipCommentsAndDirectives(FILE *fp, const char *path, LineMap *lines);
 
 #endif
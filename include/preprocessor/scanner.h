@@ -0,0 +1,270 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <ctype.h>
+#include <stddef.h>
+
+typedef struct PPState {
+  int in_string, in_char, in_comment;
+  int start_of_line;
+  int in_directive; /* the last line ended in a backslash */
+} PPState;
+
+#define PP_STATE_INIT {0, 0, 0, 1, 0}
+
+enum {
+  PP_MODE_CODE,
+  PP_MODE_STRING_ESCAPE,
+  PP_MODE_CHAR_ESCAPE,
+  PP_MODE_LEADING_SPACE,
+  PP_MODE_DIRECTIVE,
+  PP_MODE_SLASH,
+  PP_MODE_LINE_COMMENT,
+  PP_MODE_BLOCK_COMMENT
+};
+
+/*
+ * The comment and directive state machine shared by preprocessLine(), the
+ * PPStream and the fused lexer. It takes source one character at a time and
+ * yields what temp.c holds for it: comments and directive lines become
+ * blanks, newlines are kept so rows stay put. Scanners are plain values, so
+ * a copy is a saved position.
+ */
+typedef struct PPScanner {
+  PPState state;
+  int mode, prev;
+  int joins; /* the directive text so far ends in a backslash */
+  size_t directive_len;
+} PPScanner;
+
+/* scanPPChar() result: the characters written, and whether a directive ended */
+#define PP_SCAN_COUNT 3
+#define PP_SCAN_DIRECTIVE 4
+
+/* Makes room for `len` bytes of directive text */
+void growDirective(char **text, size_t *capacity, size_t len);
+
+/* A scanner resuming at the start of a line in `state` */
+static inline PPScanner ppScannerAt(PPState state) {
+  PPScanner s = {state, PP_MODE_CODE, 0, 0, 0};
+
+  if (state.in_directive)
+    s.mode = PP_MODE_DIRECTIVE;
+  else if (state.in_comment)
+    s.mode = PP_MODE_BLOCK_COMMENT;
+  return s;
+}
+
+static inline int scanPPLineStart(PPScanner *s, char c, char *out) {
+  if (isspace((unsigned char)c) && c != '\n') {
+    out[0] = c;
+    s->mode = PP_MODE_LEADING_SPACE;
+    return 1;
+  }
+
+  if (c == '#') {
+    s->mode = PP_MODE_DIRECTIVE;
+    s->directive_len = 0;
+    s->prev = s->joins = 0;
+    return 0;
+  }
+
+  s->mode = PP_MODE_CODE;
+  s->state.start_of_line = 0;
+
+  if (c == '/') {
+    s->mode = PP_MODE_SLASH;
+    return 0;
+  }
+
+  out[0] = c;
+  s->state.start_of_line = (c == '\n');
+  return 1;
+}
+
+static inline int scanPPCode(PPScanner *s, char c, char *out) {
+  PPState *state = &s->state;
+
+  if (!state->in_char && c == '"' && !state->in_string) {
+    state->in_string = 1;
+    out[0] = c;
+    return 1;
+  } else if (state->in_string) {
+    out[0] = c;
+
+    if (c == '\\')
+      s->mode = PP_MODE_STRING_ESCAPE;
+    else if (c == '"')
+      state->in_string = 0;
+    return 1;
+  }
+
+  if (c == '\'' && !state->in_char) {
+    state->in_char = 1;
+    out[0] = c;
+    return 1;
+  } else if (state->in_char) {
+    out[0] = c;
+
+    if (c == '\\')
+      s->mode = PP_MODE_CHAR_ESCAPE;
+    else if (c == '\'')
+      state->in_char = 0;
+    return 1;
+  }
+
+  if (state->start_of_line)
+    return scanPPLineStart(s, c, out);
+
+  if (c == '/') {
+    s->mode = PP_MODE_SLASH;
+    return 0;
+  }
+
+  out[0] = c;
+  state->start_of_line = (c == '\n');
+  return 1;
+}
+
+/* Adds directive text that holds no newline, writing nothing */
+static inline void scanPPDirectiveText(PPScanner *s, const char *text,
+                                       size_t len, char **directive,
+                                       size_t *capacity) {
+  if (!len)
+    return;
+
+  char last = text[len - 1], before = len > 1 ? text[len - 2] : s->prev;
+
+  s->joins = last == '\\' || (last == '\r' && before == '\\');
+  s->prev = last;
+
+  if (directive) {
+    growDirective(directive, capacity, s->directive_len + len);
+    for (size_t i = 0; i < len; i++)
+      (*directive)[s->directive_len + i] = text[i];
+    s->directive_len += len;
+  }
+}
+
+/* Every mode but PP_MODE_CODE, which is the common one */
+static inline int scanPPOther(PPScanner *s, char c, char *out,
+                              char **directive, size_t *capacity) {
+  switch (s->mode) {
+  case PP_MODE_STRING_ESCAPE:
+  case PP_MODE_CHAR_ESCAPE:
+    out[0] = c;
+    s->mode = PP_MODE_CODE;
+    return 1;
+
+  case PP_MODE_LEADING_SPACE:
+    return scanPPLineStart(s, c, out);
+
+  case PP_MODE_DIRECTIVE:
+    if (c != '\n') {
+      out[0] = ' ';
+      scanPPDirectiveText(s, &c, 1, directive, capacity);
+      return 1;
+    }
+
+    /* The newline stays in the output to keep rows where they were */
+    out[0] = '\n';
+
+    if (s->joins) {
+      s->directive_len -= s->prev == '\r' ? 2 : 1;
+      s->prev = s->joins = 0;
+      s->state.in_directive = 1;
+      return 1;
+    }
+
+    s->state.in_directive = 0;
+    s->state.start_of_line = 1;
+    s->mode = PP_MODE_CODE;
+    return 1 | PP_SCAN_DIRECTIVE;
+
+  case PP_MODE_SLASH:
+    if (c == '/') {
+      s->mode = PP_MODE_LINE_COMMENT;
+      return 0;
+    }
+
+    if (c == '*') {
+      out[0] = out[1] = ' ';
+      s->state.in_comment = 1;
+      s->prev = 0;
+      s->mode = PP_MODE_BLOCK_COMMENT;
+      return 2;
+    }
+
+    out[0] = '/';
+    s->mode = PP_MODE_CODE;
+    return 1 + scanPPCode(s, c, out + 1);
+
+  case PP_MODE_LINE_COMMENT:
+    if (c != '\n')
+      return 0;
+
+    out[0] = '\n';
+    s->state.start_of_line = 1;
+    s->mode = PP_MODE_CODE;
+    return 1;
+
+  case PP_MODE_BLOCK_COMMENT:
+    if (c == '\n') {
+      out[0] = '\n';
+      s->state.start_of_line = 1;
+      s->prev = 0;
+      return 1;
+    }
+
+    out[0] = ' ';
+
+    if (s->prev == '*' && c == '/') {
+      s->state.in_comment = 0;
+      s->mode = PP_MODE_CODE;
+    }
+
+    s->prev = c;
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Feeds `c` and writes up to two characters of output to `out`. Directive
+ * text goes to `*directive` unless that is NULL; a backslash before the
+ * newline carries the directive on to the next line and is dropped from it.
+ */
+static inline int scanPPChar(PPScanner *s, char c, char *out, char **directive,
+                             size_t *capacity) {
+  if (s->mode == PP_MODE_CODE)
+    return scanPPCode(s, c, out);
+  return scanPPOther(s, c, out, directive, capacity);
+}
+
+/* Ends the input: closes an open directive, line comment or slash */
+static inline int finishPPScanner(PPScanner *s, char *out) {
+  int mode = s->mode;
+
+  s->mode = PP_MODE_CODE;
+
+  switch (mode) {
+  case PP_MODE_DIRECTIVE:
+    out[0] = '\n';
+    s->state.in_directive = 0;
+    s->state.start_of_line = 1;
+    return 1 | PP_SCAN_DIRECTIVE;
+
+  case PP_MODE_LINE_COMMENT:
+    out[0] = '\n';
+    return 1;
+
+  case PP_MODE_SLASH:
+    out[0] = '/';
+    return 1;
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERVER_SOCKET_ENV "COMPILE_SOCKET"
+#define SERVER_SOCKET_NAME "compile.sock"
+
+/* Seconds a client may stall while sending a request or reading the reply */
+#define SERVER_TIMEOUT 30
+
+#define SERVER_MAX_ARGS 4096
+#define SERVER_MAX_ARG_BYTES (1 << 20)
+#define SERVER_MAX_SOURCE ((uint64_t)1 << 30)
+
+/*
+ * One request per connection, integers in host byte order:
+ *
+ *   request:  uint32 count, uint32 size, then `size` bytes holding `count`
+ *             NUL-terminated strings (the client's working directory
+ *             followed by its compile arguments), then uint64 length and
+ *             that many bytes of source for an input of "-"
+ *   response: int32 exit status, uint64 stdout length, uint64 stderr length,
+ *             then the captured stdout and stderr
+ *
+ * A request whose only argument is --shutdown stops the server.
+ */
+
+/*
+ * $COMPILE_SOCKET, or compile.sock in $XDG_RUNTIME_DIR, or in
+ * /tmp/compile-<uid> when that is unset.
+ */
+const char *serverSocketPath(void);
+int connectServer(const char *path);
+
+int writeAll(int fd, const void *buf, size_t len);
+int readAll(int fd, void *buf, size_t len);
+
+#endif
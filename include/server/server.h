@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * Serves compile requests on the Unix socket at `path` until SIGINT, SIGTERM
+ * or a --shutdown request. The socket is only accessible to the current user,
+ * its directory must not be writable by others, and clients of another uid
+ * are turned away. Requests run one at a time in this process, in the
+ * client's working directory, with their stdout and stderr captured and sent
+ * back; a client that stalls for SERVER_TIMEOUT seconds is dropped. The
+ * header cache stays warm between requests and is dropped when a cached
+ * header changes on disk. Returns non-zero if the socket could not be set up.
+ */
+int runServer(const char *path);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef enum AllocModule {
+  ALLOC_LEXER,
+  ALLOC_TOKEN,
+  ALLOC_SYMBOL,
+  ALLOC_HASHMAP,
+  ALLOC_STACK,
+  ALLOC_PREPROCESSOR,
+  ALLOC_AST,
+  ALLOC_XREF,
+  ALLOC_QUEUE,
+  ALLOC_MODULE_COUNT
+} AllocModule;
+
+#define ALLOC_MAX_PHASES 8
+#define ALLOC_NO_PHASE -1
+
+typedef struct AllocCounters {
+  long live_bytes;
+  long peak_bytes;
+  long allocs;
+  long frees;
+} AllocCounters;
+
+#ifdef ALLOC_TRACKING
+
+void *alloc_malloc(AllocModule module, size_t size);
+void *alloc_calloc(AllocModule module, size_t n, size_t size);
+void *alloc_realloc(AllocModule module, void *ptr, size_t size);
+void alloc_free(void *ptr);
+
+int alloc_setPhase(int phase);
+
+const AllocCounters *alloc_moduleCounters(AllocModule module);
+const AllocCounters *alloc_phaseCounters(int phase);
+
+void alloc_report(FILE *out, const char *phase_names[], int phase_count,
+                  int json);
+int alloc_checkLeaks(FILE *out, const char *phase_names[], int phase_count);
+
+#else
+
+#define alloc_malloc(module, size) malloc(size)
+#define alloc_calloc(module, n, size) calloc(n, size)
+#define alloc_realloc(module, ptr, size) realloc(ptr, size)
+#define alloc_free(ptr) free(ptr)
+
+#define alloc_setPhase(phase) ((void)(phase), ALLOC_NO_PHASE)
+
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+#include "alloc.h"
+
+#ifdef ALLOC_TRACKING
+
+#include <pthread.h>
+#include <stdalign.h>
+
+typedef struct AllocHeader {
+  alignas(max_align_t) size_t size;
+  int module;
+  int phase;
+} AllocHeader;
+
+static const char *module_names[ALLOC_MODULE_COUNT] = {
+    "lexer", "token", "symbol", "hashmap", "stack", "preprocessor", "ast",
+    "xref", "queue"};
+
+static AllocCounters module_counters[ALLOC_MODULE_COUNT];
+static AllocCounters phase_counters[ALLOC_MAX_PHASES + 1];
+static AllocCounters total;
+
+/* Each thread runs its own phase; the counters are shared */
+static _Thread_local int current_phase = ALLOC_NO_PHASE;
+static pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static AllocCounters *phaseSlot(int phase) {
+  if (phase < 0 || phase >= ALLOC_MAX_PHASES)
+    return &phase_counters[ALLOC_MAX_PHASES];
+  return &phase_counters[phase];
+}
+
+static void grow(AllocCounters *c, size_t size) {
+  c->live_bytes += size;
+  c->allocs++;
+  if (c->live_bytes > c->peak_bytes)
+    c->peak_bytes = c->live_bytes;
+}
+
+static void shrink(AllocCounters *c, size_t size) {
+  c->live_bytes -= size;
+  c->frees++;
+}
+
+static void *track(AllocHeader *h, AllocModule module, size_t size) {
+  if (!h)
+    return NULL;
+
+  h->size = size;
+  h->module = module;
+  h->phase = current_phase;
+
+  pthread_mutex_lock(&counters_lock);
+  grow(&module_counters[module], size);
+  grow(phaseSlot(current_phase), size);
+  grow(&total, size);
+
+  AllocCounters *p = phaseSlot(current_phase);
+  if (total.live_bytes > p->peak_bytes)
+    p->peak_bytes = total.live_bytes;
+  pthread_mutex_unlock(&counters_lock);
+
+  return h + 1;
+}
+
+static void untrack(AllocHeader *h) {
+  pthread_mutex_lock(&counters_lock);
+  shrink(&module_counters[h->module], h->size);
+  shrink(phaseSlot(h->phase), h->size);
+  shrink(&total, h->size);
+  pthread_mutex_unlock(&counters_lock);
+}
+
+void *alloc_malloc(AllocModule module, size_t size) {
+  return track(malloc(sizeof(AllocHeader) + size), module, size);
+}
+
+void *alloc_calloc(AllocModule module, size_t n, size_t size) {
+  if (size && n > ((size_t)-1 - sizeof(AllocHeader)) / size)
+    return NULL;
+
+  return track(calloc(1, sizeof(AllocHeader) + n * size), module, n * size);
+}
+
+void *alloc_realloc(AllocModule module, void *ptr, size_t size) {
+  if (!ptr)
+    return alloc_malloc(module, size);
+
+  AllocHeader *h = (AllocHeader *)ptr - 1;
+  AllocHeader old = *h;
+
+  AllocHeader *grown = realloc(h, sizeof(AllocHeader) + size);
+  if (!grown)
+    return NULL;
+
+  untrack(&old);
+  return track(grown, old.module, size);
+}
+
+void alloc_free(void *ptr) {
+  if (!ptr)
+    return;
+
+  AllocHeader *h = (AllocHeader *)ptr - 1;
+  untrack(h);
+  free(h);
+}
+
+int alloc_setPhase(int phase) {
+  int prev = current_phase;
+  current_phase = phase;
+
+  pthread_mutex_lock(&counters_lock);
+  AllocCounters *p = phaseSlot(phase);
+  if (total.live_bytes > p->peak_bytes)
+    p->peak_bytes = total.live_bytes;
+  pthread_mutex_unlock(&counters_lock);
+
+  return prev;
+}
+
+const AllocCounters *alloc_moduleCounters(AllocModule module) {
+  if (module < 0 || module >= ALLOC_MODULE_COUNT)
+    return NULL;
+  return &module_counters[module];
+}
+
+const AllocCounters *alloc_phaseCounters(int phase) {
+  return phaseSlot(phase);
+}
+
+static const char *phaseName(const char *phase_names[], int phase_count,
+                             int i) {
+  if (i < phase_count && phase_names[i])
+    return phase_names[i];
+  return i == ALLOC_MAX_PHASES ? "(none)" : "?";
+}
+
+static void printCounters(FILE *out, const char *name, const AllocCounters *c,
+                          int json, int first) {
+  if (json) {
+    fprintf(out,
+            "%s\"%s\": {\"live_bytes\": %ld, \"peak_bytes\": %ld, "
+            "\"allocs\": %ld, \"frees\": %ld}",
+            first ? "" : ", ", name, c->live_bytes, c->peak_bytes, c->allocs,
+            c->frees);
+    return;
+  }
+
+  fprintf(out, "%-12s | live: %-10ld | peak: %-10ld | allocs: %-8ld | "
+               "frees: %-8ld\n",
+          name, c->live_bytes, c->peak_bytes, c->allocs, c->frees);
+}
+
+void alloc_report(FILE *out, const char *phase_names[], int phase_count,
+                  int json) {
+  fprintf(out, json ? "{\"modules\": {" : "\n=== Memory ===\n\n");
+
+  for (int i = 0; i < ALLOC_MODULE_COUNT; i++)
+    printCounters(out, module_names[i], &module_counters[i], json, i == 0);
+
+  fprintf(out, json ? "}, \"phases\": {" : "\n");
+
+  int first = 1;
+  for (int i = 0; i <= ALLOC_MAX_PHASES; i++) {
+    if (!phase_counters[i].allocs && i >= phase_count)
+      continue;
+
+    printCounters(out, phaseName(phase_names, phase_count, i),
+                  &phase_counters[i], json, first);
+    first = 0;
+  }
+
+  if (json) {
+    fprintf(out, "}, ");
+    printCounters(out, "total", &total, json, 1);
+    fprintf(out, "}\n");
+  } else {
+    fprintf(out, "\n");
+    printCounters(out, "total", &total, json, 1);
+    fprintf(out, "\n==============\n");
+  }
+}
+
+int alloc_checkLeaks(FILE *out, const char *phase_names[], int phase_count) {
+  int leaks = 0;
+
+  for (int i = 0; i <= ALLOC_MAX_PHASES; i++) {
+    if (phase_counters[i].live_bytes == 0)
+      continue;
+
+    fprintf(out, "leak: phase %s still holds %ld bytes in %ld allocations\n",
+            phaseName(phase_names, phase_count, i),
+            phase_counters[i].live_bytes,
+            phase_counters[i].allocs - phase_counters[i].frees);
+    leaks++;
+  }
+
+  return leaks;
+}
+
+#endif
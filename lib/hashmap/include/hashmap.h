@@ -9,13 +9,17 @@ typedef struct HashMap {
   int dir_size;
   Bucket **directory;
 
+  int splits;
+  int doublings;
+
   int (*getIndex)(const void *data, int depth);
   int (*comparator)(const void *a, const void *b);
 } HashMap;
 
 HashMap *hashmap_create(int bucket_limit, void *getIndexFunction, void *comparator);
-void hashmap_insert(HashMap *map, void *data);
+int hashmap_insert(HashMap *map, void *data);
 void *hashmap_find(HashMap *map, void *data);
+int hashmap_maxChain(const HashMap *map);
 void hashmap_destroy(HashMap *map);
 
 #endif
@@ -0,0 +1,338 @@
+#ifndef HASHMAP_TYPED_H
+#define HASHMAP_TYPED_H
+
+#include <string.h>
+
+#include "alloc.h"
+
+/*
+ * Generates an extendible hashmap specialised for one value type:
+ *
+ *   HASHMAP_DEFINE(Name, KeyType, ValueType, KEY_OF, HASH, EQUAL)
+ *
+ * KEY_OF(const ValueType *) yields the key of a stored value, HASH(key)
+ * returns an unsigned int and EQUAL(a, b) is non-zero for equal keys. All
+ * three are expanded inline. Values are copied into the buckets together with
+ * their hash, so splits never rehash. Pointers returned by Name_find() stay
+ * valid only until the next Name_insert() or Name_remove().
+ *
+ *   HASHMAP_DEFINE_CTX(Name, KeyType, ValueType, CtxType, KEY_OF, HASH, EQUAL)
+ *
+ * is the same, but the map carries a `CtxType *ctx` that the caller sets after
+ * Name_create() and KEY_OF(ctx, const ValueType *) receives. This lets the
+ * values be small handles, such as indices into a table owned elsewhere.
+ *
+ * A bucket_limit of HASHMAP_BUCKET_AUTO fits each bucket to a cache line.
+ * Name_createSized() also takes the number of values expected and starts
+ * with a directory deep enough for them, instead of doubling its way there.
+ *
+ * Values whose hashes are all equal cannot be told apart by splitting, so a
+ * full bucket holding only those grows past bucket_limit instead.
+ */
+#define HASHMAP_BUCKET_AUTO 0
+#define HASHMAP_CACHE_LINE 64
+#define HASHMAP_MIN_AUTO_LIMIT 4
+#define HASHMAP_MAX_SIZED_DEPTH 24
+#define HASHMAP_MAX_DEPTH 30 /* dir_size is an int */
+#define HASHMAP_DEFINE(NAME, K, V, KEY_OF, HASH, EQUAL)                        \
+  HASHMAP_TYPES(NAME, V, void)                                                 \
+                                                                               \
+  static inline K NAME##_keyOf(const NAME *map, const V *value) {              \
+    (void)map;                                                                 \
+    return KEY_OF(value);                                                      \
+  }                                                                            \
+                                                                               \
+  HASHMAP_FUNCTIONS(NAME, K, V, HASH, EQUAL)
+
+#define HASHMAP_DEFINE_CTX(NAME, K, V, CTX, KEY_OF, HASH, EQUAL)               \
+  HASHMAP_TYPES(NAME, V, CTX)                                                  \
+                                                                               \
+  static inline K NAME##_keyOf(const NAME *map, const V *value) {              \
+    return KEY_OF(map->ctx, value);                                            \
+  }                                                                            \
+                                                                               \
+  HASHMAP_FUNCTIONS(NAME, K, V, HASH, EQUAL)
+
+#define HASHMAP_TYPES(NAME, V, CTX)                                            \
+  typedef struct NAME##Slot {                                                  \
+    unsigned int hash;                                                         \
+    V value;                                                                   \
+  } NAME##Slot;                                                                \
+                                                                               \
+  typedef struct NAME##Bucket {                                                \
+    int local_depth;                                                           \
+    int size;                                                                  \
+    NAME##Slot slots[];                                                        \
+  } NAME##Bucket;                                                              \
+                                                                               \
+  typedef struct NAME {                                                        \
+    int global_depth;                                                          \
+    int bucket_limit;                                                          \
+    int dir_size;                                                              \
+    NAME##Bucket **directory;                                                  \
+                                                                               \
+    int splits;                                                                \
+    int doublings;                                                             \
+                                                                               \
+    CTX *ctx;                                                                  \
+  } NAME;
+
+#define HASHMAP_FUNCTIONS(NAME, K, V, HASH, EQUAL)                             \
+  static inline NAME##Bucket *NAME##_bucketCreate(NAME *map, int local_depth,  \
+                                                  int slots) {                 \
+    if (slots < map->bucket_limit)                                             \
+      slots = map->bucket_limit;                                               \
+                                                                               \
+    NAME##Bucket *b = alloc_malloc(                                            \
+        ALLOC_HASHMAP, sizeof(NAME##Bucket) + sizeof(NAME##Slot) * slots);     \
+    if (!b)                                                                    \
+      return NULL;                                                             \
+                                                                               \
+    b->local_depth = local_depth;                                              \
+    b->size = 0;                                                               \
+    return b;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* As many slots as fit in whole cache lines, at least a few */              \
+  static inline int NAME##_autoLimit(void) {                                   \
+    size_t bytes = HASHMAP_CACHE_LINE;                                         \
+                                                                               \
+    while ((bytes - sizeof(NAME##Bucket)) / sizeof(NAME##Slot) <               \
+           HASHMAP_MIN_AUTO_LIMIT)                                             \
+      bytes += HASHMAP_CACHE_LINE;                                             \
+                                                                               \
+    return (bytes - sizeof(NAME##Bucket)) / sizeof(NAME##Slot);                \
+  }                                                                            \
+                                                                               \
+  static inline NAME *NAME##_createSized(int bucket_limit, size_t expected) {  \
+    NAME *map = alloc_malloc(ALLOC_HASHMAP, sizeof(NAME));                     \
+    if (!map)                                                                  \
+      return NULL;                                                             \
+                                                                               \
+    map->bucket_limit =                                                        \
+        bucket_limit > 0 ? bucket_limit : NAME##_autoLimit();                  \
+    map->global_depth = 1;                                                     \
+                                                                               \
+    /* Buckets settle about 70% full, so plan on that */                       \
+    while (map->global_depth < HASHMAP_MAX_SIZED_DEPTH &&                      \
+           ((size_t)map->bucket_limit << map->global_depth) * 7 / 10 <         \
+               expected)                                                       \
+      map->global_depth++;                                                     \
+                                                                               \
+    map->dir_size = 1 << map->global_depth;                                    \
+    map->splits = 0;                                                           \
+    map->doublings = 0;                                                        \
+    map->ctx = NULL;                                                           \
+                                                                               \
+    map->directory =                                                           \
+        alloc_malloc(ALLOC_HASHMAP, sizeof(NAME##Bucket *) * map->dir_size);   \
+    for (int i = 0; i < map->dir_size; i++)                                    \
+      map->directory[i] = NAME##_bucketCreate(map, map->global_depth, 0);      \
+                                                                               \
+    return map;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline NAME *NAME##_create(int bucket_limit) {                        \
+    return NAME##_createSized(bucket_limit, 0);                                \
+  }                                                                            \
+                                                                               \
+  static inline V *NAME##_findHashed(NAME *map, K key, unsigned int hash) {    \
+    NAME##Bucket *b =                                                          \
+        map->directory[hash & ((1u << map->global_depth) - 1)];                \
+                                                                               \
+    for (int i = 0; i < b->size; i++) {                                        \
+      NAME##Slot *s = &b->slots[i];                                            \
+      if (s->hash == hash && EQUAL(NAME##_keyOf(map, &s->value), key))         \
+        return &s->value;                                                      \
+    }                                                                          \
+                                                                               \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline V *NAME##_find(NAME *map, K key) {                             \
+    if (!map)                                                                  \
+      return NULL;                                                             \
+                                                                               \
+    return NAME##_findHashed(map, key, HASH(key));                             \
+  }                                                                            \
+                                                                               \
+  static inline void NAME##_growDirectory(NAME *map, int depth) {              \
+    int old_size = map->dir_size;                                              \
+                                                                               \
+    map->doublings += depth - map->global_depth;                               \
+    map->global_depth = depth;                                                 \
+    map->dir_size = 1 << depth;                                                \
+                                                                               \
+    map->directory =                                                           \
+        alloc_realloc(ALLOC_HASHMAP, map->directory,                           \
+                      sizeof(NAME##Bucket *) * map->dir_size);                 \
+    for (int size = old_size; size < map->dir_size; size *= 2)                 \
+      memcpy(map->directory + size, map->directory,                            \
+             sizeof(NAME##Bucket *) * size);                                   \
+  }                                                                            \
+                                                                               \
+  /*                                                                           \
+   * Splits the full bucket `hash` falls in. Until the first bit on which its  \
+   * slots and `hash` differ, every split would leave one side empty, so those \
+   * levels are taken in one go: the directory grows once, each level gets an  \
+   * empty bucket for its other side and the slots move only once. Returns 0,  \
+   * changing nothing, if no bit within HASHMAP_MAX_DEPTH tells them apart.    \
+   */                                                                          \
+  static inline int NAME##_splitBucket(NAME *map, unsigned int hash) {         \
+    NAME##Bucket *old =                                                        \
+        map->directory[hash & ((1u << map->global_depth) - 1)];                \
+    unsigned int differ = 0;                                                   \
+                                                                               \
+    for (int i = 0; i < old->size; i++)                                        \
+      differ |= old->slots[i].hash ^ hash;                                     \
+                                                                               \
+    int from = old->local_depth, depth = from + 1;                             \
+    while (depth <= HASHMAP_MAX_DEPTH && !(differ & (1u << (depth - 1))))      \
+      depth++;                                                                 \
+                                                                               \
+    if (depth > HASHMAP_MAX_DEPTH)                                             \
+      return 0;                                                                \
+                                                                               \
+    if (depth > map->global_depth)                                             \
+      NAME##_growDirectory(map, depth);                                        \
+                                                                               \
+    NAME##Bucket *empty[HASHMAP_MAX_DEPTH];                                    \
+    for (int d = from; d < depth - 1; d++)                                     \
+      empty[d] = NAME##_bucketCreate(map, d + 1, 0);                           \
+                                                                               \
+    unsigned int bit = 1u << (depth - 1), step = 1u << from;                   \
+    int high = 0;                                                              \
+                                                                               \
+    for (int i = 0; i < old->size; i++)                                        \
+      high += (old->slots[i].hash & bit) != 0;                                 \
+                                                                               \
+    NAME##Bucket *lo = NAME##_bucketCreate(map, depth, old->size - high);      \
+    NAME##Bucket *hi = NAME##_bucketCreate(map, depth, high);                  \
+    map->splits++;                                                             \
+                                                                               \
+    /* Only every step-th slot of the directory pointed at the old bucket */   \
+    for (unsigned int i = hash & (step - 1); i < (unsigned int)map->dir_size;  \
+         i += step) {                                                          \
+      unsigned int apart = (i ^ hash) & (bit - 1);                             \
+      int d = from;                                                            \
+                                                                               \
+      if (!apart) {                                                            \
+        map->directory[i] = (i & bit) ? hi : lo;                               \
+        continue;                                                              \
+      }                                                                        \
+                                                                               \
+      while (!(apart & (1u << d)))                                             \
+        d++;                                                                   \
+      map->directory[i] = empty[d];                                            \
+    }                                                                          \
+                                                                               \
+    for (int i = old->size - 1; i >= 0; i--) {                                 \
+      NAME##Bucket *to = (old->slots[i].hash & bit) ? hi : lo;                 \
+      to->slots[to->size++] = old->slots[i];                                   \
+    }                                                                          \
+                                                                               \
+    alloc_free(old);                                                           \
+    return 1;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Makes room for one more slot in a bucket splitting cannot help */         \
+  static inline NAME##Bucket *NAME##_overflowBucket(NAME *map,                 \
+                                                    unsigned int hash) {       \
+    NAME##Bucket *old =                                                        \
+        map->directory[hash & ((1u << map->global_depth) - 1)];                \
+    NAME##Bucket *grown = alloc_malloc(                                        \
+        ALLOC_HASHMAP,                                                         \
+        sizeof(NAME##Bucket) + sizeof(NAME##Slot) * (old->size + 1));          \
+    unsigned int step = 1u << old->local_depth;                                \
+                                                                               \
+    memcpy(grown, old, sizeof(NAME##Bucket) + sizeof(NAME##Slot) * old->size); \
+    for (unsigned int i = hash & (step - 1); i < (unsigned int)map->dir_size;  \
+         i += step)                                                            \
+      map->directory[i] = grown;                                               \
+                                                                               \
+    alloc_free(old);                                                           \
+    return grown;                                                              \
+  }                                                                            \
+                                                                               \
+  /* Adds a value whose key is known to be absent */                           \
+  static inline void NAME##_insertHashed(NAME *map, const V *value,            \
+                                         unsigned int hash) {                  \
+    for (;;) {                                                                 \
+      unsigned int index = hash & ((1u << map->global_depth) - 1);             \
+      NAME##Bucket *b = map->directory[index];                                 \
+                                                                               \
+      if (b->size >= map->bucket_limit && NAME##_splitBucket(map, hash))       \
+        continue;                                                              \
+                                                                               \
+      if (b->size >= map->bucket_limit)                                        \
+        b = NAME##_overflowBucket(map, hash);                                  \
+                                                                               \
+      b->slots[b->size].hash = hash;                                           \
+      b->slots[b->size].value = *value;                                        \
+      b->size++;                                                               \
+      return;                                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline int NAME##_insert(NAME *map, const V *value) {                 \
+    if (!map || !value)                                                        \
+      return 0;                                                                \
+                                                                               \
+    K key = NAME##_keyOf(map, value);                                          \
+    unsigned int hash = HASH(key);                                             \
+    if (NAME##_findHashed(map, key, hash))                                     \
+      return 0;                                                                \
+                                                                               \
+    NAME##_insertHashed(map, value, hash);                                     \
+    return 1;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int NAME##_remove(NAME *map, K key) {                          \
+    if (!map)                                                                  \
+      return 0;                                                                \
+                                                                               \
+    unsigned int hash = HASH(key);                                             \
+    NAME##Bucket *b =                                                          \
+        map->directory[hash & ((1u << map->global_depth) - 1)];                \
+                                                                               \
+    for (int i = 0; i < b->size; i++) {                                        \
+      NAME##Slot *s = &b->slots[i];                                            \
+      if (s->hash == hash && EQUAL(NAME##_keyOf(map, &s->value), key)) {       \
+        memmove(s, s + 1, sizeof(NAME##Slot) * (b->size - i - 1));            \
+        b->size--;                                                             \
+        return 1;                                                              \
+      }                                                                        \
+    }                                                                          \
+                                                                               \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int NAME##_isFirst(const NAME *map, int index) {               \
+    return index < (1 << map->directory[index]->local_depth);                  \
+  }                                                                            \
+                                                                               \
+  static inline int NAME##_maxChain(const NAME *map) {                         \
+    int longest = 0;                                                           \
+                                                                               \
+    for (int i = 0; map && i < map->dir_size; i++) {                           \
+      if (map->directory[i]->size > longest)                                   \
+        longest = map->directory[i]->size;                                     \
+    }                                                                          \
+                                                                               \
+    return longest;                                                            \
+  }                                                                            \
+                                                                               \
+  static inline void NAME##_destroy(NAME *map) {                               \
+    if (!map)                                                                  \
+      return;                                                                  \
+                                                                               \
+    for (int i = map->dir_size - 1; i >= 0; i--) {                             \
+      if (NAME##_isFirst(map, i))                                              \
+        alloc_free(map->directory[i]);                                         \
+    }                                                                          \
+                                                                               \
+    alloc_free(map->directory);                                                \
+    alloc_free(map);                                                           \
+  }
+
+#endif
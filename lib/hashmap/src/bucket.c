@@ -1,9 +1,10 @@
 #include <stdlib.h>
 
+#include "alloc.h"
 #include "bucket.h"
 
 Bucket *bucket_create(int local_depth) {
-  Bucket *b = malloc(sizeof(Bucket));
+  Bucket *b = alloc_malloc(ALLOC_HASHMAP, sizeof(Bucket));
   if (!b)
     return NULL;
 
@@ -17,7 +18,7 @@ void bucket_insert(Bucket *bucket, void *data) {
   if (!bucket || !data)
     return;
 
-  Entry *e = malloc(sizeof(Entry));
+  Entry *e = alloc_malloc(ALLOC_HASHMAP, sizeof(Entry));
   if (!e)
     return;
 
@@ -35,8 +36,8 @@ void bucket_clear(Bucket *bucket) {
   while (curr) {
     Entry *next = curr->next;
 
-    free(curr->data);
-    free(curr);
+    alloc_free(curr->data);
+    alloc_free(curr);
 
     curr = next;
   }
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "hashmap.h"
 
 static void doubleDirectory(HashMap *map) {
@@ -8,8 +9,10 @@ static void doubleDirectory(HashMap *map) {
 
   map->dir_size *= 2;
   map->global_depth++;
+  map->doublings++;
 
-  map->directory = realloc(map->directory, sizeof(Bucket *) * map->dir_size);
+  map->directory = alloc_realloc(ALLOC_HASHMAP, map->directory,
+                                 sizeof(Bucket *) * map->dir_size);
 
   for (int i = 0; i < old_size; i++) {
     map->directory[i + old_size] = map->directory[i];
@@ -25,6 +28,7 @@ static void splitBucket(HashMap *map, int dir_index) {
 
   Bucket *new_bucket = bucket_create(old->local_depth + 1);
   old->local_depth++;
+  map->splits++;
 
   int bit = 1 << (old->local_depth - 1);
 
@@ -43,24 +47,27 @@ static void splitBucket(HashMap *map, int dir_index) {
     int idx = map->getIndex(curr->data, map->global_depth);
 
     bucket_insert(map->directory[idx], curr->data);
-    free(curr);
+    alloc_free(curr);
 
     curr = next;
   }
 }
 
 HashMap *hashmap_create(int bucket_limit, void *getIndexFunction, void *comparator) {
-  HashMap *map = malloc(sizeof(HashMap));
+  HashMap *map = alloc_malloc(ALLOC_HASHMAP, sizeof(HashMap));
   if (!map)
     return NULL;
 
   map->global_depth = 1;
   map->bucket_limit = bucket_limit;
   map->dir_size = 2;
+  map->splits = 0;
+  map->doublings = 0;
   map->getIndex = getIndexFunction;
   map->comparator = comparator;
 
-  map->directory = malloc(sizeof(Bucket *) * map->dir_size);
+  map->directory =
+      alloc_malloc(ALLOC_HASHMAP, sizeof(Bucket *) * map->dir_size);
 
   Bucket *b0 = bucket_create(1);
   Bucket *b1 = bucket_create(1);
@@ -71,23 +78,23 @@ HashMap *hashmap_create(int bucket_limit, void *getIndexFunction, void *comparat
   return map;
 }
 
-void hashmap_insert(HashMap *map, void *data) {
+int hashmap_insert(HashMap *map, void *data) {
   if (!map || !data)
-    return;
+    return 0;
 
   if (hashmap_find(map, data))
-    return;
+    return 0;
 
   int idx = map->getIndex(data, map->global_depth);
   Bucket *b = map->directory[idx];
 
   if (b->size < map->bucket_limit) {
     bucket_insert(b, data);
-    return;
+    return 1;
   }
 
   splitBucket(map, idx);
-  hashmap_insert(map, data);
+  return hashmap_insert(map, data);
 }
 
 void *hashmap_find(HashMap *map, void *data) {
@@ -105,6 +112,20 @@ void *hashmap_find(HashMap *map, void *data) {
   return NULL;
 }
 
+int hashmap_maxChain(const HashMap *map) {
+  if (!map)
+    return 0;
+
+  int longest = 0;
+
+  for (int i = 0; i < map->dir_size; i++) {
+    if (map->directory[i]->size > longest)
+      longest = map->directory[i]->size;
+  }
+
+  return longest;
+}
+
 void hashmap_destroy(HashMap *map) {
   if (!map)
     return;
@@ -122,10 +143,10 @@ void hashmap_destroy(HashMap *map) {
 
     if (unique) {
       bucket_clear(map->directory[i]);
-      free(map->directory[i]);
+      alloc_free(map->directory[i]);
     }
   }
 
-  free(map->directory);
-  free(map);
+  alloc_free(map->directory);
+  alloc_free(map);
 }
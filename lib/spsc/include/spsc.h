@@ -0,0 +1,45 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define SPSC_CACHE_LINE 64
+
+/*
+ * Bounded single-producer/single-consumer ring of fixed-size slots. Slots
+ * are filled and read in place. The two sides only share the head and tail
+ * counters, each on its own cache line, and wait by spinning then yielding
+ * (only yielding on one CPU, where the other side cannot run meanwhile), so a
+ * full ring holds the producer back and an empty one the consumer.
+ */
+typedef struct SpscQueue {
+  atomic_size_t head; /* next slot to read */
+  char head_pad[SPSC_CACHE_LINE - sizeof(atomic_size_t)];
+  atomic_size_t tail; /* next slot to fill */
+  char tail_pad[SPSC_CACHE_LINE - sizeof(atomic_size_t)];
+  atomic_int closed;
+
+  size_t mask, slot_size;
+  int spins; /* before each yield */
+  unsigned char *slots;
+
+  long full_waits;  /* producer side */
+  long empty_waits; /* consumer side */
+} SpscQueue;
+
+/* `capacity` is rounded up to a power of two */
+SpscQueue *spsc_create(size_t capacity, size_t slot_size);
+void spsc_destroy(SpscQueue *q);
+
+/* Producer: the slot to fill next, waiting while the ring is full */
+void *spsc_reserve(SpscQueue *q);
+void spsc_push(SpscQueue *q);
+/* Producer: no more slots will be pushed */
+void spsc_close(SpscQueue *q);
+
+/* Consumer: the oldest slot, waiting for one; NULL once closed and drained */
+void *spsc_front(SpscQueue *q);
+void spsc_pop(SpscQueue *q);
+
+#endif
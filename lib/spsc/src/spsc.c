@@ -0,0 +1,100 @@
+#include "alloc.h"
+#include "spsc.h"
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPSC_SPINS 128
+
+static void backoff(const SpscQueue *q, int *spins) {
+  if (++*spins < q->spins)
+    return;
+
+  *spins = 0;
+  sched_yield();
+}
+
+SpscQueue *spsc_create(size_t capacity, size_t slot_size) {
+  SpscQueue *q = alloc_malloc(ALLOC_QUEUE, sizeof(SpscQueue));
+  if (!q)
+    return NULL;
+
+  size_t size = 1;
+  while (size < capacity)
+    size *= 2;
+
+  memset(q, 0, sizeof(*q));
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->closed, 0);
+
+  q->mask = size - 1;
+  q->slot_size = slot_size;
+  q->spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPSC_SPINS : 0;
+  q->slots = alloc_malloc(ALLOC_QUEUE, size * slot_size);
+  if (!q->slots) {
+    alloc_free(q);
+    return NULL;
+  }
+
+  return q;
+}
+
+void spsc_destroy(SpscQueue *q) {
+  if (!q)
+    return;
+
+  alloc_free(q->slots);
+  alloc_free(q);
+}
+
+static void *slotAt(SpscQueue *q, size_t index) {
+  return q->slots + (index & q->mask) * q->slot_size;
+}
+
+void *spsc_reserve(SpscQueue *q) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  int spins = 0;
+
+  if (tail - atomic_load_explicit(&q->head, memory_order_acquire) > q->mask) {
+    q->full_waits++;
+    while (tail - atomic_load_explicit(&q->head, memory_order_acquire) >
+           q->mask)
+      backoff(q, &spins);
+  }
+
+  return slotAt(q, tail);
+}
+
+void spsc_push(SpscQueue *q) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+void spsc_close(SpscQueue *q) {
+  atomic_store_explicit(&q->closed, 1, memory_order_release);
+}
+
+void *spsc_front(SpscQueue *q) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  int spins = 0, waited = 0;
+
+  while (head == atomic_load_explicit(&q->tail, memory_order_acquire)) {
+    /* Closing comes after the last push, so look at the tail once more */
+    if (atomic_load_explicit(&q->closed, memory_order_acquire) &&
+        head == atomic_load_explicit(&q->tail, memory_order_acquire))
+      return NULL;
+
+    if (!waited++)
+      q->empty_waits++;
+    backoff(q, &spins);
+  }
+
+  return slotAt(q, head);
+}
+
+void spsc_pop(SpscQueue *q) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
@@ -0,0 +1,52 @@
+#include "alloc.h"
+#include "stack.h"
+
+Stack *stack_create() {
+  Stack *stk = alloc_malloc(ALLOC_STACK, sizeof(Stack));
+  if (!stk)
+    return NULL;
+
+  stk->head = NULL;
+  return stk;
+}
+
+void stack_push(Stack *stk, void *data) {
+  if (!stk)
+    return;
+
+  StackNode *node = alloc_malloc(ALLOC_STACK, sizeof(StackNode));
+  if (!node)
+    return;
+
+  node->data = data;
+  node->next = stk->head;
+  stk->head = node;
+}
+
+void *stack_top(Stack *stk) {
+  if (!stk || !stk->head)
+    return NULL;
+
+  return stk->head->data;
+}
+
+void stack_pop(Stack *stk) {
+  if (!stk || !stk->head)
+    return;
+
+  StackNode *node = stk->head;
+  stk->head = node->next;
+
+  alloc_free(node->data);
+  alloc_free(node);
+}
+
+void stack_destroy(Stack *stk) {
+  if (!stk)
+    return;
+
+  while (stk->head)
+    stack_pop(stk);
+
+  alloc_free(stk);
+}
@@ -0,0 +1,125 @@
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "server/protocol.h"
+
+static char *readStdin(size_t *len) {
+  size_t capacity = 1 << 16;
+  char *buf = malloc(capacity);
+  size_t n;
+
+  *len = 0;
+  while ((n = fread(buf + *len, 1, capacity - *len, stdin)) > 0) {
+    *len += n;
+    if (*len == capacity) {
+      capacity *= 2;
+      buf = realloc(buf, capacity);
+    }
+  }
+
+  return buf;
+}
+
+static int sendRequest(int fd, const char *cwd, int argc, char *argv[],
+                       const char *source, uint64_t source_len) {
+  uint32_t count = argc + 1, size = strlen(cwd) + 1;
+
+  for (int i = 0; i < argc; i++)
+    size += strlen(argv[i]) + 1;
+
+  if (writeAll(fd, &count, sizeof(count)) < 0 ||
+      writeAll(fd, &size, sizeof(size)) < 0 ||
+      writeAll(fd, cwd, strlen(cwd) + 1) < 0)
+    return -1;
+
+  for (int i = 0; i < argc; i++) {
+    if (writeAll(fd, argv[i], strlen(argv[i]) + 1) < 0)
+      return -1;
+  }
+
+  if (writeAll(fd, &source_len, sizeof(source_len)) < 0 ||
+      writeAll(fd, source, source_len) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int copyOut(int fd, FILE *to, uint64_t len) {
+  char buf[1 << 16];
+
+  while (len) {
+    size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    if (readAll(fd, buf, n) < 0)
+      return -1;
+    fwrite(buf, 1, n, to);
+    len -= n;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = serverSocketPath();
+  int first = 1;
+
+  if (argc > 2 && strcmp(argv[1], "--socket") == 0) {
+    path = argv[2];
+    first = 3;
+  }
+
+  if (first >= argc) {
+    printf("Use as ./compile-client [--socket <path>] [--shutdown | "
+           "<compile arguments>...]\n"
+           "Start the server with ./compile --server [<path>]; the socket "
+           "defaults to $%s or %s\n",
+           SERVER_SOCKET_ENV, serverSocketPath());
+    return 0;
+  }
+
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    perror("getcwd");
+    return 1;
+  }
+
+  char *source = NULL;
+  size_t source_len = 0;
+
+  for (int i = first; i < argc; i++) {
+    if (strcmp(argv[i], "-") == 0) {
+      source = readStdin(&source_len);
+      break;
+    }
+  }
+
+  /* A server that turns us away shows up as a failed write, not SIGPIPE */
+  signal(SIGPIPE, SIG_IGN);
+
+  int fd = connectServer(path);
+  if (fd < 0) {
+    perror(path);
+    free(source);
+    return 1;
+  }
+
+  int32_t status = 1;
+  uint64_t out_len, err_len;
+
+  if (sendRequest(fd, cwd, argc - first, argv + first, source, source_len) <
+          0 ||
+      readAll(fd, &status, sizeof(status)) < 0 ||
+      readAll(fd, &out_len, sizeof(out_len)) < 0 ||
+      readAll(fd, &err_len, sizeof(err_len)) < 0 ||
+      copyOut(fd, stdout, out_len) < 0 || copyOut(fd, stderr, err_len) < 0) {
+    fprintf(stderr, "%s: connection to the compile server failed\n", path);
+    status = 1;
+  }
+
+  close(fd);
+  free(source);
+  return status;
+}
@@ -1,43 +1,51 @@
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "compiler/compiler.h"
+#include "compiler/pipeline.h"
+#include "compiler/stats.h"
 #include "preprocessor/preprocessor.h"
 
+#include "lexer/fused.h"
 #include "lexer/lexer.h"
-#include "lexer/symbol.h"
+#include "lexer/symimage.h"
+#include "lexer/symtab.h"
 #include "lexer/token.h"
+#include "lexer/xref.h"
 
-#include "hashmap.h"
+#include "parser/parser.h"
 
-static void displayHashMap(HashMap *map) {
-  if (!map)
-    return;
+#include "alloc.h"
 
+static void displaySymbols(const SymbolTable *table) {
   printf("\n=== Symbol Table ===\n\n");
 
-  for (int i = 0; i < map->dir_size; i++) {
-    Bucket *b = map->directory[i];
+  for (uint32_t i = 0; i < symtab_count(table); i++)
+    printf("id: %-4u | lexeme: %-15s | size: %-4d | type: %-12s | scope: "
+           "%-8s\n",
+           i, symtab_lexeme(table, i), table->sizes[i], symtab_type(table, i),
+           symtab_scope(table, i));
 
-    int seen = 0;
-    for (int j = 0; j < i; j++) {
-      if (map->directory[j] == b) {
-        seen = 1;
-        break;
-      }
-    }
+  printf("\n====================\n");
+}
 
-    if (seen)
-      continue;
+/* Written next to `path` and renamed, so a mapped image never changes */
+static int saveSymbols(const SymbolTable *table, const char *path) {
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
 
-    for (Entry *e = b->head; e; e = e->next) {
-      Symbol *s = (Symbol *)e->data;
-      printf("hash: %-4d | lexeme: %-15s | size: %-4d | type: %-12s | scope: "
-             "%-8s\n",
-             i, s->lexeme, s->size, s->type, s->scope);
-    }
+  FILE *out = fopen(tmp, "wb");
+  int ok = out && symimage_write(table, out) == 0;
+
+  if ((out && fclose(out) != 0) || !ok || rename(tmp, path) < 0) {
+    perror(path);
+    remove(tmp);
+    return -1;
   }
 
-  printf("\n====================\n");
+  return 0;
 }
 
 static void displayToken(Token *tok) {
@@ -45,107 +53,522 @@ static void displayToken(Token *tok) {
          tok->index, tok->type);
 }
 
-static int isTypeKeyword(const char *s) {
-  static const char *types[] = {"int",  "void",  "char",   "double",  "float",
-                                "long", "short", "signed", "unsigned"};
-  static const int sizes[] = {sizeof(int),     0,
-                              sizeof(char),    sizeof(double),
-                              sizeof(float),   sizeof(long),
-                              sizeof(short),   sizeof(int),
-                              sizeof(unsigned)};
+static Token *nextToken(FILE *fp, FusedLexer *lx) {
+  int phase = alloc_setPhase(PHASE_LEX);
+  STAT_BEGIN(PHASE_LEX);
+  Token *tok = lx ? getNextFusedToken(lx) : getNextToken(fp);
+  STAT_END(PHASE_LEX);
+  (void)alloc_setPhase(phase);
+  return tok;
+}
+
+typedef struct XrefItem {
+  uint32_t name;
+  XrefOccurrence at;
+} XrefItem;
+
+/*
+ * A unit's occurrences are kept aside while it is parsed and then replace
+ * the old ones of every file it read, headers included, so a header's are
+ * not added again each time it is compiled.
+ */
+typedef struct XrefBatch {
+  XrefIndex *index;
+  LineMap lines;
+  const char *main_path;
+  uint32_t main_file;
+
+  int segment; /* of the line map, whose file ID is `file` */
+  uint32_t file;
+
+  /* Furthest position recorded per file ID, as row << 32 | col */
+  uint64_t *seen;
+  uint32_t seen_capacity;
+
+  XrefItem *items;
+  uint32_t count, capacity;
+} XrefBatch;
+
+static void beginXref(XrefBatch *b, XrefIndex *index, const char *input_file,
+                      int buffer) {
+  char path[PATH_MAX];
+  const char *name = input_file;
+
+  if (buffer)
+    name = "<stdin>";
+  else if (realpath(input_file, path))
+    name = path;
+
+  memset(b, 0, sizeof(*b));
+  b->index = index;
+  b->main_path = input_file;
+  b->main_file = b->file = xref_file(index, name);
+  initLineMap(&b->lines, input_file);
+}
+
+static uint32_t segmentFile(XrefBatch *b, int segment) {
+  const char *path = b->lines.entries[segment].path;
+  return path == b->main_path ? b->main_file : xref_file(b->index, path);
+}
+
+/* `tok`'s row is already its file's, and `segment` says which file */
+static void recordXref(XrefBatch *b, const Token *tok, int segment) {
+  if (segment != b->segment) {
+    b->segment = segment;
+    b->file = segmentFile(b, segment);
+  }
+
+  if (b->file >= b->seen_capacity) {
+    uint32_t old = b->seen_capacity;
+
+    b->seen_capacity = old ? old : 16;
+    while (b->file >= b->seen_capacity)
+      b->seen_capacity *= 2;
+    b->seen = alloc_realloc(ALLOC_XREF, b->seen,
+                            sizeof(uint64_t) * b->seen_capacity);
+    memset(b->seen + old, 0, sizeof(uint64_t) * (b->seen_capacity - old));
+  }
+
+  /* A header included again repeats positions it has already recorded */
+  uint64_t at = (uint64_t)tok->row << 32 | tok->col;
+  if (at <= b->seen[b->file])
+    return;
+  b->seen[b->file] = at;
 
-  for (int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
-    if (strcmp(s, types[i]) == 0)
-      return sizes[i];
+  if (b->count == b->capacity) {
+    b->capacity = b->capacity ? b->capacity * 2 : 256;
+    b->items =
+        alloc_realloc(ALLOC_XREF, b->items, sizeof(XrefItem) * b->capacity);
   }
 
-  return -1;
+  XrefItem *item = &b->items[b->count++];
+  item->name = xref_name(b->index, tok->token_name);
+  item->at = (XrefOccurrence){b->file, at >> 32, (uint32_t)at};
 }
 
-static int isBuiltin(const char *s) {
-  static const char *funcs[] = {"printf", "scanf",  "fopen",
-                                "fclose", "malloc", "calloc",
-                                "strlen", "strcpy", "strcmp"};
+static void commitXref(XrefBatch *b) {
+  /* Intern every path first so the flags cover all file IDs */
+  for (int i = 0; i < b->lines.count; i++)
+    (void)segmentFile(b, i);
+
+  uint8_t *touched = alloc_calloc(ALLOC_XREF, b->index->files.count, 1);
+
+  touched[b->main_file] = 1;
+  for (int i = 0; i < b->lines.count; i++)
+    touched[segmentFile(b, i)] = 1;
+
+  xref_removeFiles(b->index, touched);
 
-  for (int i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
-    if (strcmp(s, funcs[i]) == 0)
-      return 1;
+  for (uint32_t i = 0; i < b->count; i++) {
+    const XrefItem *item = &b->items[i];
+    xref_add(b->index, item->name, item->at.file, item->at.row, item->at.col);
   }
 
-  return 0;
+  alloc_free(touched);
+  alloc_free(b->seen);
+  alloc_free(b->items);
+  freeLineMap(&b->lines);
 }
 
-void compile(const char *input_file) {
+typedef struct Source {
+  FILE *fp;
+  FusedLexer *lx;
+  Pipeline *pipe;
+  XrefBatch *xref;
 
-  FILE *fp = fopen(input_file, "r");
-  skipCommentsAndDirectives(fp);
-  fclose(fp);
+  /* Where included headers went; a pipeline maps rows itself */
+  LineMap *lines;
+  int segment;
+} Source;
 
-  FILE *temp_fp = fopen("temp.c", "r");
+static Token *pullToken(void *ctx) {
+  Source *src = ctx;
+  Token *tok =
+      src->pipe ? pipelineToken(src->pipe) : nextToken(src->fp, src->lx);
 
-  HashMap *map = hashmap_create(3, symbol_getIndex, symbol_compare);
+  if (!tok)
+    return tok;
 
-  Token *prev = NULL;
-  Token *curr = getNextToken(temp_fp);
+  /* Rows count from the top of the file the token was written in */
+  if (src->lines)
+    tok->row = lineMapRow(lineMapFind(src->lines, &src->segment, tok->row),
+                          tok->row);
 
-  char last_type[64] = "";
-  int last_type_row = -1;
+  if (strcmp(tok->type, "EOF") == 0)
+    return tok;
 
-  while (curr && strcmp(curr->type, "EOF") != 0) {
-    displayToken(curr);
+  displayToken(tok);
+
+  if (src->xref && strcmp(tok->type, "IDENTIFIER") == 0)
+    recordXref(src->xref, tok, src->segment);
+
+  return tok;
+}
+
+static int baseSize(const AstNode *type) {
+  int bits = type->op;
+
+  if (bits & TYPE_LONG_LONG)
+    return sizeof(long long);
+  if (bits & TYPE_LONG)
+    return (bits & TYPE_BASE_MASK) == TYPE_DOUBLE ? (int)sizeof(long double)
+                                                  : (int)sizeof(long);
+  if (bits & TYPE_SHORT)
+    return sizeof(short);
+
+  switch (bits & TYPE_BASE_MASK) {
+  case TYPE_VOID:
+    return 0;
+  case TYPE_CHAR:
+    return sizeof(char);
+  case TYPE_INT:
+  case TYPE_ENUM:
+    return sizeof(int);
+  case TYPE_FLOAT:
+    return sizeof(float);
+  case TYPE_DOUBLE:
+    return sizeof(double);
+  case TYPE_FILE:
+    return sizeof(FILE);
+  case TYPE_SIZE_T:
+    return sizeof(size_t);
+  default:
+    return -1;
+  }
+}
+
+/* Size of a declarator of the given type; -1 when it is not known */
+static int declaratorSize(const Ast *ast, AstIndex type, AstIndex d) {
+  const AstNode *n = ast_node(ast, d);
+  int size = n->flags ? (int)sizeof(void *) : baseSize(ast_node(ast, type));
+
+  if (n->kind == AST_FUNCTION)
+    return size;
+
+  for (AstIndex dim = n->b; dim != AST_NULL && size > 0;
+       dim = ast_node(ast, dim)->next) {
+    AstIndex len = ast_node(ast, dim)->a;
+
+    if (len == AST_NULL || ast_node(ast, len)->kind != AST_NUMBER)
+      return -1;
+    size *= (int)strtol(ast_text(ast, len), NULL, 0);
+  }
+
+  return size;
+}
+
+/* Writes at most `len` bytes; returns the length the full string needs */
+static size_t typeString(const Ast *ast, AstIndex type, AstIndex d, char *out,
+                         size_t len) {
+  static const char *bases[] = {"",       "void",  "char",   "int",
+                                "float",  "double", "struct", "union",
+                                "enum",   "",       "FILE",   "size_t"};
+  const AstNode *t = ast_node(ast, type);
+  int bits = t->op, base = bits & TYPE_BASE_MASK;
+  size_t n = 0;
+
+#define PUT(...)                                                               \
+  (n += snprintf(n < len ? out + n : NULL, n < len ? len - n : 0, __VA_ARGS__))
+
+  if (bits & TYPE_UNSIGNED)
+    PUT("unsigned ");
+  if (bits & TYPE_SIGNED)
+    PUT("signed ");
+  if (bits & TYPE_SHORT)
+    PUT("short ");
+  if (bits & TYPE_LONG_LONG)
+    PUT("long long ");
+  else if (bits & TYPE_LONG)
+    PUT("long ");
+
+  if (base == TYPE_NAME)
+    PUT("%s", ast_text(ast, type));
+  else if (base == TYPE_INT && (bits & (TYPE_UNSIGNED | TYPE_SIGNED |
+                                        TYPE_SHORT | TYPE_LONG)))
+    n--; /* "unsigned", not "unsigned int" */
+  else if (t->text)
+    PUT("%s %s", bases[base], ast_text(ast, type));
+  else
+    PUT("%s", bases[base]);
+
+  const AstNode *dn = ast_node(ast, d);
+  int pointers = dn->flags;
+
+  /* A function pointer reads "int* (*)(char, ...)" */
+  if (dn->op) {
+    for (int i = 1; i < dn->op; i++)
+      PUT("*");
+    PUT(" (");
+    pointers -= dn->op - 1;
+  }
+
+  for (int i = 0; i < pointers; i++)
+    PUT("*");
+  for (AstIndex dim = dn->b; dim != AST_NULL; dim = ast_node(ast, dim)->next)
+    PUT("[]");
+
+  if (dn->op) {
+    PUT(")(");
+    for (AstIndex p = dn->c; p != AST_NULL; p = ast_node(ast, p)->next) {
+      const AstNode *pn = ast_node(ast, p);
+
+      if (p != dn->c)
+        PUT(", ");
+      if (pn->kind == AST_ELLIPSIS)
+        PUT("...");
+      else
+        n += typeString(ast, pn->a, pn->b, n < len ? out + n : NULL,
+                        n < len ? len - n : 0);
+    }
+    PUT(")");
+  }
+
+#undef PUT
+
+  if (n < len)
+    out[n] = '\0';
+  return n;
+}
+
+/* Inserts the declarator `d` with its type spelled out, however long */
+static void insertTyped(SymbolTable *table, const Ast *ast, AstIndex type,
+                        AstIndex d, int size, const char *scope) {
+  char buf[64], *text = buf;
+  size_t n = typeString(ast, type, d, buf, sizeof(buf));
+
+  if (n >= sizeof(buf)) {
+    text = alloc_malloc(ALLOC_SYMBOL, n + 1);
+    typeString(ast, type, d, text, n + 1);
+  }
+
+  symtab_insert(table, ast_text(ast, d), size, text, scope);
+
+  if (text != buf)
+    alloc_free(text);
+}
 
-    if (strcmp(curr->type, "KEYWORD") == 0 &&
-        isTypeKeyword(curr->token_name) != -1) {
-      strcpy(last_type, curr->token_name);
-      last_type_row = curr->row;
-    } else if (strcmp(curr->type, "IDENTIFIER") == 0) {
-      Token *peek = getNextToken(temp_fp);
-      displayToken(peek);
+static void collectDeclarations(SymbolTable *table, const Ast *ast, AstIndex i,
+                                const char *scope);
 
-      int is_function = 0;
+static void collectDeclarators(SymbolTable *table, const Ast *ast, AstIndex decl,
+                               const char *scope) {
+  const AstNode *n = ast_node(ast, decl);
+  AstIndex type = n->a;
+  const AstNode *t = ast_node(ast, type);
 
-      if (peek && strcmp(peek->type, "PUNCT") == 0 &&
-          peek->token_name[0] == '(')
-        is_function = 1;
+  if ((t->op & TYPE_BASE_MASK) == TYPE_ENUM)
+    for (AstIndex e = t->a; e != AST_NULL; e = ast_node(ast, e)->next)
+      symtab_insert(table, ast_text(ast, e), sizeof(int), "enum", scope);
 
-      if (curr->row == last_type_row) {
-        if (is_function) {
-          hashmap_insert(map, symbol_create(curr->token_name,
-                                            isTypeKeyword(last_type),
-                                            "function", "global"));
+  for (AstIndex d = n->b; d != AST_NULL; d = ast_node(ast, d)->next) {
+    const AstNode *dn = ast_node(ast, d);
+    int size = declaratorSize(ast, type, d);
 
-          prev = peek;
-          curr = getNextToken(temp_fp);
+    if (!dn->text)
+      continue;
+
+    if (n->flags & STORAGE_TYPEDEF) {
+      symtab_insert(table, ast_text(ast, d), size, "typedef", scope);
+    } else if (dn->kind == AST_FUNCTION) {
+      /* Scopes are interned, so the name is used straight from the AST */
+      const char *name = ast_text(ast, d);
+      symtab_insert(table, name, size, "function", scope);
+
+      for (AstIndex p = dn->a; p != AST_NULL; p = ast_node(ast, p)->next) {
+        const AstNode *pn = ast_node(ast, p);
+
+        if (pn->kind != AST_PARAM || !ast_node(ast, pn->b)->text)
           continue;
-        }
-
-        hashmap_insert(map,
-                       symbol_create(curr->token_name, isTypeKeyword(last_type),
-                                     last_type, "global"));
-      } else if (is_function) {
-        hashmap_insert(
-            map, symbol_create(curr->token_name, -1, "function", "global"));
-
-        prev = peek;
-        curr = getNextToken(temp_fp);
-        continue;
-      } else if (isBuiltin(curr->token_name)) {
-        hashmap_insert(
-            map, symbol_create(curr->token_name, -1, "function", "global"));
+
+        insertTyped(table, ast, pn->a, pn->b,
+                    declaratorSize(ast, pn->a, pn->b), name);
       }
+
+      collectDeclarations(table, ast, dn->b, name);
+    } else {
+      insertTyped(table, ast, type, d, size, scope);
     }
+  }
+}
 
-    if (strcmp(curr->type, "PUNCT") == 0 && curr->token_name[0] == ';') {
-      last_type[0] = 0;
-      last_type_row = -1;
+/* Declarations anywhere under `i`, except struct and union members */
+static void collectDeclarations(SymbolTable *table, const Ast *ast, AstIndex i,
+                                const char *scope) {
+  for (; i != AST_NULL; i = ast_node(ast, i)->next) {
+    const AstNode *n = ast_node(ast, i);
+
+    if (n->kind == AST_DECLARATION) {
+      collectDeclarators(table, ast, i, scope);
+    } else if (n->kind != AST_TYPE && n->kind != AST_PARAM) {
+      collectDeclarations(table, ast, n->a, scope);
+      collectDeclarations(table, ast, n->b, scope);
+      collectDeclarations(table, ast, n->c, scope);
     }
+  }
+}
+
+/* Functions that are called without being declared, such as printf */
+static void collectCalls(SymbolTable *table, const Ast *ast, AstIndex i) {
+  for (; i != AST_NULL; i = ast_node(ast, i)->next) {
+    const AstNode *n = ast_node(ast, i);
+
+    if (n->kind == AST_CALL && ast_node(ast, n->a)->kind == AST_IDENT &&
+        symtab_find(table, ast_text(ast, n->a)) == STRTAB_NONE)
+      symtab_insert(table, ast_text(ast, n->a), -1, "function", "global");
+
+    collectCalls(table, ast, n->a);
+    collectCalls(table, ast, n->b);
+    collectCalls(table, ast, n->c);
+  }
+}
+
+/* Roughly the names collectSymbols will insert, to size the table by */
+static size_t countDeclarators(const Ast *ast) {
+  size_t count = 0;
+
+  for (AstIndex i = 1; i < ast->count; i++) {
+    int kind = ast_node(ast, i)->kind;
+    count += kind == AST_VARIABLE || kind == AST_FUNCTION ||
+             kind == AST_ENUMERATOR;
+  }
+
+  return count;
+}
+
+static void collectSymbols(SymbolTable *table, const Ast *ast) {
+  int phase = alloc_setPhase(PHASE_SYMBOLS);
+  STAT_BEGIN(PHASE_SYMBOLS);
+
+  AstIndex decls = ast_node(ast, ast->root)->a;
+  collectDeclarations(table, ast, decls, "global");
+  collectCalls(table, ast, decls);
+
+  STAT_END(PHASE_SYMBOLS);
+  (void)alloc_setPhase(phase);
+}
+
+static Ast *parse(Source *src, int *errors) {
+  int phase = alloc_setPhase(PHASE_PARSE);
+  STAT_BEGIN(PHASE_PARSE);
+  Ast *ast = parseTranslationUnit(pullToken, src, errors);
+  STAT_END(PHASE_PARSE);
+  (void)alloc_setPhase(phase);
+
+  STAT_ADD(ast_nodes, ast->count - 1);
+  if (*errors)
+    fprintf(stderr, "%d syntax error%s\n", *errors, *errors == 1 ? "" : "s");
+
+  return ast;
+}
 
-    prev = curr;
-    curr = getNextToken(temp_fp);
+static FILE *preprocess(const char *input_file, LineMap *lines) {
+  FILE *fp = fopen(input_file, "r");
+  if (!fp) {
+    perror(input_file);
+    return NULL;
   }
 
-  displayHashMap(map);
+  int phase = alloc_setPhase(PHASE_PREPROCESS);
+  STAT_BEGIN(PHASE_PREPROCESS);
+  skipCommentsAndDirectives(fp, input_file, lines);
+  STAT_END(PHASE_PREPROCESS);
+  (void)alloc_setPhase(phase);
+  STAT_ADD(bytes_read, ftell(fp));
+  fclose(fp);
+
+  return fopen("temp.c", "r");
+}
+
+static FusedLexer *openFused(const char *input_file,
+                             const CompileOptions *options, LineMap *lines) {
+  int phase = alloc_setPhase(PHASE_PREPROCESS);
+  STAT_BEGIN(PHASE_PREPROCESS);
+  FusedLexer *lx = options->source
+                       ? openFusedLexerBuffer(input_file, options->source,
+                                              options->source_len)
+                       : openFusedLexer(input_file);
+  STAT_END(PHASE_PREPROCESS);
+  (void)alloc_setPhase(phase);
+
+  if (!lx)
+    perror(input_file);
+  else if (lines)
+    trackFusedLines(lx, lines);
+  return lx;
+}
+
+static int openSource(Source *src, const char *input_file,
+                      const CompileOptions *options, LineMap *lines) {
+  /* xref needs each header's path, which only the serial line map has */
+  if (options->pipelined && !options->source && !options->xref &&
+      (src->pipe = startPipeline(input_file)))
+    return 0;
+
+  src->lines = lines;
+
+  if (options->fused || options->pipelined || options->source)
+    return (src->lx = openFused(input_file, options, lines)) ? 0 : -1;
+
+  return (src->fp = preprocess(input_file, lines)) ? 0 : -1;
+}
+
+int compile(const char *input_file, const CompileOptions *options) {
+  STAT_BEGIN(PHASE_TOTAL);
+
+  /* The legacy lexer keeps its position in statics; start each unit fresh */
+  resetLexer(1, 1, 0);
+
+  Source src = {0};
+  XrefBatch xref;
+  LineMap rows, *lines = &rows;
+
+  if (options->xref) {
+    beginXref(&xref, options->xref, input_file, options->source != NULL);
+    src.xref = &xref;
+    lines = &xref.lines;
+  } else {
+    initLineMap(&rows, input_file);
+  }
+
+  if (openSource(&src, input_file, options, lines) < 0) {
+    freeLineMap(lines);
+    return 1;
+  }
+
+  int errors;
+  Ast *ast = parse(&src, &errors);
+  int status = errors ? 1 : 0;
+
+  if (options->dump_ast)
+    ast_print(stdout, ast);
+
+  SymbolTable *table =
+      symtab_createSized(HASHMAP_BUCKET_AUTO, countDeclarators(ast));
+  table->parent = options->symbol_base;
+  collectSymbols(table, ast);
+
+  displaySymbols(table);
+
+  if (options->symbol_image && saveSymbols(table, options->symbol_image) < 0)
+    status = 1;
+
+  if (src.xref)
+    commitXref(src.xref);
+  else
+    freeLineMap(&rows);
+
+  if (src.pipe)
+    finishPipeline(src.pipe);
+  else if (src.lx)
+    closeFusedLexer(src.lx);
+  else
+    fclose(src.fp);
+
+  STAT_HASHMAP(table->lexemes.index,
+               StringIndex_maxChain(table->lexemes.index));
+  symtab_destroy(table);
+  ast_destroy(ast);
 
-  fclose(temp_fp);
-  hashmap_destroy(map);
+  STAT_END(PHASE_TOTAL);
+  return status;
 }
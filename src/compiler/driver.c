@@ -0,0 +1,204 @@
+#include "compiler/driver.h"
+#include "compiler/compiler.h"
+#include "compiler/stats.h"
+#include "lexer/symimage.h"
+#include "lexer/xref.h"
+#include "preprocessor/include.h"
+
+#include "alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static char *readStdin(size_t *len) {
+  size_t capacity = 1 << 16;
+  char *buf = alloc_malloc(ALLOC_LEXER, capacity);
+  size_t n;
+
+  *len = 0;
+  while ((n = fread(buf + *len, 1, capacity - *len, stdin)) > 0) {
+    *len += n;
+    if (*len == capacity) {
+      capacity *= 2;
+      buf = alloc_realloc(ALLOC_LEXER, buf, capacity);
+    }
+  }
+
+  return buf;
+}
+
+static XrefIndex *loadXref(const char *path) {
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return xref_create();
+
+  XrefIndex *index = xref_load(in);
+  fclose(in);
+
+  if (!index)
+    fprintf(stderr, "%s: not a cross-reference index\n", path);
+  return index;
+}
+
+/* Writes next to `path` and renames, so readers never see a partial index */
+static int saveXref(const XrefIndex *index, const char *path) {
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  FILE *out = fopen(tmp, "wb");
+  int ok = out && xref_save(index, out) == 0;
+
+  if ((out && fclose(out) != 0) || !ok || rename(tmp, path) < 0) {
+    perror(path);
+    remove(tmp);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void printRefs(const XrefIndex *index, const char *name) {
+  XrefCursor cursor;
+  XrefOccurrence at;
+
+  xref_begin(index, xref_find(index, name), &cursor);
+  while (xref_next(&cursor, &at))
+    printf("%s:%u:%u\n", xref_fileName(index, at.file), at.row, at.col);
+}
+
+/* Answers --refs without an input file by reading only that name's list */
+static int queryXref(const char *path, const char *name) {
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return 0;
+
+  XrefIndex *index = xref_loadName(in, name);
+  fclose(in);
+
+  if (!index) {
+    fprintf(stderr, "%s: not a cross-reference index\n", path);
+    return 1;
+  }
+
+  printRefs(index, name);
+  xref_destroy(index);
+  return 0;
+}
+
+int runCompiler(int argc, char *argv[], const char *source,
+                size_t source_len) {
+  CompileOptions options = {0};
+  char *input_file = NULL;
+  const char *xref_path = NULL, *refs = NULL, *base_path = NULL;
+  int print_stats = 0, json = 0;
+  int memory = 0, memory_json = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      print_stats = 1;
+    } else if (strcmp(argv[i], "--stats=json") == 0) {
+      print_stats = json = 1;
+    } else if (strcmp(argv[i], "--fused") == 0) {
+      options.fused = 1;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      options.pipelined = 1;
+    } else if (strcmp(argv[i], "--ast") == 0) {
+      options.dump_ast = 1;
+    } else if (strcmp(argv[i], "--memory") == 0) {
+      memory = 1;
+    } else if (strcmp(argv[i], "--memory=json") == 0) {
+      memory = memory_json = 1;
+    } else if (strncmp(argv[i], "--xref=", 7) == 0) {
+      xref_path = argv[i] + 7;
+    } else if (strncmp(argv[i], "--refs=", 7) == 0) {
+      refs = argv[i] + 7;
+    } else if (strncmp(argv[i], "--symbols=", 10) == 0) {
+      options.symbol_image = argv[i] + 10;
+    } else if (strncmp(argv[i], "--symbols-base=", 15) == 0) {
+      base_path = argv[i] + 15;
+    } else if (strncmp(argv[i], "-I", 2) == 0) {
+      if (argv[i][2])
+        addIncludePath(argv[i] + 2);
+      else if (i + 1 < argc)
+        addIncludePath(argv[++i]);
+    } else if (!input_file) {
+      input_file = argv[i];
+    } else {
+      input_file = NULL;
+      break;
+    }
+  }
+
+  if (!input_file && !(xref_path && refs)) {
+    printf("Use as ./compile [--stats[=json]] [--memory[=json]] [--fused] "
+           "[--pipeline] [--ast] [--xref=<index> [--refs=<name>]] [--symbols=<image>] "
+           "[--symbols-base=<image>] [-I<dir>]... <input-file-location | ->\n"
+           "    or ./compile --xref=<index> --refs=<name>\n"
+           "    or ./compile --server [<socket-path>]\n");
+    clearIncludePaths();
+    return 0;
+  }
+
+  SymbolImage *base = NULL;
+
+  if (base_path && input_file && !(base = symimage_open(base_path))) {
+    fprintf(stderr, "%s: not a symbol table image\n", base_path);
+    clearIncludePaths();
+    return 1;
+  }
+
+  if (!input_file) {
+    clearIncludePaths();
+    return queryXref(xref_path, refs);
+  }
+
+  if (xref_path && !(options.xref = loadXref(xref_path))) {
+    symimage_close(base);
+    clearIncludePaths();
+    return 1;
+  }
+
+  options.symbol_base = base;
+
+  char *buffer = NULL;
+
+  if (strcmp(input_file, "-") == 0) {
+    if (!source)
+      source = buffer = readStdin(&source_len);
+    options.source = source;
+    options.source_len = source_len;
+  }
+
+  STAT_RESET();
+  int status = compile(input_file, &options);
+
+  if (options.xref) {
+    if (refs)
+      printRefs(options.xref, refs);
+    if (saveXref(options.xref, xref_path) < 0)
+      status = 1;
+    xref_destroy(options.xref);
+  }
+
+  symimage_close(base);
+  alloc_free(buffer);
+  clearIncludePaths();
+
+  if (print_stats)
+    stats_print(stderr, json);
+
+  if (memory) {
+#ifdef ALLOC_TRACKING
+    clearHeaderCache();
+    alloc_report(stderr, phase_names, PHASE_COUNT, memory_json);
+    if (alloc_checkLeaks(stderr, phase_names, PHASE_COUNT))
+      status = 1;
+#else
+    (void)memory_json;
+    fprintf(stderr, "memory tracking is not available in this build, "
+                    "configure with -DENABLE_ALLOC_TRACKING=ON\n");
+#endif
+  }
+
+  return status;
+}
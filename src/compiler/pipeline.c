@@ -0,0 +1,254 @@
+#include "compiler/pipeline.h"
+#include "alloc.h"
+#include "lexer/fused.h"
+#include "preprocessor/linemap.h"
+#include "preprocessor/preprocessor.h"
+#include "spsc.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PIPELINE_BLOCKS 8
+#define PIPELINE_BLOCK_FLUSH (16 * 1024)
+#define PIPELINE_BATCHES 16
+#define PIPELINE_BATCH 256
+
+typedef struct TextBlock {
+  /* Line map entries added since the last block, owned by the lexer */
+  LineMapEntry *entries;
+  int entry_count;
+
+  size_t len;
+  char text[PP_BLOCK_SIZE];
+} TextBlock;
+
+typedef struct TokenBatch {
+  int count;
+  Token *tokens[PIPELINE_BATCH];
+} TokenBatch;
+
+struct Pipeline {
+  const char *path;
+  int fd;
+
+  SpscQueue *blocks;
+  SpscQueue *batches;
+  pthread_t preprocessor, lexer;
+
+  /* Preprocessor side; the lexer keeps a copy of the line map */
+  TextBlock *filling;
+  LineMap lines;
+  int shipped;
+
+  /* Lexer side: holds the front block */
+  int reading;
+  LineMap lexer_lines;
+  int segment;
+
+  TokenBatch *batch; /* caller side */
+  int batch_pos;
+
+  Stats stage_stats[2];
+};
+
+/* The lexer only sees the line map through the blocks */
+static void pushBlock(Pipeline *p) {
+  TextBlock *b = p->filling;
+  int count = p->lines.count - p->shipped;
+
+  b->entries = NULL;
+  b->entry_count = count;
+
+  if (count) {
+    b->entries = alloc_malloc(ALLOC_QUEUE, sizeof(LineMapEntry) * count);
+    memcpy(b->entries, p->lines.entries + p->shipped,
+           sizeof(LineMapEntry) * count);
+    p->shipped = p->lines.count;
+  }
+
+  spsc_push(p->blocks);
+  p->filling = NULL;
+}
+
+/* Output is gathered into blocks big enough to be worth a hand-off */
+static void pushText(const char *text, size_t len, void *ctx) {
+  Pipeline *p = ctx;
+
+  while (len) {
+    if (!p->filling) {
+      p->filling = spsc_reserve(p->blocks);
+      p->filling->len = 0;
+    }
+
+    TextBlock *b = p->filling;
+    size_t n = sizeof(b->text) - b->len;
+    if (n > len)
+      n = len;
+
+    memcpy(b->text + b->len, text, n);
+    b->len += n;
+    text += n;
+    len -= n;
+
+    if (b->len >= PIPELINE_BLOCK_FLUSH)
+      pushBlock(p);
+  }
+}
+
+static void *preprocessStage(void *arg) {
+  Pipeline *p = arg;
+
+  (void)alloc_setPhase(PHASE_PREPROCESS);
+  STAT_BEGIN(PHASE_PREPROCESS);
+
+  initLineMap(&p->lines, p->path);
+  p->shipped = p->lines.count;
+
+  if (preprocessUnit(p->fd, p->path, pushText, p, &p->lines) < 0)
+    perror(p->path);
+  STAT_ADD(bytes_read, lseek(p->fd, 0, SEEK_CUR));
+
+  if (p->filling)
+    pushBlock(p);
+  spsc_close(p->blocks);
+  freeLineMap(&p->lines);
+
+  STAT_END(PHASE_PREPROCESS);
+  STAT_SAVE(p->stage_stats[0]);
+  return NULL;
+}
+
+static const char *nextBlock(size_t *len, void *ctx) {
+  Pipeline *p = ctx;
+
+  if (p->reading)
+    spsc_pop(p->blocks);
+
+  TextBlock *b = spsc_front(p->blocks);
+  p->reading = b != NULL;
+
+  if (!b)
+    return NULL;
+
+  if (b->entry_count) {
+    appendLineMap(&p->lexer_lines, b->entries, b->entry_count);
+    alloc_free(b->entries);
+  }
+
+  *len = b->len;
+  return b->text;
+}
+
+static int isEnd(const Token *tok) {
+  return !tok || strcmp(tok->type, "EOF") == 0;
+}
+
+static void *lexStage(void *arg) {
+  Pipeline *p = arg;
+
+  (void)alloc_setPhase(PHASE_LEX);
+  STAT_BEGIN(PHASE_LEX);
+
+  FusedLexer *lx = openFusedLexerStream(nextBlock, p);
+  int done = 0;
+
+  initLineMap(&p->lexer_lines, p->path);
+
+  /* Once a batch is pushed its tokens belong to the parser */
+  while (!done) {
+    TokenBatch *b = spsc_reserve(p->batches);
+    b->count = 0;
+
+    while (!done && b->count < PIPELINE_BATCH) {
+      Token *tok = getNextFusedToken(lx);
+      b->tokens[b->count++] = tok;
+      done = isEnd(tok);
+
+      /* A token's block came with the entries up to its row */
+      if (tok)
+        tok->row = lineMapRow(
+            lineMapFind(&p->lexer_lines, &p->segment, tok->row), tok->row);
+    }
+
+    spsc_push(p->batches);
+  }
+
+  closeFusedLexer(lx);
+  freeLineMap(&p->lexer_lines);
+  spsc_close(p->batches);
+
+  STAT_END(PHASE_LEX);
+  STAT_SAVE(p->stage_stats[1]);
+  return NULL;
+}
+
+static void destroyPipeline(Pipeline *p) {
+  spsc_destroy(p->blocks);
+  spsc_destroy(p->batches);
+  close(p->fd);
+  alloc_free(p);
+}
+
+Pipeline *startPipeline(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  Pipeline *p = alloc_calloc(ALLOC_QUEUE, 1, sizeof(Pipeline));
+  p->path = path;
+  p->fd = fd;
+  p->blocks = spsc_create(PIPELINE_BLOCKS, sizeof(TextBlock));
+  p->batches = spsc_create(PIPELINE_BATCHES, sizeof(TokenBatch));
+
+  if (!p->blocks || !p->batches ||
+      pthread_create(&p->lexer, NULL, lexStage, p) != 0) {
+    destroyPipeline(p);
+    return NULL;
+  }
+
+  /* With no preprocessor the lexer just sees the end of its input */
+  if (pthread_create(&p->preprocessor, NULL, preprocessStage, p) != 0) {
+    Token *tok;
+
+    spsc_close(p->blocks);
+    while ((tok = pipelineToken(p)))
+      token_destroy(tok);
+    pthread_join(p->lexer, NULL);
+    destroyPipeline(p);
+    return NULL;
+  }
+
+  return p;
+}
+
+Token *pipelineToken(Pipeline *p) {
+  while (!p->batch || p->batch_pos == p->batch->count) {
+    if (p->batch)
+      spsc_pop(p->batches);
+
+    p->batch_pos = 0;
+    if (!(p->batch = spsc_front(p->batches)))
+      return NULL;
+  }
+
+  return p->batch->tokens[p->batch_pos++];
+}
+
+void finishPipeline(Pipeline *p) {
+  if (!p)
+    return;
+
+  /* Whatever the caller did not ask for still has to be taken off */
+  Token *tok;
+  while ((tok = pipelineToken(p)))
+    token_destroy(tok);
+
+  pthread_join(p->preprocessor, NULL);
+  pthread_join(p->lexer, NULL);
+
+  STAT_MERGE(p->stage_stats[0]);
+  STAT_MERGE(p->stage_stats[1]);
+  destroyPipeline(p);
+}
@@ -0,0 +1,206 @@
+#include "compiler/stats.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+const char *phase_names[PHASE_COUNT] = {"preprocess", "lex", "parse",
+                                        "symbols", "total"};
+
+#ifdef COMPILER_STATS
+
+_Thread_local Stats stats;
+
+static const char *token_kinds[TOKEN_KIND_COUNT] = {
+    "KEYWORD", "IDENTIFIER", "STRING", "BAD_STRING", "NUM",
+    "LOGICAL", "RELOP",      "ASSIGN", "ADDOP",      "MULOP",
+    "PUNCT",   "UNKNOWN",    "EOF"};
+
+double stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_countToken(const Token *tok) {
+  if (!tok)
+    return;
+
+  for (int i = 0; i < TOKEN_KIND_COUNT; i++) {
+    if (strcmp(tok->type, token_kinds[i]) == 0) {
+      stats.tokens[i]++;
+      return;
+    }
+  }
+}
+
+void stats_countHashMap(int splits, int doublings, int max_chain) {
+  stats.hashmap_splits += splits;
+  stats.hashmap_doublings += doublings;
+
+  if (max_chain > stats.max_chain)
+    stats.max_chain = max_chain;
+}
+
+void stats_merge(const Stats *from) {
+  for (int i = 0; i < PHASE_COUNT; i++)
+    stats.phase_time[i] += from->phase_time[i];
+  for (int i = 0; i < TOKEN_KIND_COUNT; i++)
+    stats.tokens[i] += from->tokens[i];
+
+  stats.bytes_read += from->bytes_read;
+  stats.headers_read += from->headers_read;
+  stats.includes_skipped += from->includes_skipped;
+  stats.macro_expansions += from->macro_expansions;
+  stats.bytes_skipped += from->bytes_skipped;
+  stats.chars_pushed += from->chars_pushed;
+  stats.chars_unread += from->chars_unread;
+  stats.ast_nodes += from->ast_nodes;
+  stats.hashmap_splits += from->hashmap_splits;
+  stats.hashmap_doublings += from->hashmap_doublings;
+  stats.mallocs += from->mallocs;
+
+  if (from->max_chain > stats.max_chain)
+    stats.max_chain = from->max_chain;
+}
+
+#ifdef __GLIBC__
+
+/*
+ * glibc's strdup() and aligned allocators do not go through malloc(), so
+ * they are replaced too. Its stdio buffers, open_memstream() and fmemopen()
+ * included, already do.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+  stats.mallocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  stats.mallocs++;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  stats.mallocs++;
+  return __libc_realloc(ptr, size);
+}
+
+char *strdup(const char *s) {
+  size_t len = strlen(s) + 1;
+  char *copy = malloc(len);
+  return copy ? memcpy(copy, s, len) : NULL;
+}
+
+char *strndup(const char *s, size_t n) {
+  size_t len = strnlen(s, n);
+  char *copy = malloc(len + 1);
+
+  if (!copy)
+    return NULL;
+
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+    return EINVAL;
+
+  stats.mallocs++;
+  void *p = __libc_memalign(alignment, size);
+  if (!p)
+    return ENOMEM;
+
+  *ptr = p;
+  return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  stats.mallocs++;
+  return __libc_memalign(alignment, size);
+}
+
+#endif
+
+static void printTable(FILE *out) {
+  fprintf(out, "\n=== Stats ===\n\n");
+
+  for (int i = 0; i < PHASE_COUNT; i++)
+    fprintf(out, "time %-12s : %10.3f ms\n", phase_names[i],
+            stats.phase_time[i] * 1e3);
+
+  fprintf(out, "\n%-22s : %ld\n", "bytes read", stats.bytes_read);
+  fprintf(out, "%-22s : %ld\n", "headers read", stats.headers_read);
+  fprintf(out, "%-22s : %ld\n", "includes skipped", stats.includes_skipped);
+  fprintf(out, "%-22s : %ld\n", "macro expansions", stats.macro_expansions);
+  fprintf(out, "%-22s : %ld\n", "bytes skipped", stats.bytes_skipped);
+  fprintf(out, "%-22s : %ld\n", "chars pushed", stats.chars_pushed);
+  fprintf(out, "%-22s : %ld\n", "chars unread", stats.chars_unread);
+  fprintf(out, "%-22s : %ld\n", "ast nodes", stats.ast_nodes);
+  fprintf(out, "%-22s : %ld\n", "hashmap splits", stats.hashmap_splits);
+  fprintf(out, "%-22s : %ld\n", "directory doublings",
+          stats.hashmap_doublings);
+  fprintf(out, "%-22s : %ld\n", "max bucket chain", stats.max_chain);
+  fprintf(out, "%-22s : %ld\n", "malloc calls", stats.mallocs);
+
+  fprintf(out, "\n");
+  for (int i = 0; i < TOKEN_KIND_COUNT; i++) {
+    if (stats.tokens[i])
+      fprintf(out, "tokens %-15s : %ld\n", token_kinds[i], stats.tokens[i]);
+  }
+
+  fprintf(out, "\n=============\n");
+}
+
+static void printJson(FILE *out) {
+  fprintf(out, "{\"phases_ms\": {");
+  for (int i = 0; i < PHASE_COUNT; i++)
+    fprintf(out, "%s\"%s\": %.3f", i ? ", " : "", phase_names[i],
+            stats.phase_time[i] * 1e3);
+
+  fprintf(out,
+          "}, \"bytes_read\": %ld, \"headers_read\": %ld, "
+          "\"includes_skipped\": %ld, \"macro_expansions\": %ld, "
+          "\"bytes_skipped\": %ld, \"chars_pushed\": %ld, "
+          "\"chars_unread\": %ld, \"ast_nodes\": %ld, "
+          "\"hashmap_splits\": %ld, "
+          "\"directory_doublings\": %ld, \"max_bucket_chain\": %ld, "
+          "\"malloc_calls\": %ld, \"tokens\": {",
+          stats.bytes_read, stats.headers_read, stats.includes_skipped,
+          stats.macro_expansions, stats.bytes_skipped, stats.chars_pushed,
+          stats.chars_unread, stats.ast_nodes, stats.hashmap_splits,
+          stats.hashmap_doublings, stats.max_chain, stats.mallocs);
+
+  for (int i = 0; i < TOKEN_KIND_COUNT; i++)
+    fprintf(out, "%s\"%s\": %ld", i ? ", " : "", token_kinds[i],
+            stats.tokens[i]);
+
+  fprintf(out, "}}\n");
+}
+
+int stats_print(FILE *out, int json) {
+  if (json)
+    printJson(out);
+  else
+    printTable(out);
+  return 0;
+}
+
+#else
+
+int stats_print(FILE *out, int json) {
+  (void)out;
+  (void)json;
+  fprintf(stderr, "stats are not available in this build, "
+                  "configure with -DENABLE_STATS=ON\n");
+  return -1;
+}
+
+#endif
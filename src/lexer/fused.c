@@ -0,0 +1,748 @@
+#include "lexer/fused.h"
+#include "alloc.h"
+#include "compiler/stats.h"
+#include "preprocessor/directive.h"
+#include "preprocessor/include.h"
+#include "preprocessor/preprocessor.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Source fed to the expander at a time, rounded up to a whole line */
+#define EXPAND_CHUNK 4096
+
+/*
+ * Position in the text the two-pass pipeline would have written to temp.c.
+ * That text is never built: the PPStream state machine runs inline and yields
+ * at most two characters per source byte. Cursors are small enough to copy,
+ * which is how characters are unread.
+ */
+typedef struct Cursor {
+  size_t pos, pending_pos;
+  int row, col;
+
+  PPScanner scan;
+
+  int queue_pos, queue_len;
+  char queue[2];
+  int finished;
+} Cursor;
+
+struct FusedLexer {
+  const char *path;
+  char *src;
+  size_t len, limit;
+
+  Cursor cur;
+  int index;
+
+  PPUnit unit;
+  int unit_done;
+  size_t hooked;
+
+  char *pending;
+  size_t pending_len, pending_capacity;
+
+  /*
+   * Once a macro is defined the cursor stops at `limit` and the rest of the
+   * source goes through the expander a few lines at a time, from `feed_pos`.
+   */
+  PPStream *stream;
+  size_t feed_pos;
+
+  /* Rows appended to `pending` since the directive that starts at splice */
+  LineMap *lines;
+  uint32_t splice_row, spliced_rows;
+
+  /* Stream mode: preprocessed text arrives through here instead */
+  FusedBlockSource next_block;
+  void *block_ctx;
+
+  char *directive;
+  size_t directive_capacity;
+};
+
+static void appendText(const char *block, size_t len, void *ctx) {
+  FusedLexer *lx = ctx;
+
+  if (lx->pending_len + len > lx->pending_capacity) {
+    while (lx->pending_len + len > lx->pending_capacity)
+      lx->pending_capacity =
+          lx->pending_capacity ? lx->pending_capacity * 2 : PP_BLOCK_SIZE;
+    lx->pending =
+        alloc_realloc(ALLOC_LEXER, lx->pending, lx->pending_capacity);
+  }
+
+  memcpy(lx->pending + lx->pending_len, block, len);
+  lx->pending_len += len;
+
+  if (lx->lines) {
+    for (const char *p = block, *end = block + len;
+         (p = memchr(p, '\n', end - p)); p++)
+      lx->spliced_rows++;
+  }
+}
+
+static void feedUnit(const char *block, size_t len, void *ctx) {
+  feedPPUnit(&((FusedLexer *)ctx)->unit, block, len);
+}
+
+static void directiveUnit(const char *directive, size_t len, void *ctx) {
+  FusedLexer *lx = ctx;
+  handleDirective(&lx->unit, directive, len, lx->path, NULL);
+}
+
+static void includeUnit(const char *path, void *ctx) {
+  FusedLexer *lx = ctx;
+  uint32_t row = lx->splice_row + lx->spliced_rows;
+
+  if (path)
+    enterLineMap(lx->lines, path, row);
+  else
+    leaveLineMap(lx->lines, row);
+}
+
+static void finishUnit(FusedLexer *lx) {
+  if (lx->unit_done)
+    return;
+
+  finishPPUnit(&lx->unit);
+  lx->unit_done = 1;
+}
+
+static void startExpanding(FusedLexer *lx, Cursor *cur) {
+  lx->stream = alloc_malloc(ALLOC_LEXER, sizeof(PPStream));
+  initPPStream(lx->stream, feedUnit, lx);
+  lx->stream->on_directive = directiveUnit;
+
+  lx->feed_pos = lx->limit = cur->pos;
+}
+
+/* Expands source lines until one yields text. Returns 0 at the end. */
+static int expandLine(FusedLexer *lx) {
+  size_t before = lx->pending_len;
+
+  while (lx->stream && lx->pending_len == before) {
+    if (lx->feed_pos == lx->len) {
+      finishPPStream(lx->stream);
+      alloc_free(lx->stream);
+      lx->stream = NULL;
+      finishUnit(lx);
+      break;
+    }
+
+    /* Whole lines, so a partial one never sits in the expander */
+    size_t ahead = lx->len - lx->feed_pos;
+    size_t skip = ahead < EXPAND_CHUNK ? ahead : EXPAND_CHUNK;
+    const char *p = lx->src + lx->feed_pos;
+    const char *nl = memchr(p + skip, '\n', ahead - skip);
+    size_t n = nl ? (size_t)(nl + 1 - p) : ahead;
+
+    feedPPStream(lx->stream, p, n);
+    flushPPStream(lx->stream);
+    lx->feed_pos += n;
+  }
+
+  return lx->pending_len > before;
+}
+
+/* The next block goes after whatever of `pending` is still unread */
+static int readBlock(FusedLexer *lx) {
+  const char *block;
+  size_t len;
+
+  while ((block = lx->next_block(&len, lx->block_ctx))) {
+    if (len) {
+      appendText(block, len, lx);
+      return 1;
+    }
+  }
+
+  lx->next_block = NULL;
+  return 0;
+}
+
+static void endDirective(FusedLexer *lx, Cursor *cur) {
+  /* Reading the newline again after an unread must not rerun the directive */
+  if (cur->pos <= lx->hooked)
+    return;
+
+  lx->hooked = cur->pos;
+  lx->unit.expander.last = '\n';
+  lx->splice_row = cur->row + 1;
+  lx->spliced_rows = 0;
+  handleDirective(&lx->unit, lx->directive ? lx->directive : "",
+                  cur->scan.directive_len, lx->path, NULL);
+
+  if (lx->unit.expander.macro_count && !lx->stream)
+    startExpanding(lx, cur);
+}
+
+/* Runs the state machine until it yields text. Returns 0 at the end. */
+static int fill(FusedLexer *lx, Cursor *cur) {
+  int n;
+
+  cur->queue_pos = cur->queue_len = 0;
+
+  while (cur->pos < lx->limit) {
+    if (cur->scan.mode == PP_MODE_LINE_COMMENT) {
+      const char *nl =
+          memchr(lx->src + cur->pos, '\n', lx->limit - cur->pos);
+      if (!nl) {
+        cur->pos = lx->limit;
+        break;
+      }
+
+      cur->pos = nl - lx->src;
+    }
+
+    n = scanPPChar(&cur->scan, lx->src[cur->pos++], cur->queue,
+                   &lx->directive, &lx->directive_capacity);
+    cur->queue_len = n & PP_SCAN_COUNT;
+
+    if (n & PP_SCAN_DIRECTIVE)
+      endDirective(lx, cur);
+    if (cur->queue_len)
+      return 1;
+  }
+
+  if (cur->finished)
+    return 0;
+
+  n = finishPPScanner(&cur->scan, cur->queue);
+  cur->queue_len = n & PP_SCAN_COUNT;
+  cur->finished = 1;
+
+  if (n & PP_SCAN_DIRECTIVE)
+    endDirective(lx, cur);
+
+  return cur->queue_len > 0;
+}
+
+static char nextChar(FusedLexer *lx) {
+  Cursor *cur = &lx->cur;
+  char c;
+
+  for (;;) {
+    if (cur->queue_pos < cur->queue_len) {
+      c = cur->queue[cur->queue_pos++];
+
+      /* Text in a disabled conditional is reduced to its newlines */
+      if (lx->unit.skipping && c != '\n') {
+        STAT_INC(bytes_skipped);
+        continue;
+      }
+    } else if (cur->pending_pos < lx->pending_len) {
+      c = lx->pending[cur->pending_pos++];
+    } else if (lx->next_block && readBlock(lx)) {
+      continue;
+    } else if (lx->stream && expandLine(lx)) {
+      continue;
+    } else if (fill(lx, cur)) {
+      continue;
+    } else {
+      return EOF;
+    }
+
+    if (c == '\n') {
+      cur->row++;
+      cur->col = 1;
+    } else {
+      cur->col++;
+    }
+
+    return c;
+  }
+}
+
+static inline void unread(FusedLexer *lx, char c, const Cursor *save) {
+  if (c != EOF)
+    lx->cur = *save;
+}
+
+/* Comment bodies and directive lines are blank in temp.c; skip them whole. */
+static void skipBlank(FusedLexer *lx) {
+  Cursor *cur = &lx->cur;
+
+  if (cur->queue_pos < cur->queue_len || cur->pending_pos < lx->pending_len)
+    return;
+
+  const char *p = lx->src + cur->pos, *end = lx->src + lx->limit;
+  int visible = !lx->unit.skipping;
+
+  if (cur->scan.mode == PP_MODE_BLOCK_COMMENT) {
+    while (p < end && cur->scan.mode == PP_MODE_BLOCK_COMMENT) {
+      char text[2];
+
+      scanPPChar(&cur->scan, *p++, text, NULL, NULL);
+      if (text[0] == '\n') {
+        cur->row++;
+        cur->col = 1;
+      } else {
+        cur->col += visible;
+      }
+    }
+  } else if (cur->scan.mode == PP_MODE_DIRECTIVE) {
+    const char *nl = memchr(p, '\n', end - p);
+    size_t n = (nl ? nl : end) - p;
+
+    scanPPDirectiveText(&cur->scan, p, n, &lx->directive,
+                        &lx->directive_capacity);
+    cur->col += visible * (int)n;
+    p += n;
+  }
+
+  if (!visible)
+    STAT_ADD(bytes_skipped, p - (lx->src + cur->pos));
+  cur->pos = p - lx->src;
+}
+
+static Token *punctuation(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor save = lx->cur;
+
+  char c = nextChar(lx);
+  char tok[2] = {c, 0};
+
+  switch (c) {
+  case '(':
+  case ')':
+  case '{':
+  case '}':
+  case '[':
+  case ']':
+  case ';':
+  case ',':
+  case '.':
+  case '"':
+  case '\'':
+  case '\\':
+    return token_create(tok, row, col, -1, "PUNCT");
+  default:
+    unread(lx, c, &save);
+    return NULL;
+  }
+}
+
+/* Keywords and identifiers in one scan */
+static Token *word(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor save = lx->cur;
+
+  char buf[128];
+  size_t len = 0;
+
+  char c = nextChar(lx);
+  if (!(isalpha(c) || c == '_')) {
+    unread(lx, c, &save);
+    return NULL;
+  }
+
+  buf[len++] = c;
+
+  for (;;) {
+    save = lx->cur;
+    c = nextChar(lx);
+    if (c == EOF || !(isalnum(c) || c == '_'))
+      break;
+    if (len < sizeof(buf) - 1)
+      buf[len++] = c;
+  }
+
+  buf[len] = 0;
+  unread(lx, c, &save);
+
+  if (token_isKeyword(buf))
+    return token_create(buf, row, col, -1, "KEYWORD");
+
+  return token_create(buf, row, col, lx->index++, "IDENTIFIER");
+}
+
+static Token *stringLiteral(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor save = lx->cur;
+
+  char buf[1024];
+  size_t len = 0;
+
+  int c = nextChar(lx);
+
+  if (c != '"') {
+    unread(lx, c, &save);
+    return NULL;
+  }
+
+  buf[len++] = '"';
+
+  while ((c = nextChar(lx)) != EOF) {
+
+    if (len >= sizeof(buf) - 1)
+      break;
+
+    buf[len++] = c;
+
+    if (c == '\\') {
+      int next = nextChar(lx);
+      if (next == EOF)
+        break;
+
+      if (len >= sizeof(buf) - 1)
+        break;
+
+      buf[len++] = next;
+      continue;
+    }
+
+    if (c == '"') {
+      buf[len] = '\0';
+      return token_create(buf, row, col, -1, "STRING");
+    }
+  }
+
+  buf[len] = '\0';
+  return token_create(buf, row, col, -1, "BAD_STRING");
+}
+
+static Token *number(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor save = lx->cur;
+
+  char buf[128];
+  size_t len = 0;
+  int dot = 0, exp = 0;
+
+  char c = nextChar(lx);
+  if (!isdigit(c)) {
+    unread(lx, c, &save);
+    return NULL;
+  }
+
+  buf[len++] = c;
+
+  for (;;) {
+    save = lx->cur;
+    if ((c = nextChar(lx)) == EOF)
+      break;
+
+    if (len >= sizeof(buf) - 2)
+      break;
+
+    if (isdigit(c)) {
+      buf[len++] = c;
+    } else if (c == '.' && !dot) {
+      dot = 1;
+      buf[len++] = c;
+    } else if ((c == 'e' || c == 'E') && !exp) {
+      exp = 1;
+      buf[len++] = c;
+      save = lx->cur;
+      c = nextChar(lx);
+      if (c == '+' || c == '-' || isdigit(c)) {
+        buf[len++] = c;
+      } else {
+        break;
+      }
+    } else
+      break;
+  }
+
+  buf[len] = 0;
+  unread(lx, c, &save);
+
+  return token_create(buf, row, col, -1, "NUM");
+}
+
+static Token *logicalop(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor before_c = lx->cur;
+  char c = nextChar(lx);
+  Cursor before_n = lx->cur;
+  char n = nextChar(lx);
+
+  char buf[3] = {0};
+
+  if ((c == '&' && n == '&') || (c == '|' && n == '|')) {
+    buf[0] = c;
+    buf[1] = n;
+    return token_create(buf, row, col, -1, "LOGICAL");
+  }
+
+  unread(lx, n, &before_n);
+
+  if (c == '&' || c == '|' || c == '!' || c == '^' || c == '~') {
+    buf[0] = c;
+    return token_create(buf, row, col, -1, "LOGICAL");
+  }
+
+  unread(lx, c, &before_c);
+  return NULL;
+}
+
+static Token *relop(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor before_c = lx->cur;
+  char c = nextChar(lx);
+  Cursor before_n = lx->cur;
+  char n = nextChar(lx);
+  char buf[3] = {0};
+
+  if ((c == '<' || c == '>' || c == '=' || c == '!') && n == '=') {
+    buf[0] = c;
+    buf[1] = '=';
+    return token_create(buf, row, col, -1, "RELOP");
+  }
+
+  unread(lx, n, &before_n);
+
+  if (c == '<' || c == '>') {
+    buf[0] = c;
+    return token_create(buf, row, col, -1, "RELOP");
+  }
+
+  unread(lx, c, &before_c);
+  return NULL;
+}
+
+static Token *assignop(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor before_c = lx->cur;
+  char c = nextChar(lx);
+  Cursor before_n = lx->cur;
+  char n = nextChar(lx);
+  char buf[3] = {0};
+
+  if (n == '=' && strchr("+-*/%", c)) {
+    buf[0] = c;
+    buf[1] = '=';
+    return token_create(buf, row, col, -1, "ASSIGN");
+  }
+
+  unread(lx, n, &before_n);
+
+  if (c == '=') {
+    buf[0] = '=';
+    return token_create(buf, row, col, -1, "ASSIGN");
+  }
+
+  unread(lx, c, &before_c);
+  return NULL;
+}
+
+static Token *addop(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor save = lx->cur;
+
+  char c = nextChar(lx);
+  if (c != '+' && c != '-') {
+    unread(lx, c, &save);
+    return NULL;
+  }
+
+  save = lx->cur;
+  char n = nextChar(lx);
+  char buf[3];
+  if (n == c) {
+    buf[0] = c;
+    buf[1] = n;
+    buf[2] = '\0';
+  } else {
+    unread(lx, n, &save);
+    buf[0] = c;
+    buf[1] = '\0';
+  }
+
+  return token_create(buf, row, col, -1, "ADDOP");
+}
+
+static Token *mulop(FusedLexer *lx) {
+  int row = lx->cur.row, col = lx->cur.col;
+  Cursor save = lx->cur;
+
+  char c = nextChar(lx);
+  char buf[2] = {c, '\0'};
+
+  if (c == '*' || c == '/' || c == '%') {
+    return token_create(buf, row, col, -1, "MULOP");
+  }
+
+  unread(lx, c, &save);
+  return NULL;
+}
+
+static Token *scanToken(FusedLexer *lx) {
+  size_t used = lx->cur.pending_pos;
+
+  /*
+   * No cursor outlives a token, so what was read before it can go; the rest
+   * is moved down once it is no longer than what is dropped.
+   */
+  if (used == lx->pending_len) {
+    lx->cur.pending_pos = lx->pending_len = 0;
+  } else if (used >= PP_BLOCK_SIZE && used >= lx->pending_len - used) {
+    memmove(lx->pending, lx->pending + used, lx->pending_len - used);
+    lx->pending_len -= used;
+    lx->cur.pending_pos = 0;
+  }
+
+  Cursor save;
+  char c;
+
+  for (;;) {
+    skipBlank(lx);
+    save = lx->cur;
+    c = nextChar(lx);
+    if (c == EOF || !isspace(c))
+      break;
+  }
+
+  if (c == EOF)
+    return token_create("EOF", lx->cur.row, lx->cur.col, -1, "EOF");
+
+  lx->cur = save;
+
+  Token *tok;
+  if ((tok = word(lx)))
+    return tok;
+  if ((tok = stringLiteral(lx)))
+    return tok;
+  if ((tok = number(lx)))
+    return tok;
+  if ((tok = logicalop(lx)))
+    return tok;
+  if ((tok = relop(lx)))
+    return tok;
+  if ((tok = assignop(lx)))
+    return tok;
+  if ((tok = addop(lx)))
+    return tok;
+  if ((tok = mulop(lx)))
+    return tok;
+  if ((tok = punctuation(lx)))
+    return tok;
+
+  c = nextChar(lx);
+  char unk[2] = {c, '\0'};
+  return token_create(unk, lx->cur.row, lx->cur.col - 1, -1, "UNKNOWN");
+}
+
+Token *getNextFusedToken(FusedLexer *lx) {
+  Token *tok = scanToken(lx);
+  STAT_TOKEN(tok);
+  return tok;
+}
+
+static char *readSource(int fd, size_t *len) {
+  struct stat st;
+  size_t capacity = PP_BLOCK_SIZE;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    capacity = st.st_size + 1;
+
+  char *buf = alloc_malloc(ALLOC_LEXER, capacity);
+  *len = 0;
+
+  for (;;) {
+    if (*len == capacity) {
+      capacity *= 2;
+      buf = alloc_realloc(ALLOC_LEXER, buf, capacity);
+    }
+
+    ssize_t n = read(fd, buf + *len, capacity - *len);
+    if (n == 0)
+      break;
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      alloc_free(buf);
+      return NULL;
+    }
+
+    *len += n;
+  }
+
+  return buf;
+}
+
+static FusedLexer *createLexer(const char *path, char *src, size_t len) {
+  FusedLexer *lx = alloc_calloc(ALLOC_LEXER, 1, sizeof(FusedLexer));
+  PPState init = PP_STATE_INIT;
+
+  lx->path = path;
+  lx->src = src;
+  lx->len = lx->limit = len;
+  lx->cur.row = lx->cur.col = 1;
+  lx->cur.scan = ppScannerAt(init);
+
+  resetIncludedHeaders();
+  initPPUnit(&lx->unit, appendText, lx);
+  STAT_ADD(bytes_read, len);
+
+  return lx;
+}
+
+FusedLexer *openFusedLexer(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  size_t len;
+  char *src = readSource(fd, &len);
+  close(fd);
+
+  if (!src)
+    return NULL;
+
+  return createLexer(path, src, len);
+}
+
+FusedLexer *openFusedLexerBuffer(const char *name, const char *text,
+                                 size_t len) {
+  char *src = alloc_malloc(ALLOC_LEXER, len + 1);
+
+  memcpy(src, text, len);
+  return createLexer(name, src, len);
+}
+
+FusedLexer *openFusedLexerStream(FusedBlockSource next_block, void *ctx) {
+  FusedLexer *lx = alloc_calloc(ALLOC_LEXER, 1, sizeof(FusedLexer));
+  PPState init = PP_STATE_INIT;
+
+  lx->path = "";
+  lx->cur.row = lx->cur.col = 1;
+  lx->cur.scan = ppScannerAt(init);
+
+  /* The unit is never fed: the text is preprocessed already */
+  lx->unit_done = 1;
+  lx->next_block = next_block;
+  lx->block_ctx = ctx;
+
+  return lx;
+}
+
+void trackFusedLines(FusedLexer *lx, LineMap *lines) {
+  lx->lines = lines;
+  lx->unit.on_include = includeUnit;
+  lx->unit.include_ctx = lx;
+}
+
+void closeFusedLexer(FusedLexer *lx) {
+  if (!lx)
+    return;
+
+  if (lx->stream) {
+    alloc_free(lx->stream->directive);
+    alloc_free(lx->stream);
+  }
+
+  finishUnit(lx);
+  alloc_free(lx->src);
+  alloc_free(lx->pending);
+  alloc_free(lx->directive);
+  alloc_free(lx);
+}
@@ -1,4 +1,6 @@
 #include "lexer/lexer.h"
+#include "compiler/stats.h"
+#include "alloc.h"
 #include "stack.h"
 
 #include <stdlib.h>
@@ -8,7 +10,7 @@ typedef struct Position {
 } Position;
 
 static Position *getPosition(int row, int col) {
-  Position *pos = (Position *)malloc(sizeof(Position));
+  Position *pos = (Position *)alloc_malloc(ALLOC_LEXER, sizeof(Position));
   pos->row = row;
   pos->col = col;
   return pos;
@@ -16,12 +18,33 @@ static Position *getPosition(int row, int col) {
 
 Stack *stack;
 
+static int lex_row = 1, lex_col = 1;
+static int lex_index = 0;
+
+static void clearPositions(void) {
+  if (!stack)
+    stack = stack_create();
+
+  while (stack_top(stack))
+    stack_pop(stack);
+}
+
+void resetLexer(int row, int col, int index) {
+  if (stack)
+    clearPositions();
+
+  lex_row = row;
+  lex_col = col;
+  lex_index = index;
+}
+
 char nextChar(FILE *fp, int *row, int *col) {
   int c = fgetc(fp);
   if (c == EOF)
     return EOF;
 
   stack_push(stack, getPosition(*row, *col));
+  STAT_INC(chars_pushed);
 
   if (c == '\n') {
     (*row)++;
@@ -38,6 +61,7 @@ char ungetChar(char c, FILE *fp, int *row, int *col) {
     return EOF;
 
   ungetc(c, fp);
+  STAT_INC(chars_unread);
 
   Position *p = (Position *)stack_top(stack);
   if (p) {
@@ -84,7 +108,7 @@ Token *isIdentifier(FILE *fp, int *row, int *col, int index) {
   int start_col = *col;
 
   char buf[128];
-  int len = 0;
+  size_t len = 0;
 
   char c = nextChar(fp, row, col);
   if (!(isalpha(c) || c == '_')) {
@@ -95,7 +119,8 @@ Token *isIdentifier(FILE *fp, int *row, int *col, int index) {
   buf[len++] = c;
 
   while ((c = nextChar(fp, row, col)) != EOF && (isalnum(c) || c == '_')) {
-    buf[len++] = c;
+    if (len < sizeof(buf) - 1)
+      buf[len++] = c;
   }
 
   buf[len] = 0;
@@ -105,14 +130,6 @@ Token *isIdentifier(FILE *fp, int *row, int *col, int index) {
 }
 
 Token *isKeyword(FILE *fp, int *row, int *col) {
-  static const char *keywords[] = {
-      "auto",     "break",    "case",     "char",   "const",   "continue",
-      "default",  "do",       "double",   "else",   "enum",    "extern",
-      "float",    "for",      "goto",     "if",     "inline",  "int",
-      "long",     "register", "restrict", "return", "short",   "signed",
-      "sizeof",   "static",   "struct",   "switch", "typedef", "union",
-      "unsigned", "void",     "volatile", "while",  "FILE",    "size_t"};
-
   long pos = ftell(fp);
   int r = *row, c = *col;
 
@@ -120,13 +137,13 @@ Token *isKeyword(FILE *fp, int *row, int *col) {
   if (!tok)
     return NULL;
 
-  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
-    if (strcmp(tok->token_name, keywords[i]) == 0) {
-      strcpy(tok->type, "KEYWORD");
-      return tok;
-    }
+  if (token_isKeyword(tok->token_name)) {
+    strcpy(tok->type, "KEYWORD");
+    return tok;
   }
 
+  token_destroy(tok);
+
   fseek(fp, pos, SEEK_SET);
   *row = r;
   *col = c;
@@ -138,7 +155,7 @@ Token *isStringLiteral(FILE *fp, int *row, int *col) {
   int start_col = *col;
 
   char buf[1024];
-  int len = 0;
+  size_t len = 0;
 
   int c = nextChar(fp, row, col);
 
@@ -183,7 +200,8 @@ Token *isNum(FILE *fp, int *row, int *col) {
   int start_col = *col;
 
   char buf[128];
-  int len = 0, dot = 0, exp = 0;
+  size_t len = 0;
+  int dot = 0, exp = 0;
 
   char c = nextChar(fp, row, col);
   if (!isdigit(c)) {
@@ -206,7 +224,6 @@ Token *isNum(FILE *fp, int *row, int *col) {
       if (c == '+' || c == '-' || isdigit(c)) {
         buf[len++] = c;
       } else {
-        ungetChar(c, fp, row, col);
         break;
       }
     } else
@@ -335,51 +352,54 @@ Token *isMulop(FILE *fp, int *row, int *col) {
   return NULL;
 }
 
-Token *getNextToken(FILE *fp) {
-  if (!stack)
-    stack = stack_create();
-
-  static int row = 1, col = 1;
-  static int index = 0;
+static Token *scanToken(FILE *fp) {
+  clearPositions();
 
   char c;
 
-  while ((c = nextChar(fp, &row, &col)) != EOF) {
+  while ((c = nextChar(fp, &lex_row, &lex_col)) != EOF) {
     if (isspace(c))
       continue;
     break;
   }
 
   if (c == EOF) {
-    return token_create("EOF", row, col, -1, "EOF");
     stack_destroy(stack);
+    stack = NULL;
+    return token_create("EOF", lex_row, lex_col, -1, "EOF");
   }
 
-  ungetChar(c, fp, &row, &col);
+  ungetChar(c, fp, &lex_row, &lex_col);
 
   Token *tok;
-  if ((tok = isKeyword(fp, &row, &col)))
+  if ((tok = isKeyword(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isIdentifier(fp, &row, &col, index)))
-    return index++, tok;
-  if ((tok = isStringLiteral(fp, &row, &col)))
+  if ((tok = isIdentifier(fp, &lex_row, &lex_col, lex_index)))
+    return lex_index++, tok;
+  if ((tok = isStringLiteral(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isNum(fp, &row, &col)))
+  if ((tok = isNum(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isLogicalop(fp, &row, &col)))
+  if ((tok = isLogicalop(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isRelop(fp, &row, &col)))
+  if ((tok = isRelop(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isAssignop(fp, &row, &col)))
+  if ((tok = isAssignop(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isAddop(fp, &row, &col)))
+  if ((tok = isAddop(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isMulop(fp, &row, &col)))
+  if ((tok = isMulop(fp, &lex_row, &lex_col)))
     return tok;
-  if ((tok = isPunctuation(fp, &row, &col)))
+  if ((tok = isPunctuation(fp, &lex_row, &lex_col)))
     return tok;
 
-  c = nextChar(fp, &row, &col);
+  c = nextChar(fp, &lex_row, &lex_col);
   char unk[2] = {c, '\0'};
-  return token_create(unk, row, col - 1, -1, "UNKNOWN");
+  return token_create(unk, lex_row, lex_col - 1, -1, "UNKNOWN");
+}
+
+Token *getNextToken(FILE *fp) {
+  Token *tok = scanToken(fp);
+  STAT_TOKEN(tok);
+  return tok;
 }
@@ -1,27 +1,30 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
 #include "lexer/symbol.h"
 
-Symbol *symbol_create(char *lexeme, int size, char *type, char *scope) {
-  Symbol *sym = malloc(sizeof(Symbol));
-
-  strcpy(sym->lexeme, lexeme);
-  strcpy(sym->type, type);
-  strcpy(sym->scope, scope);
+void symbol_init(Symbol *sym, const char *lexeme, int size, const char *type,
+                 const char *scope) {
+  snprintf(sym->lexeme, sizeof(sym->lexeme), "%s", lexeme);
+  snprintf(sym->type, sizeof(sym->type), "%s", type);
+  snprintf(sym->scope, sizeof(sym->scope), "%s", scope);
   sym->size = size;
+}
 
+Symbol *symbol_create(char *lexeme, int size, char *type, char *scope) {
+  Symbol *sym = alloc_malloc(ALLOC_SYMBOL, sizeof(Symbol));
+  symbol_init(sym, lexeme, size, type, scope);
   return sym;
 }
 
+void symbol_destroy(Symbol *sym) { alloc_free(sym); }
+
 int symbol_compare(const Symbol *a, const Symbol *b) {
   return strcmp(a->lexeme, b->lexeme) == 0;
 }
 
 int symbol_getIndex(const Symbol *sym, int depth) {
-  unsigned hash = 5381;
-  const char *lexeme = sym->lexeme;
-  while (*lexeme)
-    hash = ((hash << 5) + hash) + *lexeme++;
-  return hash & ((1 << depth) - 1);
+  return symbol_hash(sym->lexeme) & ((1 << depth) - 1);
 }
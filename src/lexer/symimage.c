@@ -0,0 +1,242 @@
+#include "lexer/symimage.h"
+#include "alloc.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SYMIMAGE_MAGIC "SYM1"
+#define SYMIMAGE_BYTE_ORDER 0x01020304u
+#define SYMIMAGE_MAX_DEPTH 30
+
+static uint64_t align4(uint64_t n) { return (n + 3) & ~(uint64_t)3; }
+
+static int writeWords(const void *words, size_t count, FILE *out) {
+  return count == 0 || fwrite(words, sizeof(uint32_t), count, out) == count;
+}
+
+static int writePool(const StringTable *t, FILE *out) {
+  static const char zeros[4];
+  size_t pad = align4(t->pool_len) - t->pool_len;
+
+  return (t->pool_len == 0 || fwrite(t->pool, 1, t->pool_len, out) ==
+                                  t->pool_len) &&
+         fwrite(zeros, 1, pad, out) == pad;
+}
+
+static int writeBuckets(const StringIndex *index, uint32_t limit, FILE *out) {
+  uint32_t words = 1 + 2 * limit;
+  uint32_t *bucket = alloc_malloc(ALLOC_SYMBOL, sizeof(uint32_t) * words);
+  int ok = 1;
+
+  for (int i = 0; ok && i < index->dir_size; i++) {
+    if (!StringIndex_isFirst(index, i))
+      continue;
+
+    const StringIndexBucket *b = index->directory[i];
+    memset(bucket, 0, sizeof(uint32_t) * words);
+
+    bucket[0] = b->size;
+    for (int j = 0; j < b->size; j++) {
+      bucket[1 + 2 * j] = b->slots[j].hash;
+      bucket[2 + 2 * j] = b->slots[j].value;
+    }
+
+    ok = writeWords(bucket, words, out);
+  }
+
+  alloc_free(bucket);
+  return ok;
+}
+
+int symimage_write(const SymbolTable *t, FILE *out) {
+  const StringIndex *index = t->lexemes.index;
+  uint32_t count = t->lexemes.count;
+  SymbolImageHeader h = {0};
+
+  memcpy(h.magic, SYMIMAGE_MAGIC, 4);
+  h.byte_order = SYMIMAGE_BYTE_ORDER;
+  h.count = count;
+  h.name_count = t->names.count;
+  h.global_depth = index->global_depth;
+  /* Buckets of colliding hashes may hold more than the limit */
+  h.bucket_limit = index->bucket_limit;
+  if (StringIndex_maxChain(index) > index->bucket_limit)
+    h.bucket_limit = StringIndex_maxChain(index);
+
+  /* Buckets are numbered by the first directory slot that points at them */
+  uint32_t *numbers =
+      alloc_malloc(ALLOC_SYMBOL, sizeof(uint32_t) * index->dir_size);
+
+  for (int i = 0; i < index->dir_size; i++) {
+    int depth = index->directory[i]->local_depth;
+    numbers[i] = StringIndex_isFirst(index, i)
+                     ? h.bucket_count++
+                     : numbers[i & ((1 << depth) - 1)];
+  }
+
+  uint64_t pos = sizeof(h);
+
+  h.lexeme_pool = pos;
+  h.lexeme_pool_len = t->lexemes.pool_len;
+  pos += align4(h.lexeme_pool_len);
+  h.lexeme_offsets = pos;
+  pos += sizeof(uint32_t) * count;
+
+  h.name_pool = pos;
+  h.name_pool_len = t->names.pool_len;
+  pos += align4(h.name_pool_len);
+  h.name_offsets = pos;
+  pos += sizeof(uint32_t) * h.name_count;
+
+  h.sizes = pos;
+  pos += sizeof(int32_t) * count;
+  h.types = pos;
+  pos += sizeof(uint32_t) * count;
+  h.scopes = pos;
+  pos += sizeof(uint32_t) * count;
+
+  h.directory = pos;
+  pos += sizeof(uint32_t) * index->dir_size;
+  h.buckets = pos;
+  pos += sizeof(uint32_t) * (1 + 2 * (uint64_t)h.bucket_limit) *
+         h.bucket_count;
+
+  int ok = pos <= UINT32_MAX;
+  h.size = pos;
+
+  ok = ok && fwrite(&h, sizeof(h), 1, out) == 1 &&
+       writePool(&t->lexemes, out) &&
+       writeWords(t->lexemes.offsets, count, out) &&
+       writePool(&t->names, out) &&
+       writeWords(t->names.offsets, h.name_count, out) &&
+       writeWords(t->sizes, count, out) && writeWords(t->types, count, out) &&
+       writeWords(t->scopes, count, out) &&
+       writeWords(numbers, index->dir_size, out) &&
+       writeBuckets(index, h.bucket_limit, out);
+
+  alloc_free(numbers);
+  return ok && fflush(out) == 0 ? 0 : -1;
+}
+
+static const void *section(const SymbolImage *img, uint32_t offset,
+                           uint64_t bytes) {
+  if (offset % 4 || offset < sizeof(SymbolImageHeader) ||
+      offset + bytes > img->size)
+    return NULL;
+
+  return (const char *)img->base + offset;
+}
+
+/* A pool's last string must end inside it; each string then does too */
+static int checkPool(const char *pool, uint32_t len, uint32_t strings) {
+  return strings == 0 || (len > 0 && pool[len - 1] == '\0');
+}
+
+/*
+ * Only the header and the section bounds are checked here, in constant time;
+ * a truncated file is refused, and what lies inside the sections is checked
+ * by symimage_find() and the accessors as they read it.
+ */
+static int mapSections(SymbolImage *img) {
+  const SymbolImageHeader *h = img->base;
+
+  if (img->size < sizeof(*h) || memcmp(h->magic, SYMIMAGE_MAGIC, 4) != 0 ||
+      h->byte_order != SYMIMAGE_BYTE_ORDER || h->size != img->size ||
+      h->global_depth < 1 || h->global_depth > SYMIMAGE_MAX_DEPTH ||
+      h->bucket_limit < 1 || h->bucket_limit > (1u << 16) ||
+      h->bucket_count < 1 || h->bucket_count > (1u << h->global_depth))
+    return 0;
+
+  uint32_t count = h->count, dir_size = 1u << h->global_depth;
+
+  img->count = count;
+  img->mask = dir_size - 1;
+  img->bucket_count = h->bucket_count;
+  img->bucket_limit = h->bucket_limit;
+  img->bucket_words = 1 + 2 * h->bucket_limit;
+  img->lexeme_pool_len = h->lexeme_pool_len;
+  img->name_pool_len = h->name_pool_len;
+  img->name_count = h->name_count;
+
+  img->lexeme_pool = section(img, h->lexeme_pool, h->lexeme_pool_len);
+  img->lexeme_offsets =
+      section(img, h->lexeme_offsets, sizeof(uint32_t) * (uint64_t)count);
+  img->name_pool = section(img, h->name_pool, h->name_pool_len);
+  img->name_offsets = section(img, h->name_offsets,
+                              sizeof(uint32_t) * (uint64_t)h->name_count);
+  img->sizes = section(img, h->sizes, sizeof(int32_t) * (uint64_t)count);
+  img->types = section(img, h->types, sizeof(uint32_t) * (uint64_t)count);
+  img->scopes = section(img, h->scopes, sizeof(uint32_t) * (uint64_t)count);
+  img->directory = section(img, h->directory, sizeof(uint32_t) * dir_size);
+  img->buckets =
+      section(img, h->buckets,
+              sizeof(uint32_t) * (uint64_t)img->bucket_words * h->bucket_count);
+
+  return img->lexeme_pool && img->lexeme_offsets && img->name_pool &&
+         img->name_offsets && img->sizes && img->types && img->scopes &&
+         img->directory && img->buckets &&
+         checkPool(img->lexeme_pool, h->lexeme_pool_len, count) &&
+         checkPool(img->name_pool, h->name_pool_len, h->name_count);
+}
+
+SymbolImage *symimage_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SymbolImageHeader) ||
+      st.st_size > UINT32_MAX) {
+    close(fd);
+    return NULL;
+  }
+
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED)
+    return NULL;
+
+  SymbolImage *img = alloc_calloc(ALLOC_SYMBOL, 1, sizeof(SymbolImage));
+  img->base = base;
+  img->size = st.st_size;
+
+  if (!mapSections(img)) {
+    symimage_close(img);
+    return NULL;
+  }
+
+  return img;
+}
+
+void symimage_close(SymbolImage *img) {
+  if (!img)
+    return;
+
+  munmap(img->base, img->size);
+  alloc_free(img);
+}
+
+uint32_t symimage_find(const SymbolImage *img, const char *lexeme) {
+  unsigned int hash = symbol_hash(lexeme);
+  uint32_t bucket = img->directory[hash & img->mask];
+
+  if (bucket >= img->bucket_count)
+    return STRTAB_NONE;
+
+  const uint32_t *b = img->buckets + (size_t)bucket * img->bucket_words;
+  uint32_t size = b[0] < img->bucket_limit ? b[0] : img->bucket_limit;
+
+  for (uint32_t i = 0; i < size; i++) {
+    uint32_t id = b[2 + 2 * i];
+
+    if (b[1 + 2 * i] == hash && id < img->count &&
+        strcmp(symimage_lexeme(img, id), lexeme) == 0)
+      return id;
+  }
+
+  return STRTAB_NONE;
+}
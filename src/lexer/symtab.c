@@ -0,0 +1,136 @@
+#include "lexer/symtab.h"
+#include "alloc.h"
+#include "lexer/symimage.h"
+
+#include <string.h>
+
+void strtab_init(StringTable *t, int bucket_limit, size_t expected) {
+  memset(t, 0, sizeof(*t));
+
+  t->index = StringIndex_createSized(bucket_limit, expected);
+  t->index->ctx = t;
+}
+
+void strtab_free(StringTable *t) {
+  StringIndex_destroy(t->index);
+  alloc_free(t->pool);
+  alloc_free(t->offsets);
+  memset(t, 0, sizeof(*t));
+}
+
+uint32_t strtab_find(const StringTable *t, const char *s) {
+  uint32_t *id = StringIndex_find(t->index, s);
+  return id ? *id : STRTAB_NONE;
+}
+
+uint32_t strtab_intern(StringTable *t, const char *s) {
+  unsigned int hash = symbol_hash(s);
+  uint32_t *found = StringIndex_findHashed(t->index, s, hash);
+
+  if (found)
+    return *found;
+
+  size_t len = strlen(s) + 1;
+
+  if (t->pool_len + len > t->pool_capacity) {
+    t->pool_capacity = t->pool_capacity ? t->pool_capacity : 256;
+    while (t->pool_len + len > t->pool_capacity)
+      t->pool_capacity *= 2;
+    t->pool = alloc_realloc(ALLOC_SYMBOL, t->pool, t->pool_capacity);
+  }
+
+  if (t->count == t->capacity) {
+    t->capacity = t->capacity ? t->capacity * 2 : 16;
+    t->offsets =
+        alloc_realloc(ALLOC_SYMBOL, t->offsets, sizeof(uint32_t) * t->capacity);
+  }
+
+  uint32_t id = t->count++;
+  t->offsets[id] = t->pool_len;
+  memcpy(t->pool + t->pool_len, s, len);
+  t->pool_len += len;
+
+  StringIndex_insertHashed(t->index, &id, hash);
+  return id;
+}
+
+SymbolTable *symtab_createSized(int bucket_limit, size_t expected) {
+  SymbolTable *t = alloc_calloc(ALLOC_SYMBOL, 1, sizeof(SymbolTable));
+
+  strtab_init(&t->lexemes, bucket_limit, expected);
+  strtab_init(&t->names, bucket_limit, 0);
+  return t;
+}
+
+SymbolTable *symtab_create(int bucket_limit) {
+  return symtab_createSized(bucket_limit, 0);
+}
+
+void symtab_destroy(SymbolTable *t) {
+  if (!t)
+    return;
+
+  strtab_free(&t->lexemes);
+  strtab_free(&t->names);
+  alloc_free(t->sizes);
+  alloc_free(t->types);
+  alloc_free(t->scopes);
+  alloc_free(t);
+}
+
+static void grow(SymbolTable *t) {
+  t->capacity = t->capacity ? t->capacity * 2 : 16;
+  t->sizes =
+      alloc_realloc(ALLOC_SYMBOL, t->sizes, sizeof(int32_t) * t->capacity);
+  t->types =
+      alloc_realloc(ALLOC_SYMBOL, t->types, sizeof(uint32_t) * t->capacity);
+  t->scopes =
+      alloc_realloc(ALLOC_SYMBOL, t->scopes, sizeof(uint32_t) * t->capacity);
+}
+
+int symtab_insert(SymbolTable *t, const char *lexeme, int size,
+                  const char *type, const char *scope) {
+  if (t->parent && symimage_find(t->parent, lexeme) != STRTAB_NONE)
+    return 0;
+
+  uint32_t count = t->lexemes.count;
+  uint32_t id = strtab_intern(&t->lexemes, lexeme);
+
+  if (id < count)
+    return 0;
+
+  if (id == t->capacity)
+    grow(t);
+
+  t->sizes[id] = size;
+  t->types[id] = strtab_intern(&t->names, type);
+  t->scopes[id] = strtab_intern(&t->names, scope);
+  return 1;
+}
+
+uint32_t symtab_find(const SymbolTable *t, const char *lexeme) {
+  return strtab_find(&t->lexemes, lexeme);
+}
+
+static size_t indexBytes(const StringIndex *index) {
+  size_t bytes =
+      sizeof(StringIndex) + sizeof(StringIndexBucket *) * index->dir_size;
+
+  for (int i = 0; i < index->dir_size; i++) {
+    if (StringIndex_isFirst(index, i))
+      bytes += sizeof(StringIndexBucket) +
+               sizeof(StringIndexSlot) * index->bucket_limit;
+  }
+
+  return bytes;
+}
+
+static size_t tableBytes(const StringTable *t) {
+  return t->pool_capacity + sizeof(uint32_t) * t->capacity +
+         indexBytes(t->index);
+}
+
+size_t symtab_bytes(const SymbolTable *t) {
+  return sizeof(*t) + tableBytes(&t->lexemes) + tableBytes(&t->names) +
+         (sizeof(int32_t) + 2 * sizeof(uint32_t)) * t->capacity;
+}
@@ -1,11 +1,34 @@
 #include "lexer/token.h"
 
+#include <stdio.h>
+
+#include "alloc.h"
+
 Token *token_create(char token_name[], int row, int col, int index, char type[]) {
-  Token* tk = malloc(sizeof(Token));
+  Token* tk = alloc_malloc(ALLOC_TOKEN, sizeof(Token));
   tk->row = row;
   tk->col = col;
   tk->index = index;
-  strcpy(tk->token_name, token_name);
+  snprintf(tk->token_name, sizeof(tk->token_name), "%s", token_name);
   strcpy(tk->type, type);
   return tk;
 }
+
+void token_destroy(Token *tok) { alloc_free(tok); }
+
+int token_isKeyword(const char *name) {
+  static const char *keywords[] = {
+      "auto",     "break",    "case",     "char",   "const",   "continue",
+      "default",  "do",       "double",   "else",   "enum",    "extern",
+      "float",    "for",      "goto",     "if",     "inline",  "int",
+      "long",     "register", "restrict", "return", "short",   "signed",
+      "sizeof",   "static",   "struct",   "switch", "typedef", "union",
+      "unsigned", "void",     "volatile", "while",  "FILE",    "size_t"};
+
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    if (strcmp(name, keywords[i]) == 0)
+      return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,421 @@
+#include "lexer/tokenstream.h"
+#include "alloc.h"
+#include "lexer/lexer.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXT_GAP 4096
+
+/* Windows are lexed into a stream whose gaps stay at the end */
+static void pushToken(TokenStream *ts, Token *tok) {
+  if (ts->count == ts->capacity) {
+    ts->capacity = ts->capacity ? ts->capacity * 2 : 64;
+    ts->tokens = alloc_realloc(ALLOC_LEXER, ts->tokens,
+                               sizeof(Token *) * ts->capacity);
+  }
+
+  ts->tokens[ts->count++] = tok;
+  ts->token_gap = ts->count;
+}
+
+static void pushLine(TokenStream *ts, LineInfo line) {
+  if (ts->line_count == ts->line_capacity) {
+    ts->line_capacity = ts->line_capacity ? ts->line_capacity * 2 : 64;
+    ts->lines = alloc_realloc(ALLOC_LEXER, ts->lines,
+                              sizeof(LineInfo) * ts->line_capacity);
+  }
+
+  ts->lines[ts->line_count++] = line;
+  ts->line_gap = ts->line_count;
+}
+
+static int sameState(PPState a, PPState b) {
+  return a.in_string == b.in_string && a.in_char == b.in_char &&
+         a.in_comment == b.in_comment && a.start_of_line == b.start_of_line &&
+         a.in_directive == b.in_directive;
+}
+
+static int countLines(const char *s, size_t len) {
+  int n = 0;
+  for (size_t i = 0; i < len; i++)
+    n += (s[i] == '\n');
+  return n;
+}
+
+static Token *tokenAt(const TokenStream *ts, int i) {
+  return ts->tokens[i < ts->token_gap ? i : i + ts->capacity - ts->count];
+}
+
+static unsigned int tokenRow(const TokenStream *ts, int i) {
+  unsigned int row = tokenAt(ts, i)->row;
+  return i < ts->token_gap ? row : ts->line_count - row;
+}
+
+static int tokenIndex(const TokenStream *ts, int i) {
+  int index = tokenAt(ts, i)->index;
+  return i < ts->token_gap || index < 0 ? index : ts->identifiers - index;
+}
+
+/* Switches a token between absolute and counted from the end */
+static void flipToken(const TokenStream *ts, Token *tok) {
+  tok->row = ts->line_count - tok->row;
+  if (tok->index >= 0)
+    tok->index = ts->identifiers - tok->index;
+}
+
+static void moveTokenGap(TokenStream *ts, int to) {
+  int gap = ts->capacity - ts->count;
+
+  while (ts->token_gap > to) {
+    Token *tok = ts->tokens[--ts->token_gap];
+    flipToken(ts, tok);
+    ts->tokens[ts->token_gap + gap] = tok;
+  }
+
+  while (ts->token_gap < to) {
+    Token *tok = ts->tokens[ts->token_gap + gap];
+    flipToken(ts, tok);
+    ts->tokens[ts->token_gap++] = tok;
+  }
+}
+
+static void reserveTokens(TokenStream *ts, int n) {
+  int old = ts->capacity, tail = ts->count - ts->token_gap;
+
+  if (ts->count + n <= old)
+    return;
+
+  while (ts->count + n > ts->capacity)
+    ts->capacity = ts->capacity ? ts->capacity * 2 : 64;
+  ts->tokens =
+      alloc_realloc(ALLOC_LEXER, ts->tokens, sizeof(Token *) * ts->capacity);
+  memmove(ts->tokens + ts->capacity - tail, ts->tokens + old - tail,
+          sizeof(Token *) * tail);
+}
+
+static LineInfo lineGet(const TokenStream *ts, int i) {
+  if (i < ts->line_gap)
+    return ts->lines[i];
+
+  LineInfo line = ts->lines[i + ts->line_capacity - ts->line_count];
+  line.offset = ts->len - line.offset;
+  return line;
+}
+
+static void moveLineGap(TokenStream *ts, int to) {
+  int gap = ts->line_capacity - ts->line_count;
+
+  while (ts->line_gap > to) {
+    LineInfo line = ts->lines[--ts->line_gap];
+    line.offset = ts->len - line.offset;
+    ts->lines[ts->line_gap + gap] = line;
+  }
+
+  while (ts->line_gap < to) {
+    LineInfo line = ts->lines[ts->line_gap + gap];
+    line.offset = ts->len - line.offset;
+    ts->lines[ts->line_gap++] = line;
+  }
+}
+
+static void reserveLines(TokenStream *ts, int n) {
+  int old = ts->line_capacity, tail = ts->line_count - ts->line_gap;
+
+  if (ts->line_count + n <= old)
+    return;
+
+  while (ts->line_count + n > ts->line_capacity)
+    ts->line_capacity = ts->line_capacity ? ts->line_capacity * 2 : 64;
+  ts->lines = alloc_realloc(ALLOC_LEXER, ts->lines,
+                            sizeof(LineInfo) * ts->line_capacity);
+  memmove(ts->lines + ts->line_capacity - tail, ts->lines + old - tail,
+          sizeof(LineInfo) * tail);
+}
+
+static void moveTextGap(TokenStream *ts, size_t to) {
+  if (to < ts->gap)
+    memmove(ts->text + to + ts->gap_len, ts->text + to, ts->gap - to);
+  else
+    memmove(ts->text + ts->gap, ts->text + ts->gap + ts->gap_len,
+            to - ts->gap);
+  ts->gap = to;
+}
+
+static void reserveText(TokenStream *ts, size_t n) {
+  if (n <= ts->gap_len)
+    return;
+
+  size_t tail = ts->len - ts->gap;
+  size_t gap_len = n + TEXT_GAP + ts->len / 4;
+
+  ts->text = alloc_realloc(ALLOC_LEXER, ts->text, ts->len + gap_len);
+  memmove(ts->text + ts->gap + gap_len, ts->text + ts->gap + ts->gap_len,
+          tail);
+  ts->gap_len = gap_len;
+}
+
+static int tokenEndRow(const TokenStream *ts, int i) {
+  const Token *tok = tokenAt(ts, i);
+  size_t len = strlen(tok->token_name);
+
+  if (len == sizeof(tok->token_name) - 1)
+    return INT_MAX;
+
+  return tokenRow(ts, i) + countLines(tok->token_name, len);
+}
+
+static int lineAt(const TokenStream *ts, size_t offset) {
+  int lo = 0, hi = ts->line_count - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (lineGet(ts, mid).offset <= (long)offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return lo;
+}
+
+static int firstTokenAt(const TokenStream *ts, int row) {
+  int lo = 0, hi = ts->count;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if ((int)tokenRow(ts, mid) < row)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static int nextIndex(const TokenStream *ts, int t) {
+  while (t-- > 0) {
+    int index = tokenIndex(ts, t);
+    if (index >= 0)
+      return index + 1;
+  }
+
+  return 0;
+}
+
+static int countIdentifiers(const TokenStream *ts, int from, int to) {
+  int n = 0;
+  for (int i = from; i < to; i++)
+    n += (tokenAt(ts, i)->index >= 0);
+  return n;
+}
+
+/*
+ * Preprocesses and lexes the source starting at line `from` (whose first row
+ * is `row`). At most `max_lines` lines are consumed; when the limit is hit the
+ * start of the following line is pushed as one extra entry in `out->lines` and
+ * 0 is returned. Returns 1 when the end of the source was reached.
+ */
+static int lexRange(TokenStream *ts, LineInfo from, int row, int max_lines,
+                    int index, TokenStream *out) {
+  LineInfo line = from;
+  char *buf = NULL;
+  size_t size = 0;
+  int eof = 1;
+
+  FILE *pp = open_memstream(&buf, &size);
+  pushLine(out, line);
+
+  if (from.offset < (long)ts->len) {
+    moveTextGap(ts, from.offset);
+
+    FILE *in = fmemopen(ts->text + ts->gap + ts->gap_len,
+                        ts->len - from.offset, "r");
+
+    while (preprocessLine(in, pp, &line.state)) {
+      line.offset = from.offset + ftell(in);
+      pushLine(out, line);
+
+      if (out->line_count > max_lines) {
+        eof = 0;
+        break;
+      }
+    }
+
+    fclose(in);
+  }
+
+  fclose(pp);
+
+  if (size > 0) {
+    FILE *fp = fmemopen(buf, size, "r");
+    resetLexer(row, 1, index);
+
+    Token *tok;
+    while ((tok = getNextToken(fp)) && strcmp(tok->type, "EOF") != 0)
+      pushToken(out, tok);
+
+    token_destroy(tok);
+    fclose(fp);
+  }
+
+  free(buf);
+  return eof;
+}
+
+TokenStream *tokenstream_create(const char *text, size_t len) {
+  TokenStream *ts = alloc_calloc(ALLOC_LEXER, 1, sizeof(TokenStream));
+  if (!ts)
+    return NULL;
+
+  ts->gap_len = TEXT_GAP;
+  ts->text = alloc_malloc(ALLOC_LEXER, len + ts->gap_len);
+  memcpy(ts->text + ts->gap_len, text, len);
+  ts->len = len;
+
+  TokenStream win = {0};
+  LineInfo first = {0, PP_STATE_INIT};
+  lexRange(ts, first, 1, INT_MAX, 0, &win);
+
+  ts->tokens = win.tokens;
+  ts->count = ts->token_gap = win.count;
+  ts->capacity = win.capacity;
+  ts->identifiers = countIdentifiers(&win, 0, win.count);
+
+  ts->lines = win.lines;
+  ts->line_count = ts->line_gap = win.line_count;
+  ts->line_capacity = win.line_capacity;
+
+  return ts;
+}
+
+static void spliceTokens(TokenStream *ts, int t0, int t1,
+                         const TokenStream *win) {
+  moveTokenGap(ts, t0);
+
+  for (int i = t0; i < t1; i++)
+    token_destroy(tokenAt(ts, i));
+  ts->count -= t1 - t0;
+
+  reserveTokens(ts, win->count);
+  memcpy(ts->tokens + t0, win->tokens, sizeof(Token *) * win->count);
+  ts->token_gap += win->count;
+  ts->count += win->count;
+}
+
+static void spliceLines(TokenStream *ts, int l0, int l1,
+                        const TokenStream *win, int new_lines) {
+  moveLineGap(ts, l0);
+  ts->line_count -= l1 - l0;
+
+  reserveLines(ts, new_lines);
+  memcpy(ts->lines + l0, win->lines, sizeof(LineInfo) * new_lines);
+  ts->line_gap += new_lines;
+  ts->line_count += new_lines;
+}
+
+void tokenstream_edit(TokenStream *ts, size_t offset, size_t removed,
+                      const char *inserted, size_t inserted_len) {
+  if (!ts)
+    return;
+
+  if (offset > ts->len)
+    offset = ts->len;
+  if (removed > ts->len - offset)
+    removed = ts->len - offset;
+
+  int first = lineAt(ts, offset);
+  int last_old = lineAt(ts, offset + removed);
+
+  /* Lines past the edit count from the end, so they follow the text */
+  moveLineGap(ts, first + 1);
+  moveTextGap(ts, offset);
+
+  int delta = countLines(inserted, inserted_len) -
+              countLines(ts->text + ts->gap + ts->gap_len, removed);
+
+  ts->gap_len += removed;
+  ts->len -= removed;
+  reserveText(ts, inserted_len);
+  memcpy(ts->text + ts->gap, inserted, inserted_len);
+  ts->gap += inserted_len;
+  ts->gap_len -= inserted_len;
+  ts->len += inserted_len;
+
+  int start = first;
+  int t0 = firstTokenAt(ts, start + 1);
+
+  while (t0 > 0 && tokenEndRow(ts, t0 - 1) > start) {
+    start = tokenRow(ts, t0 - 1) - 1;
+    t0 = firstTokenAt(ts, start + 1);
+  }
+
+  int index = nextIndex(ts, t0);
+  int lines = last_old + delta + 1 - start;
+
+  for (;;) {
+    TokenStream win = {0};
+    int eof = lexRange(ts, lineGet(ts, start), start + 1, lines, index, &win);
+
+    int old_line = ts->line_count;
+    int t1 = ts->count;
+    int synced = eof;
+
+    if (!eof) {
+      Token *last = win.count ? win.tokens[win.count - 1] : NULL;
+
+      old_line = start + lines - delta;
+      t1 = firstTokenAt(ts, old_line + 1);
+
+      synced = old_line > last_old && old_line < ts->line_count &&
+               sameState(win.lines[lines].state,
+                         lineGet(ts, old_line).state) &&
+               (t1 == 0 || tokenEndRow(ts, t1 - 1) <= old_line) &&
+               (!last || strcmp(last->type, "BAD_STRING") != 0);
+    }
+
+    if (synced) {
+      int index_delta = countIdentifiers(&win, 0, win.count) -
+                        countIdentifiers(ts, t0, t1);
+
+      /* The tail is relative to the old totals until both splices are done */
+      spliceTokens(ts, t0, t1, &win);
+      spliceLines(ts, start, old_line, &win, eof ? win.line_count : lines);
+      ts->identifiers += index_delta;
+
+      alloc_free(win.tokens);
+      alloc_free(win.lines);
+      return;
+    }
+
+    for (int i = 0; i < win.count; i++)
+      token_destroy(win.tokens[i]);
+    alloc_free(win.tokens);
+    alloc_free(win.lines);
+
+    lines *= 2;
+  }
+}
+
+Token *tokenstream_token(TokenStream *ts, int i) {
+  if (!ts || i < 0 || i >= ts->count)
+    return NULL;
+
+  moveTokenGap(ts, i + 1);
+  return ts->tokens[i];
+}
+
+void tokenstream_destroy(TokenStream *ts) {
+  if (!ts)
+    return;
+
+  for (int i = 0; i < ts->count; i++)
+    token_destroy(tokenAt(ts, i));
+
+  alloc_free(ts->tokens);
+  alloc_free(ts->lines);
+  alloc_free(ts->text);
+  alloc_free(ts);
+}
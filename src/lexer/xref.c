@@ -0,0 +1,532 @@
+#include "lexer/xref.h"
+#include "alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define XREF_MAGIC "XRF2"
+#define XREF_BUCKET_LIMIT 8
+
+static inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static void reserve(XrefList *l, uint32_t extra) {
+  if (l->len + extra <= l->capacity)
+    return;
+
+  l->capacity = l->capacity ? l->capacity : 16;
+  while (l->len + extra > l->capacity)
+    l->capacity *= 2;
+  l->data = alloc_realloc(ALLOC_XREF, l->data, l->capacity);
+}
+
+static void putVarint(XrefList *l, uint32_t v) {
+  while (v >= 0x80) {
+    l->data[l->len++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  l->data[l->len++] = v;
+}
+
+static int getVarint(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+  uint32_t result = 0;
+
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    uint8_t b = *(*p)++;
+    result |= (uint32_t)(b & 0x7f) << shift;
+
+    if (!(b & 0x80)) {
+      *v = result;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void append(XrefList *l, XrefOccurrence at) {
+  XrefOccurrence base = l->last;
+  int new_file = at.file != base.file;
+  int new_row = new_file || at.row != base.row;
+
+  if (new_file)
+    base.row = 0;
+  if (new_row)
+    base.col = 0;
+
+  reserve(l, 15);
+  putVarint(l, zigzag(at.file - base.file));
+  putVarint(l, zigzag(at.row - base.row));
+  putVarint(l, zigzag(at.col - base.col));
+
+  l->last = at;
+  l->count++;
+}
+
+XrefIndex *xref_create(void) {
+  XrefIndex *index = alloc_calloc(ALLOC_XREF, 1, sizeof(XrefIndex));
+
+  strtab_init(&index->names, XREF_BUCKET_LIMIT, 0);
+  strtab_init(&index->files, XREF_BUCKET_LIMIT, 0);
+  return index;
+}
+
+void xref_destroy(XrefIndex *index) {
+  if (!index)
+    return;
+
+  for (uint32_t i = 0; i < index->list_capacity; i++)
+    alloc_free(index->lists[i].data);
+  for (uint32_t i = 0; i < index->file_capacity; i++)
+    alloc_free(index->file_names[i].ids);
+
+  alloc_free(index->lists);
+  alloc_free(index->file_names);
+  strtab_free(&index->names);
+  strtab_free(&index->files);
+  alloc_free(index);
+}
+
+static void reserveFiles(XrefIndex *index, uint32_t count) {
+  uint32_t old = index->file_capacity;
+
+  if (count <= old)
+    return;
+
+  index->file_capacity = old ? old : 16;
+  while (count > index->file_capacity)
+    index->file_capacity *= 2;
+
+  index->file_names = alloc_realloc(ALLOC_XREF, index->file_names,
+                                    sizeof(XrefNames) * index->file_capacity);
+  memset(index->file_names + old, 0,
+         sizeof(XrefNames) * (index->file_capacity - old));
+}
+
+uint32_t xref_file(XrefIndex *index, const char *path) {
+  uint32_t id = strtab_intern(&index->files, path);
+
+  reserveFiles(index, id + 1);
+  return id;
+}
+
+static void noteName(XrefNames *names, uint32_t name) {
+  if (names->count == names->capacity) {
+    names->capacity = names->capacity ? names->capacity * 2 : 16;
+    names->ids = alloc_realloc(ALLOC_XREF, names->ids,
+                               sizeof(uint32_t) * names->capacity);
+  }
+
+  names->ids[names->count++] = name;
+}
+
+static void reserveLists(XrefIndex *index, uint32_t count) {
+  uint32_t old = index->list_capacity;
+
+  if (count <= old)
+    return;
+
+  index->list_capacity = old ? old : 64;
+  while (count > index->list_capacity)
+    index->list_capacity *= 2;
+
+  index->lists = alloc_realloc(ALLOC_XREF, index->lists,
+                               sizeof(XrefList) * index->list_capacity);
+  memset(index->lists + old, 0,
+         sizeof(XrefList) * (index->list_capacity - old));
+}
+
+uint32_t xref_name(XrefIndex *index, const char *name) {
+  uint32_t id = strtab_intern(&index->names, name);
+
+  reserveLists(index, id + 1);
+  return id;
+}
+
+void xref_add(XrefIndex *index, uint32_t name, uint32_t file, uint32_t row,
+              uint32_t col) {
+  XrefOccurrence at = {file, row, col};
+  XrefList *l = &index->lists[name];
+
+  if (!l->count || l->last.file != file)
+    noteName(&index->file_names[file], name);
+  append(l, at);
+}
+
+uint32_t xref_find(const XrefIndex *index, const char *name) {
+  return strtab_find(&index->names, name);
+}
+
+uint32_t xref_count(const XrefIndex *index, uint32_t name) {
+  return name < index->names.count ? index->lists[name].count : 0;
+}
+
+void xref_begin(const XrefIndex *index, uint32_t name, XrefCursor *cursor) {
+  memset(cursor, 0, sizeof(*cursor));
+
+  if (name < index->names.count) {
+    const XrefList *l = &index->lists[name];
+    cursor->p = l->data;
+    cursor->end = l->data + l->len;
+  }
+}
+
+int xref_next(XrefCursor *cursor, XrefOccurrence *out) {
+  uint32_t file, row, col;
+
+  if (cursor->p >= cursor->end ||
+      !getVarint(&cursor->p, cursor->end, &file) ||
+      !getVarint(&cursor->p, cursor->end, &row) ||
+      !getVarint(&cursor->p, cursor->end, &col))
+    return 0;
+
+  XrefOccurrence *at = &cursor->at;
+
+  if (file != 0) {
+    at->file += unzigzag(file);
+    at->row = 0;
+  }
+  if (file != 0 || row != 0)
+    at->col = 0;
+
+  at->row += unzigzag(row);
+  at->col += unzigzag(col);
+
+  *out = *at;
+  return 1;
+}
+
+static void removeOccurrences(XrefList *l, const uint8_t *files) {
+  XrefList kept = {0};
+  XrefCursor cursor = {l->data, l->data + l->len, {0, 0, 0}};
+  XrefOccurrence at;
+
+  while (xref_next(&cursor, &at)) {
+    if (!files[at.file])
+      append(&kept, at);
+  }
+
+  kept.stamp = l->stamp;
+  alloc_free(l->data);
+  *l = kept;
+}
+
+void xref_removeFiles(XrefIndex *index, const uint8_t *files) {
+  /* A name listed under several flagged files is filtered once */
+  index->stamp++;
+
+  for (uint32_t f = 0; f < index->files.count; f++) {
+    XrefNames *names = &index->file_names[f];
+
+    if (!files[f])
+      continue;
+
+    for (uint32_t i = 0; i < names->count; i++) {
+      XrefList *l = &index->lists[names->ids[i]];
+
+      if (l->stamp != index->stamp) {
+        l->stamp = index->stamp;
+        removeOccurrences(l, files);
+      }
+    }
+
+    names->count = 0;
+  }
+}
+
+/* A directory entry as saved; names are sorted by spelling */
+typedef struct XrefEntry {
+  uint64_t name_at;
+  uint32_t name_len, id;
+  uint32_t count, len;
+  uint64_t list_at; /* from the start of the lists */
+} XrefEntry;
+
+typedef struct SortedName {
+  const char *name;
+  XrefEntry entry;
+} SortedName;
+
+static int writeU32(FILE *out, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, out) == 1;
+}
+
+static int readU32(FILE *in, uint32_t *v) {
+  return fread(v, sizeof(*v), 1, in) == 1;
+}
+
+static int writeU64(FILE *out, uint64_t v) {
+  return fwrite(&v, sizeof(v), 1, out) == 1;
+}
+
+static int readU64(FILE *in, uint64_t *v) {
+  return fread(v, sizeof(*v), 1, in) == 1;
+}
+
+static uint64_t tableSize(const StringTable *t) {
+  uint64_t size = 4;
+
+  for (uint32_t i = 0; i < t->count; i++)
+    size += 4 + strlen(strtab_get(t, i));
+  return size;
+}
+
+static int writeTable(const StringTable *t, FILE *out) {
+  if (!writeU32(out, t->count))
+    return 0;
+
+  for (uint32_t i = 0; i < t->count; i++) {
+    const char *s = strtab_get(t, i);
+    uint32_t len = strlen(s);
+
+    if (!writeU32(out, len) || fwrite(s, 1, len, out) != len)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Interns the strings in order; fails unless each gets its stored ID */
+static int readTable(StringTable *t, FILE *in, uint64_t size) {
+  uint32_t count, capacity = 0;
+  char *buf = NULL;
+  int ok = readU32(in, &count);
+
+  for (uint32_t i = 0; ok && i < count; i++) {
+    uint32_t len;
+
+    if (!readU32(in, &len) || len > size - (uint64_t)ftell(in)) {
+      ok = 0;
+      break;
+    }
+
+    if (len >= capacity) {
+      capacity = len + 1 > 64 ? len + 1 : 64;
+      buf = alloc_realloc(ALLOC_XREF, buf, capacity);
+    }
+
+    buf[len] = '\0';
+    ok = fread(buf, 1, len, in) == len && strtab_intern(t, buf) == i;
+  }
+
+  alloc_free(buf);
+  return ok;
+}
+
+static int compareSorted(const void *a, const void *b) {
+  return strcmp(((const SortedName *)a)->name, ((const SortedName *)b)->name);
+}
+
+int xref_save(const XrefIndex *index, FILE *out) {
+  uint32_t count = index->names.count;
+  SortedName *sorted =
+      alloc_malloc(ALLOC_XREF, sizeof(SortedName) * (count ? count : 1));
+  uint64_t at = 4 + 16 + tableSize(&index->files) + 4, list_at = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    const XrefList *l = &index->lists[i];
+    const char *name = strtab_get(&index->names, i);
+    uint32_t len = strlen(name);
+
+    sorted[i].name = name;
+    sorted[i].entry = (XrefEntry){at + 4, len, i, l->count, l->len, list_at};
+    at += 4 + len;
+    list_at += l->len;
+  }
+
+  qsort(sorted, count, sizeof(SortedName), compareSorted);
+
+  uint64_t dir_at = at, lists_at = dir_at + 4 + sizeof(XrefEntry) * count;
+  int ok = fwrite(XREF_MAGIC, 1, 4, out) == 4 && writeU64(out, dir_at) &&
+           writeU64(out, lists_at) && writeTable(&index->files, out) &&
+           writeTable(&index->names, out) && writeU32(out, count);
+
+  for (uint32_t i = 0; ok && i < count; i++)
+    ok = fwrite(&sorted[i].entry, sizeof(XrefEntry), 1, out) == 1;
+
+  for (uint32_t i = 0; ok && i < count; i++) {
+    const XrefList *l = &index->lists[i];
+    ok = fwrite(l->data, 1, l->len, out) == l->len;
+  }
+
+  alloc_free(sorted);
+  return ok && fflush(out) == 0 ? 0 : -1;
+}
+
+/*
+ * Reads the list of `name`, at most `avail` bytes, recovering its last
+ * occurrence for appending
+ */
+static int readList(XrefIndex *index, uint32_t name, const XrefEntry *e,
+                    uint64_t avail, FILE *in) {
+  XrefList *l = &index->lists[name];
+
+  if (e->len > avail || e->len > (uint64_t)e->count * 15)
+    return 0;
+
+  reserve(l, e->len);
+  if (fread(l->data, 1, e->len, in) != e->len)
+    return 0;
+  l->len = e->len;
+
+  XrefCursor cursor = {l->data, l->data + l->len, {0, 0, 0}};
+  XrefOccurrence at;
+
+  while (xref_next(&cursor, &at)) {
+    if (at.file >= index->files.count)
+      return 0;
+    if (!l->count || at.file != l->last.file)
+      noteName(&index->file_names[at.file], name);
+    l->last = at;
+    l->count++;
+  }
+
+  return cursor.p == cursor.end && l->count == e->count;
+}
+
+/* Checks the magic and reads the section offsets and the file table */
+static int readHead(XrefIndex *index, FILE *in, uint64_t *size,
+                    uint64_t *dir_at, uint64_t *lists_at) {
+  char magic[4];
+  long end;
+
+  if (fseek(in, 0, SEEK_END) != 0 || (end = ftell(in)) < 0 ||
+      fseek(in, 0, SEEK_SET) != 0)
+    return 0;
+  *size = end;
+
+  if (fread(magic, 1, 4, in) != 4 || memcmp(magic, XREF_MAGIC, 4) != 0 ||
+      !readU64(in, dir_at) || !readU64(in, lists_at) ||
+      *dir_at > *lists_at || *lists_at > *size ||
+      !readTable(&index->files, in, *size))
+    return 0;
+
+  reserveFiles(index, index->files.count);
+  return 1;
+}
+
+static int readIndex(XrefIndex *index, FILE *in) {
+  uint64_t size, dir_at, lists_at, list_at = 0;
+  uint32_t count;
+
+  if (!readHead(index, in, &size, &dir_at, &lists_at) ||
+      !readTable(&index->names, in, size) || (uint64_t)ftell(in) != dir_at ||
+      !readU32(in, &count) || count != index->names.count ||
+      dir_at + 4 + sizeof(XrefEntry) * (uint64_t)count != lists_at)
+    return 0;
+
+  XrefEntry *entries =
+      alloc_calloc(ALLOC_XREF, count ? count : 1, sizeof(XrefEntry));
+  uint8_t *seen = alloc_calloc(ALLOC_XREF, count ? count : 1, 1);
+  const char *prev = NULL;
+  int ok = 1;
+
+  reserveLists(index, count);
+
+  /* Queries binary search the directory, so it must be exact and sorted */
+  for (uint32_t i = 0; ok && i < count; i++) {
+    XrefEntry e;
+
+    ok = fread(&e, sizeof(e), 1, in) == 1 && e.id < count && !seen[e.id];
+    if (!ok)
+      break;
+
+    const char *name = strtab_get(&index->names, e.id);
+    ok = e.name_len == strlen(name) && (!prev || strcmp(prev, name) < 0);
+    seen[e.id] = 1;
+    entries[e.id] = e;
+    prev = name;
+  }
+
+  for (uint32_t i = 0; ok && i < count; i++) {
+    ok = entries[i].list_at == list_at &&
+         readList(index, i, &entries[i], size - lists_at - list_at, in);
+    list_at += entries[i].len;
+  }
+
+  alloc_free(entries);
+  alloc_free(seen);
+  return ok && (uint64_t)ftell(in) == size;
+}
+
+XrefIndex *xref_load(FILE *in) {
+  XrefIndex *index = xref_create();
+
+  if (readIndex(index, in))
+    return index;
+
+  xref_destroy(index);
+  return NULL;
+}
+
+/* Compares the saved name of `e` with `name` into `c`, like strcmp */
+static int compareEntry(const XrefEntry *e, const char *name, size_t len,
+                        char *buf, FILE *in, int *c) {
+  size_t n = e->name_len < len ? e->name_len : len;
+
+  if (fseek(in, e->name_at, SEEK_SET) != 0 || fread(buf, 1, n, in) != n)
+    return 0;
+
+  *c = memcmp(buf, name, n);
+  if (!*c)
+    *c = (e->name_len > len) - (e->name_len < len);
+  return 1;
+}
+
+static int findName(XrefIndex *index, FILE *in, const char *name) {
+  uint64_t size, dir_at, lists_at;
+  uint32_t count;
+
+  if (!readHead(index, in, &size, &dir_at, &lists_at) ||
+      fseek(in, dir_at, SEEK_SET) != 0 || !readU32(in, &count) ||
+      dir_at + 4 + sizeof(XrefEntry) * (uint64_t)count != lists_at)
+    return 0;
+
+  size_t len = strlen(name);
+  char *buf = alloc_malloc(ALLOC_XREF, len + 1);
+  uint32_t lo = 0, hi = count;
+  XrefEntry e;
+  int c = 1, ok = 1;
+
+  while (ok && lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    ok = fseek(in, dir_at + 4 + sizeof(XrefEntry) * (uint64_t)mid,
+               SEEK_SET) == 0 &&
+         fread(&e, sizeof(e), 1, in) == 1 && e.name_at <= dir_at &&
+         e.name_len <= dir_at - e.name_at &&
+         compareEntry(&e, name, len, buf, in, &c);
+    if (!ok || c == 0)
+      break;
+
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  alloc_free(buf);
+
+  if (!ok || c != 0)
+    return ok;
+
+  uint32_t id = xref_name(index, name);
+  return e.list_at <= size - lists_at &&
+         fseek(in, lists_at + e.list_at, SEEK_SET) == 0 &&
+         readList(index, id, &e, size - lists_at - e.list_at, in);
+}
+
+XrefIndex *xref_loadName(FILE *in, const char *name) {
+  XrefIndex *index = xref_create();
+
+  if (findName(index, in, name))
+    return index;
+
+  xref_destroy(index);
+  return NULL;
+}
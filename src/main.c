@@ -1,16 +1,16 @@
-#include <stdio.h>
+#include <string.h>
 
-#include "compiler/compiler.h"
+#include "compiler/driver.h"
+#include "preprocessor/include.h"
+#include "server/protocol.h"
+#include "server/server.h"
 
 int main(int argc, char *argv[]) {
-  // if (argc != 2) {
-  //   printf("Use as ./compile <input-file-location>\n");
-  //   return 0;
-  // }
-  //
-  // char *input_file = argv[1];
-  char input_file[] = "/home/asmitpaul/Projects/compiler/build/sample.c";
-  compile(input_file);
+  if (argc > 1 && strcmp(argv[1], "--server") == 0)
+    return runServer(argc > 2 ? argv[2] : serverSocketPath());
 
-  return 0;
+  int status = runCompiler(argc, argv, NULL, 0);
+
+  clearHeaderCache();
+  return status;
 }
@@ -0,0 +1,119 @@
+#include "parser/ast.h"
+#include "alloc.h"
+
+#include <string.h>
+
+static const char *kind_names[AST_KIND_COUNT] = {
+    "None",      "TranslationUnit", "Declaration", "Type",    "Enumerator",
+    "Variable",  "Function",        "Array",       "Param",   "Ellipsis",
+    "Compound",  "If",              "While",       "Do",      "For",
+    "ForHead",   "Switch",          "Case",        "Default", "Label",
+    "Goto",      "Return",          "Break",       "Continue", "ExprStmt",
+    "Empty",     "Ident",           "Number",      "String",  "Char",
+    "Unary",     "Postfix",         "Binary",      "Assign",  "Ternary",
+    "Call",      "Index",           "Member",      "Cast",    "Sizeof",
+    "InitList",  "Designation"};
+
+static const char *op_names[OP_COUNT] = {
+    "",  "+",  "-",  "*",  "/",  "%", "<<", ">>", "<", ">",
+    "<=", ">=", "==", "!=", "&", "|", "^",  "&&", "||", ",",
+    "!",  "~",  "-",  "+",  "*", "&", "++", "--"};
+
+Ast *ast_create(void) {
+  Ast *ast = alloc_calloc(ALLOC_AST, 1, sizeof(Ast));
+
+  ast->capacity = 1024;
+  ast->nodes = alloc_malloc(ALLOC_AST, sizeof(AstNode) * ast->capacity);
+  ast->strings_capacity = 4096;
+  ast->strings = alloc_malloc(ALLOC_AST, ast->strings_capacity);
+
+  memset(&ast->nodes[0], 0, sizeof(AstNode));
+  ast->count = 1;
+  ast->strings[0] = '\0';
+  ast->strings_len = 1;
+
+  return ast;
+}
+
+void ast_destroy(Ast *ast) {
+  if (!ast)
+    return;
+
+  alloc_free(ast->nodes);
+  alloc_free(ast->strings);
+  alloc_free(ast);
+}
+
+AstIndex ast_add(Ast *ast, AstKind kind, int row, int col) {
+  if (ast->count == ast->capacity) {
+    ast->capacity *= 2;
+    ast->nodes =
+        alloc_realloc(ALLOC_AST, ast->nodes, sizeof(AstNode) * ast->capacity);
+  }
+
+  AstNode *n = &ast->nodes[ast->count];
+  memset(n, 0, sizeof(*n));
+  n->kind = kind;
+  n->row = row;
+  n->col = col;
+
+  return ast->count++;
+}
+
+uint32_t ast_addText(Ast *ast, const char *text, size_t len) {
+  if (!len)
+    return 0;
+
+  if (ast->strings_len + len + 1 > ast->strings_capacity) {
+    while (ast->strings_len + len + 1 > ast->strings_capacity)
+      ast->strings_capacity *= 2;
+    ast->strings =
+        alloc_realloc(ALLOC_AST, ast->strings, ast->strings_capacity);
+  }
+
+  uint32_t offset = ast->strings_len;
+  memcpy(ast->strings + offset, text, len);
+  ast->strings[offset + len] = '\0';
+  ast->strings_len += len + 1;
+
+  return offset;
+}
+
+const char *ast_kindName(AstKind kind) {
+  return kind < AST_KIND_COUNT ? kind_names[kind] : "?";
+}
+
+const char *ast_opName(AstOp op) { return op < OP_COUNT ? op_names[op] : "?"; }
+
+static void printNode(FILE *out, const Ast *ast, AstIndex i, int depth,
+                      const char *label) {
+  for (; i != AST_NULL; i = ast->nodes[i].next) {
+    const AstNode *n = ast_node(ast, i);
+
+    fprintf(out, "%*s%s%s", depth * 2, "", label, ast_kindName(n->kind));
+
+    if (n->kind == AST_TYPE)
+      fprintf(out, " 0x%x", n->op);
+    else if (n->kind == AST_VARIABLE && n->op)
+      fprintf(out, " fnptr");
+    else if (n->op)
+      fprintf(out, " %s", ast_opName(n->op));
+
+    if (n->text)
+      fprintf(out, " '%s'", ast_text(ast, i));
+    if (n->flags)
+      fprintf(out, " flags=%d", n->flags);
+
+    fprintf(out, " <%u:%u>\n", n->row, n->col);
+
+    printNode(out, ast, n->a, depth + 1, "a: ");
+    printNode(out, ast, n->b, depth + 1, "b: ");
+    printNode(out, ast, n->c, depth + 1, "c: ");
+  }
+}
+
+void ast_print(FILE *out, const Ast *ast) {
+  fprintf(out, "\n=== AST (%u nodes) ===\n\n", ast->count - 1);
+  printNode(out, ast, ast->root, 0, "");
+  fprintf(out, "\n====================\n");
+}
@@ -0,0 +1,1170 @@
+#include "parser/parser.h"
+#include "alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define LOOKAHEAD 4
+
+typedef struct Parser {
+  TokenSource source;
+  void *ctx;
+
+  Token *raw;
+  Token *ahead[LOOKAHEAD];
+  int head, count;
+
+  Ast *ast;
+
+  uint32_t *typedefs;
+  int typedef_count, typedef_capacity;
+
+  int errors;
+  int panic;
+} Parser;
+
+typedef struct List {
+  AstIndex head, tail;
+} List;
+
+static const char *storage_words[] = {"typedef", "extern",   "static",
+                                      "auto",    "register", "inline", NULL};
+static const char *type_words[] = {
+    "void",     "char",     "short",    "int",   "long",  "float",
+    "double",   "signed",   "unsigned", "const", "volatile", "restrict",
+    "struct",   "union",    "enum",     "FILE",  "size_t", NULL};
+static const char *statement_words[] = {
+    "if",    "while",    "do",     "for",  "switch", "case",
+    "default", "break", "continue", "return", "goto", NULL};
+
+static AstIndex parseExpression(Parser *p);
+static AstIndex parseAssignment(Parser *p);
+static AstIndex parseConditional(Parser *p);
+static AstIndex parseCast(Parser *p);
+static AstIndex parseUnary(Parser *p);
+static AstIndex parseStatement(Parser *p);
+static AstIndex parseCompound(Parser *p);
+static AstIndex parseDeclaration(Parser *p, int external);
+static AstIndex parseDeclarator(Parser *p, int abstract);
+static AstIndex parseInitializer(Parser *p);
+
+static int isType(const Token *tok, const char *type) {
+  return strcmp(tok->type, type) == 0;
+}
+
+static int isText(const Token *tok, const char *text) {
+  return strcmp(tok->token_name, text) == 0;
+}
+
+static int inList(const char *s, const char *list[]) {
+  for (int i = 0; list[i]; i++) {
+    if (strcmp(s, list[i]) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+static Token *pull(Parser *p) {
+  Token *tok = p->raw;
+
+  if (tok) {
+    p->raw = NULL;
+    return tok;
+  }
+
+  tok = p->source(p->ctx);
+  return tok ? tok : token_create("EOF", 0, 0, -1, "EOF");
+}
+
+static int glued(const Token *a, const Token *b) {
+  return a->row == b->row && b->col == a->col + strlen(a->token_name);
+}
+
+static void append(Token *tok, const char *text, const char *type) {
+  size_t len = strlen(tok->token_name);
+
+  snprintf(tok->token_name + len, sizeof(tok->token_name) - len, "%s", text);
+  strcpy(tok->type, type);
+}
+
+/* What `a` followed directly by `b` was before the lexer split it, if any */
+static const char *joinedType(const Token *a, const Token *b) {
+  static const char *ops[][3] = {
+      {"-", ">", "->"},   {"<", "<", "<<"},  {">", ">", ">>"},
+      {"<", "<=", "<<="}, {">", ">=", ">>="}, {"!", "=", "!="},
+      {"&", "=", "&="},   {"|", "=", "|="},  {"^", "=", "^="},
+      {".", ".", ".."},   {"..", ".", "..."}};
+
+  if (isType(a, "NUM") &&
+      (isType(b, "IDENTIFIER") || isType(b, "KEYWORD") || isType(b, "NUM")))
+    return "NUM";
+  if (isText(a, ".") && isType(b, "NUM"))
+    return "NUM";
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (isText(a, ops[i][0]) && isText(b, ops[i][1]))
+      return "PUNCT";
+  }
+
+  return NULL;
+}
+
+static Token *charLiteral(Parser *p, Token *tok) {
+  int escaped = 0;
+
+  for (;;) {
+    Token *next = pull(p);
+
+    if (isType(next, "EOF") || next->row != tok->row) {
+      p->raw = next;
+      break;
+    }
+
+    int gap = next->col - (tok->col + strlen(tok->token_name));
+    for (int i = 0; i < gap; i++)
+      append(tok, " ", "CHAR");
+    append(tok, next->token_name, "CHAR");
+
+    int close = isText(next, "'") && !escaped;
+    escaped = !escaped && isText(next, "\\");
+    token_destroy(next);
+
+    if (close)
+      break;
+  }
+
+  strcpy(tok->type, "CHAR");
+  return tok;
+}
+
+static Token *fetch(Parser *p) {
+  Token *tok = pull(p);
+
+  if (isType(tok, "EOF"))
+    return tok;
+
+  if (isText(tok, "'"))
+    return charLiteral(p, tok);
+
+  for (;;) {
+    Token *next = pull(p);
+    const char *type = joinedType(tok, next);
+
+    if (!type || !glued(tok, next)) {
+      p->raw = next;
+      return tok;
+    }
+
+    append(tok, next->token_name, type);
+    token_destroy(next);
+  }
+}
+
+static Token *peekAt(Parser *p, int k) {
+  while (p->count <= k) {
+    if (p->count &&
+        isType(p->ahead[(p->head + p->count - 1) % LOOKAHEAD], "EOF"))
+      return p->ahead[(p->head + p->count - 1) % LOOKAHEAD];
+
+    p->ahead[(p->head + p->count) % LOOKAHEAD] = fetch(p);
+    p->count++;
+  }
+
+  return p->ahead[(p->head + k) % LOOKAHEAD];
+}
+
+static Token *peek(Parser *p) { return peekAt(p, 0); }
+
+static int atEnd(Parser *p) { return isType(peek(p), "EOF"); }
+
+static void advance(Parser *p) {
+  if (atEnd(p))
+    return;
+
+  token_destroy(p->ahead[p->head]);
+  p->head = (p->head + 1) % LOOKAHEAD;
+  p->count--;
+}
+
+static int is(Parser *p, const char *text) { return isText(peek(p), text); }
+
+static int accept(Parser *p, const char *text) {
+  if (!is(p, text))
+    return 0;
+
+  advance(p);
+  return 1;
+}
+
+static void error(Parser *p, const char *expected) {
+  if (p->panic)
+    return;
+
+  Token *tok = peek(p);
+  fprintf(stderr, "%u:%u: expected %s before '%s'\n", tok->row, tok->col,
+          expected, tok->token_name);
+
+  p->errors++;
+  p->panic = 1;
+}
+
+static int expect(Parser *p, const char *text) {
+  if (accept(p, text))
+    return 1;
+
+  char expected[16];
+  snprintf(expected, sizeof(expected), "'%s'", text);
+  error(p, expected);
+  return 0;
+}
+
+/* Skips to the end of the broken statement; a closing brace is left alone. */
+static void synchronize(Parser *p) {
+  while (!atEnd(p) && !is(p, "}")) {
+    if (accept(p, ";"))
+      break;
+    advance(p);
+  }
+
+  p->panic = 0;
+}
+
+static AstIndex node(Parser *p, AstKind kind, const Token *at) {
+  return ast_add(p->ast, kind, at->row, at->col);
+}
+
+#define N(i) ast_node(p->ast, i)
+
+/* Creates a node carrying the current token's text and consumes the token */
+static AstIndex take(Parser *p, AstKind kind) {
+  Token *tok = peek(p);
+  AstIndex n = node(p, kind, tok);
+  uint32_t text = ast_addText(p->ast, tok->token_name, strlen(tok->token_name));
+
+  N(n)->text = text;
+  advance(p);
+  return n;
+}
+
+static void listAppend(Parser *p, List *list, AstIndex n) {
+  if (n == AST_NULL)
+    return;
+
+  if (list->head == AST_NULL)
+    list->head = n;
+  else
+    N(list->tail)->next = n;
+
+  list->tail = n;
+}
+
+static int isTypedef(Parser *p, const char *name) {
+  for (int i = 0; i < p->typedef_count; i++) {
+    if (strcmp(p->ast->strings + p->typedefs[i], name) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+static void addTypedef(Parser *p, uint32_t name) {
+  if (!name)
+    return;
+
+  if (p->typedef_count == p->typedef_capacity) {
+    p->typedef_capacity = p->typedef_capacity ? p->typedef_capacity * 2 : 16;
+    p->typedefs = alloc_realloc(ALLOC_AST, p->typedefs,
+                                sizeof(uint32_t) * p->typedef_capacity);
+  }
+
+  p->typedefs[p->typedef_count++] = name;
+}
+
+static int isTypeStart(Parser *p, const Token *tok) {
+  if (isType(tok, "KEYWORD"))
+    return inList(tok->token_name, type_words);
+
+  return isType(tok, "IDENTIFIER") && isTypedef(p, tok->token_name);
+}
+
+static int isDeclarationStart(Parser *p) {
+  Token *tok = peek(p);
+
+  if (isType(tok, "KEYWORD"))
+    return inList(tok->token_name, storage_words) ||
+           inList(tok->token_name, type_words);
+
+  if (!isType(tok, "IDENTIFIER") || !isTypedef(p, tok->token_name))
+    return 0;
+
+  Token *next = peekAt(p, 1);
+  return isType(next, "IDENTIFIER") || isText(next, "*");
+}
+
+static AstIndex parseMembers(Parser *p) {
+  List members = {0};
+
+  while (!is(p, "}") && !atEnd(p)) {
+    AstIndex decl = parseDeclaration(p, 0);
+    listAppend(p, &members, decl);
+
+    if (p->panic)
+      synchronize(p);
+  }
+
+  return members.head;
+}
+
+static AstIndex parseEnumerators(Parser *p) {
+  List list = {0};
+
+  while (!is(p, "}") && !atEnd(p)) {
+    if (!isType(peek(p), "IDENTIFIER")) {
+      error(p, "enumerator");
+      synchronize(p);
+      break;
+    }
+
+    AstIndex e = take(p, AST_ENUMERATOR);
+
+    if (accept(p, "=")) {
+      AstIndex value = parseConditional(p);
+      N(e)->a = value;
+    }
+
+    listAppend(p, &list, e);
+
+    if (!accept(p, ","))
+      break;
+  }
+
+  return list.head;
+}
+
+/* struct, union or enum after its keyword; fills the type node fields */
+static void parseTag(Parser *p, int base, uint32_t *name, AstIndex *members,
+                     int *bits) {
+  if (isType(peek(p), "IDENTIFIER") || isType(peek(p), "KEYWORD")) {
+    Token *tok = peek(p);
+    *name = ast_addText(p->ast, tok->token_name, strlen(tok->token_name));
+    advance(p);
+  }
+
+  if (!accept(p, "{"))
+    return;
+
+  *members = base == TYPE_ENUM ? parseEnumerators(p) : parseMembers(p);
+  *bits |= TYPE_DEFINED;
+  expect(p, "}");
+}
+
+/* Returns the AST_TYPE node, or AST_NULL if there are no specifiers */
+static AstIndex parseSpecifiers(Parser *p, int *storage) {
+  Token *start = peek(p);
+  int row = start->row, col = start->col;
+  int bits = 0, base = TYPE_NONE, seen = 0;
+  uint32_t name = 0;
+  AstIndex members = AST_NULL;
+
+  for (;;) {
+    Token *tok = peek(p);
+    const char *w = tok->token_name;
+
+    if (isType(tok, "IDENTIFIER")) {
+      if (base != TYPE_NONE ||
+          (bits & (TYPE_SHORT | TYPE_LONG | TYPE_SIGNED | TYPE_UNSIGNED)) ||
+          !isTypedef(p, w))
+        break;
+
+      base = TYPE_NAME;
+      name = ast_addText(p->ast, w, strlen(w));
+    } else if (!isType(tok, "KEYWORD")) {
+      break;
+    } else if (strcmp(w, "typedef") == 0) {
+      *storage |= STORAGE_TYPEDEF;
+    } else if (strcmp(w, "extern") == 0) {
+      *storage |= STORAGE_EXTERN;
+    } else if (strcmp(w, "static") == 0) {
+      *storage |= STORAGE_STATIC;
+    } else if (strcmp(w, "auto") == 0) {
+      *storage |= STORAGE_AUTO;
+    } else if (strcmp(w, "register") == 0) {
+      *storage |= STORAGE_REGISTER;
+    } else if (strcmp(w, "inline") == 0) {
+      *storage |= STORAGE_INLINE;
+    } else if (strcmp(w, "const") == 0) {
+      bits |= TYPE_CONST;
+    } else if (strcmp(w, "volatile") == 0) {
+      bits |= TYPE_VOLATILE;
+    } else if (strcmp(w, "restrict") == 0) {
+    } else if (strcmp(w, "void") == 0) {
+      base = TYPE_VOID;
+    } else if (strcmp(w, "char") == 0) {
+      base = TYPE_CHAR;
+    } else if (strcmp(w, "int") == 0) {
+      base = TYPE_INT;
+    } else if (strcmp(w, "float") == 0) {
+      base = TYPE_FLOAT;
+    } else if (strcmp(w, "double") == 0) {
+      base = TYPE_DOUBLE;
+    } else if (strcmp(w, "FILE") == 0) {
+      base = TYPE_FILE;
+    } else if (strcmp(w, "size_t") == 0) {
+      base = TYPE_SIZE_T;
+    } else if (strcmp(w, "short") == 0) {
+      bits |= TYPE_SHORT;
+    } else if (strcmp(w, "long") == 0) {
+      bits |= bits & TYPE_LONG ? TYPE_LONG_LONG : TYPE_LONG;
+    } else if (strcmp(w, "signed") == 0) {
+      bits |= TYPE_SIGNED;
+    } else if (strcmp(w, "unsigned") == 0) {
+      bits |= TYPE_UNSIGNED;
+    } else if (strcmp(w, "struct") == 0 || strcmp(w, "union") == 0 ||
+               strcmp(w, "enum") == 0) {
+      base = w[0] == 's' ? TYPE_STRUCT : w[0] == 'u' ? TYPE_UNION : TYPE_ENUM;
+      advance(p);
+      parseTag(p, base, &name, &members, &bits);
+      seen = 1;
+      continue;
+    } else {
+      break;
+    }
+
+    seen = 1;
+    advance(p);
+  }
+
+  if (!seen)
+    return AST_NULL;
+
+  if (base == TYPE_NONE)
+    base = TYPE_INT;
+
+  AstIndex type = ast_add(p->ast, AST_TYPE, row, col);
+  N(type)->op = bits | base;
+  N(type)->text = name;
+  N(type)->a = members;
+  return type;
+}
+
+static AstIndex parseTypeName(Parser *p) {
+  Token *start = peek(p);
+  AstIndex param = node(p, AST_PARAM, start);
+  int storage = 0;
+
+  AstIndex type = parseSpecifiers(p, &storage);
+  AstIndex decl = parseDeclarator(p, 1);
+
+  N(param)->a = type;
+  N(param)->b = decl;
+  return param;
+}
+
+static AstIndex parseParams(Parser *p) {
+  List list = {0};
+
+  if (accept(p, ")"))
+    return AST_NULL;
+
+  if (is(p, "void") && isText(peekAt(p, 1), ")")) {
+    advance(p);
+    advance(p);
+    return AST_NULL;
+  }
+
+  do {
+    if (is(p, "...")) {
+      AstIndex ellipsis = node(p, AST_ELLIPSIS, peek(p));
+      advance(p);
+      listAppend(p, &list, ellipsis);
+      break;
+    }
+
+    AstIndex param = node(p, AST_PARAM, peek(p));
+    int storage = 0;
+
+    AstIndex type = parseSpecifiers(p, &storage);
+    if (!type && !isType(peek(p), "IDENTIFIER")) {
+      error(p, "parameter");
+      break;
+    }
+
+    AstIndex decl = parseDeclarator(p, 1);
+    N(param)->a = type;
+    N(param)->b = decl;
+    listAppend(p, &list, param);
+  } while (accept(p, ","));
+
+  expect(p, ")");
+  return list.head;
+}
+
+static int startsNestedDeclarator(Parser *p, int abstract) {
+  Token *next = peekAt(p, 1);
+
+  if (isText(next, "*") || isText(next, "("))
+    return 1;
+
+  return !abstract && isType(next, "IDENTIFIER") &&
+         !isTypedef(p, next->token_name);
+}
+
+/*
+ * Returns an AST_VARIABLE, or an AST_FUNCTION when the name itself is
+ * followed by a parameter list. Pointer declarators bump `flags`; the name is
+ * empty for abstract declarators. A parenthesized declarator followed by a
+ * parameter list, as in `int *(*fp)(void)`, is a function pointer: `op` is
+ * then one more than the pointers that belong to the return type.
+ */
+static AstIndex parseDeclarator(Parser *p, int abstract) {
+  Token *start = peek(p);
+  int row = start->row, col = start->col;
+  int pointers = 0, nested = 0, returned;
+  AstIndex d;
+
+  while (accept(p, "*")) {
+    pointers++;
+    while (accept(p, "const") || accept(p, "volatile") ||
+           accept(p, "restrict"))
+      ;
+  }
+
+  if (isType(peek(p), "IDENTIFIER")) {
+    d = take(p, AST_VARIABLE);
+  } else if (is(p, "(") && startsNestedDeclarator(p, abstract)) {
+    advance(p);
+    d = parseDeclarator(p, abstract);
+    expect(p, ")");
+    nested = 1;
+  } else {
+    if (!abstract)
+      error(p, "identifier");
+    d = ast_add(p->ast, AST_VARIABLE, row, col);
+  }
+
+  returned = pointers;
+  pointers += N(d)->flags;
+  N(d)->flags = pointers > 255 ? 255 : pointers;
+
+  List dims = {0};
+
+  for (;;) {
+    if (is(p, "[")) {
+      AstIndex dim = node(p, AST_ARRAY, peek(p));
+      advance(p);
+
+      if (!is(p, "]")) {
+        AstIndex size = parseAssignment(p);
+        N(dim)->a = size;
+      }
+
+      expect(p, "]");
+      listAppend(p, &dims, dim);
+    } else if (is(p, "(")) {
+      advance(p);
+      AstIndex params = parseParams(p);
+
+      /* `(f)(void)` still declares f itself as a function */
+      int plain = !nested || (pointers == returned && N(d)->b == AST_NULL);
+
+      if (plain && N(d)->kind == AST_VARIABLE && dims.head == AST_NULL) {
+        N(d)->kind = AST_FUNCTION;
+        N(d)->a = params;
+      } else if (nested && N(d)->kind == AST_VARIABLE && !N(d)->op) {
+        N(d)->op = returned + 1;
+        N(d)->c = params;
+      } else if (!N(d)->op) {
+        N(d)->c = params;
+      }
+    } else {
+      break;
+    }
+  }
+
+  if (dims.head != AST_NULL)
+    N(d)->b = dims.head;
+
+  return d;
+}
+
+static AstIndex parseInitializer(Parser *p) {
+  if (!is(p, "{"))
+    return parseAssignment(p);
+
+  AstIndex list = node(p, AST_INIT_LIST, peek(p));
+  List items = {0};
+  advance(p);
+
+  while (!is(p, "}") && !atEnd(p)) {
+    AstIndex item;
+
+    if (is(p, ".") || is(p, "[")) {
+      AstIndex desig = node(p, AST_DESIGNATION, peek(p));
+      AstIndex target;
+
+      if (accept(p, ".")) {
+        if (!isType(peek(p), "IDENTIFIER")) {
+          error(p, "field name");
+          break;
+        }
+        target = take(p, AST_MEMBER);
+      } else {
+        target = node(p, AST_INDEX, peek(p));
+        advance(p);
+        AstIndex index = parseConditional(p);
+        N(target)->b = index;
+        expect(p, "]");
+      }
+
+      expect(p, "=");
+      AstIndex value = parseInitializer(p);
+      N(desig)->a = target;
+      N(desig)->b = value;
+      item = desig;
+    } else {
+      item = parseInitializer(p);
+    }
+
+    listAppend(p, &items, item);
+
+    if (p->panic || !accept(p, ","))
+      break;
+  }
+
+  expect(p, "}");
+  N(list)->a = items.head;
+  return list;
+}
+
+static AstIndex parsePrimary(Parser *p) {
+  Token *tok = peek(p);
+
+  if (isType(tok, "IDENTIFIER"))
+    return take(p, AST_IDENT);
+  if (isType(tok, "NUM"))
+    return take(p, AST_NUMBER);
+  if (isType(tok, "CHAR"))
+    return take(p, AST_CHAR);
+
+  if (isType(tok, "STRING") || isType(tok, "BAD_STRING")) {
+    AstIndex s = node(p, AST_STRING, tok);
+    char text[1024];
+    size_t len = 0;
+
+    while (isType(peek(p), "STRING") || isType(peek(p), "BAD_STRING")) {
+      len += snprintf(text + len, sizeof(text) - len, "%s%s", len ? " " : "",
+                      peek(p)->token_name);
+      if (len >= sizeof(text))
+        len = sizeof(text) - 1;
+      advance(p);
+    }
+
+    uint32_t offset = ast_addText(p->ast, text, len);
+    N(s)->text = offset;
+    return s;
+  }
+
+  if (accept(p, "(")) {
+    AstIndex e = parseExpression(p);
+    expect(p, ")");
+    return e;
+  }
+
+  error(p, "expression");
+  return AST_NULL;
+}
+
+static AstIndex parsePostfix(Parser *p) {
+  AstIndex e = parsePrimary(p);
+
+  for (;;) {
+    Token *tok = peek(p);
+    AstIndex n;
+
+    if (isText(tok, "[")) {
+      n = node(p, AST_INDEX, tok);
+      advance(p);
+      AstIndex index = parseExpression(p);
+      expect(p, "]");
+      N(n)->a = e;
+      N(n)->b = index;
+    } else if (isText(tok, "(")) {
+      n = node(p, AST_CALL, tok);
+      List args = {0};
+      advance(p);
+
+      if (!accept(p, ")")) {
+        do {
+          AstIndex arg = parseAssignment(p);
+          listAppend(p, &args, arg);
+        } while (!p->panic && accept(p, ","));
+        expect(p, ")");
+      }
+
+      N(n)->a = e;
+      N(n)->b = args.head;
+    } else if (isText(tok, ".") || isText(tok, "->")) {
+      int arrow = isText(tok, "->");
+      advance(p);
+
+      if (!isType(peek(p), "IDENTIFIER")) {
+        error(p, "field name");
+        return e;
+      }
+
+      n = take(p, AST_MEMBER);
+      N(n)->flags = arrow;
+      N(n)->a = e;
+    } else if (isText(tok, "++") || isText(tok, "--")) {
+      n = node(p, AST_POSTFIX, tok);
+      N(n)->op = tok->token_name[0] == '+' ? OP_INC : OP_DEC;
+      N(n)->a = e;
+      advance(p);
+    } else {
+      return e;
+    }
+
+    e = n;
+  }
+}
+
+static AstIndex parseUnary(Parser *p) {
+  static const struct {
+    const char *text;
+    AstOp op;
+  } ops[] = {{"++", OP_INC},  {"--", OP_DEC}, {"-", OP_NEG},
+             {"+", OP_PLUS},  {"!", OP_NOT},  {"~", OP_BIT_NOT},
+             {"*", OP_DEREF}, {"&", OP_ADDR}};
+
+  Token *tok = peek(p);
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (!isText(tok, ops[i].text))
+      continue;
+
+    AstIndex n = node(p, AST_UNARY, tok);
+    advance(p);
+
+    AstIndex operand = i < 2 ? parseUnary(p) : parseCast(p);
+    N(n)->op = ops[i].op;
+    N(n)->a = operand;
+    return n;
+  }
+
+  if (isText(tok, "sizeof")) {
+    AstIndex n = node(p, AST_SIZEOF, tok);
+    AstIndex operand;
+    advance(p);
+
+    if (is(p, "(") && isTypeStart(p, peekAt(p, 1))) {
+      advance(p);
+      operand = parseTypeName(p);
+      expect(p, ")");
+    } else {
+      operand = parseUnary(p);
+    }
+
+    N(n)->a = operand;
+    return n;
+  }
+
+  return parsePostfix(p);
+}
+
+static AstIndex parseCast(Parser *p) {
+  if (!is(p, "(") || !isTypeStart(p, peekAt(p, 1)))
+    return parseUnary(p);
+
+  AstIndex n = node(p, AST_CAST, peek(p));
+  advance(p);
+
+  AstIndex type = parseTypeName(p);
+  expect(p, ")");
+
+  AstIndex value = is(p, "{") ? parseInitializer(p) : parseCast(p);
+  N(n)->a = type;
+  N(n)->b = value;
+  return n;
+}
+
+static int binaryOp(const Token *tok, AstOp *op) {
+  static const struct {
+    const char *text;
+    AstOp op;
+    int prec;
+  } ops[] = {{"||", OP_OR, 1},      {"&&", OP_AND, 2},    {"|", OP_BIT_OR, 3},
+             {"^", OP_BIT_XOR, 4},  {"&", OP_BIT_AND, 5}, {"==", OP_EQ, 6},
+             {"!=", OP_NE, 6},      {"<", OP_LT, 7},      {">", OP_GT, 7},
+             {"<=", OP_LE, 7},      {">=", OP_GE, 7},     {"<<", OP_SHL, 8},
+             {">>", OP_SHR, 8},     {"+", OP_ADD, 9},     {"-", OP_SUB, 9},
+             {"*", OP_MUL, 10},     {"/", OP_DIV, 10},    {"%", OP_MOD, 10}};
+
+  if (isType(tok, "STRING") || isType(tok, "CHAR"))
+    return 0;
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (isText(tok, ops[i].text)) {
+      *op = ops[i].op;
+      return ops[i].prec;
+    }
+  }
+
+  return 0;
+}
+
+static AstIndex parseBinary(Parser *p, int min_prec) {
+  AstIndex lhs = parseCast(p);
+
+  for (;;) {
+    Token *tok = peek(p);
+    AstOp op;
+    int prec = binaryOp(tok, &op);
+
+    if (!prec || prec < min_prec || p->panic)
+      return lhs;
+
+    AstIndex n = node(p, AST_BINARY, tok);
+    advance(p);
+
+    AstIndex rhs = parseBinary(p, prec + 1);
+    N(n)->op = op;
+    N(n)->a = lhs;
+    N(n)->b = rhs;
+    lhs = n;
+  }
+}
+
+static AstIndex parseConditional(Parser *p) {
+  AstIndex cond = parseBinary(p, 1);
+
+  if (!is(p, "?"))
+    return cond;
+
+  AstIndex n = node(p, AST_TERNARY, peek(p));
+  advance(p);
+
+  AstIndex then = parseExpression(p);
+  expect(p, ":");
+  AstIndex otherwise = parseConditional(p);
+
+  N(n)->a = cond;
+  N(n)->b = then;
+  N(n)->c = otherwise;
+  return n;
+}
+
+static int assignOp(const Token *tok, AstOp *op) {
+  static const struct {
+    const char *text;
+    AstOp op;
+  } ops[] = {{"=", OP_NONE},     {"+=", OP_ADD},     {"-=", OP_SUB},
+             {"*=", OP_MUL},     {"/=", OP_DIV},     {"%=", OP_MOD},
+             {"&=", OP_BIT_AND}, {"|=", OP_BIT_OR},  {"^=", OP_BIT_XOR},
+             {"<<=", OP_SHL},    {">>=", OP_SHR}};
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (isText(tok, ops[i].text)) {
+      *op = ops[i].op;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static AstIndex parseAssignment(Parser *p) {
+  AstIndex lhs = parseConditional(p);
+  Token *tok = peek(p);
+  AstOp op;
+
+  if (p->panic || !assignOp(tok, &op))
+    return lhs;
+
+  AstIndex n = node(p, AST_ASSIGN, tok);
+  advance(p);
+
+  AstIndex rhs = parseAssignment(p);
+  N(n)->op = op;
+  N(n)->a = lhs;
+  N(n)->b = rhs;
+  return n;
+}
+
+static AstIndex parseExpression(Parser *p) {
+  AstIndex lhs = parseAssignment(p);
+
+  while (!p->panic && is(p, ",")) {
+    AstIndex n = node(p, AST_BINARY, peek(p));
+    advance(p);
+
+    AstIndex rhs = parseAssignment(p);
+    N(n)->op = OP_COMMA;
+    N(n)->a = lhs;
+    N(n)->b = rhs;
+    lhs = n;
+  }
+
+  return lhs;
+}
+
+static AstIndex parseExpressionStatement(Parser *p) {
+  AstIndex n = node(p, AST_EXPR_STMT, peek(p));
+  AstIndex e = parseExpression(p);
+
+  N(n)->a = e;
+  expect(p, ";");
+  return n;
+}
+
+static AstIndex parseParenthesized(Parser *p) {
+  expect(p, "(");
+  AstIndex e = parseExpression(p);
+  expect(p, ")");
+  return e;
+}
+
+static AstIndex parseFor(Parser *p, AstIndex n) {
+  AstIndex head = node(p, AST_FOR_HEAD, peek(p));
+  AstIndex init = AST_NULL, cond = AST_NULL, step = AST_NULL;
+
+  expect(p, "(");
+
+  if (isDeclarationStart(p))
+    init = parseDeclaration(p, 0);
+  else if (!accept(p, ";"))
+    init = parseExpressionStatement(p);
+
+  if (!is(p, ";"))
+    cond = parseExpression(p);
+  expect(p, ";");
+
+  if (!is(p, ")"))
+    step = parseExpression(p);
+  expect(p, ")");
+
+  AstIndex body = parseStatement(p);
+
+  N(head)->a = init;
+  N(head)->b = cond;
+  N(head)->c = step;
+  N(n)->a = head;
+  N(n)->b = body;
+  return n;
+}
+
+static AstIndex parseStatement(Parser *p) {
+  Token *tok = peek(p);
+
+  if (isText(tok, "{"))
+    return parseCompound(p);
+
+  if (isType(tok, "IDENTIFIER") && isText(peekAt(p, 1), ":")) {
+    AstIndex n = take(p, AST_LABEL);
+    advance(p);
+    AstIndex stmt = parseStatement(p);
+    N(n)->a = stmt;
+    return n;
+  }
+
+  if (!isText(tok, ";") &&
+      !(isType(tok, "KEYWORD") && inList(tok->token_name, statement_words)))
+    return parseExpressionStatement(p);
+
+  AstIndex n = node(p, AST_EMPTY, tok);
+  char word[sizeof(tok->token_name)];
+  snprintf(word, sizeof(word), "%s", tok->token_name);
+  advance(p);
+
+  if (strcmp(word, ";") == 0)
+    return n;
+
+  if (strcmp(word, "if") == 0) {
+    AstIndex cond = parseParenthesized(p);
+    AstIndex then = parseStatement(p);
+    AstIndex otherwise = accept(p, "else") ? parseStatement(p) : AST_NULL;
+
+    N(n)->kind = AST_IF;
+    N(n)->a = cond;
+    N(n)->b = then;
+    N(n)->c = otherwise;
+  } else if (strcmp(word, "while") == 0) {
+    AstIndex cond = parseParenthesized(p);
+    AstIndex body = parseStatement(p);
+
+    N(n)->kind = AST_WHILE;
+    N(n)->a = cond;
+    N(n)->b = body;
+  } else if (strcmp(word, "do") == 0) {
+    AstIndex body = parseStatement(p);
+    expect(p, "while");
+    AstIndex cond = parseParenthesized(p);
+    expect(p, ";");
+
+    N(n)->kind = AST_DO;
+    N(n)->a = body;
+    N(n)->b = cond;
+  } else if (strcmp(word, "for") == 0) {
+    N(n)->kind = AST_FOR;
+    parseFor(p, n);
+  } else if (strcmp(word, "switch") == 0) {
+    AstIndex value = parseParenthesized(p);
+    AstIndex body = parseStatement(p);
+
+    N(n)->kind = AST_SWITCH;
+    N(n)->a = value;
+    N(n)->b = body;
+  } else if (strcmp(word, "case") == 0) {
+    AstIndex value = parseConditional(p);
+    expect(p, ":");
+    AstIndex stmt = parseStatement(p);
+
+    N(n)->kind = AST_CASE;
+    N(n)->a = value;
+    N(n)->b = stmt;
+  } else if (strcmp(word, "default") == 0) {
+    expect(p, ":");
+    AstIndex stmt = parseStatement(p);
+
+    N(n)->kind = AST_DEFAULT;
+    N(n)->a = stmt;
+  } else if (strcmp(word, "break") == 0 || strcmp(word, "continue") == 0) {
+    N(n)->kind = word[0] == 'b' ? AST_BREAK : AST_CONTINUE;
+    expect(p, ";");
+  } else if (strcmp(word, "return") == 0) {
+    AstIndex value = is(p, ";") ? AST_NULL : parseExpression(p);
+    expect(p, ";");
+
+    N(n)->kind = AST_RETURN;
+    N(n)->a = value;
+  } else if (strcmp(word, "goto") == 0) {
+    N(n)->kind = AST_GOTO;
+
+    if (isType(peek(p), "IDENTIFIER")) {
+      Token *label = peek(p);
+      uint32_t text =
+          ast_addText(p->ast, label->token_name, strlen(label->token_name));
+      N(n)->text = text;
+      advance(p);
+    } else {
+      error(p, "label");
+    }
+
+    expect(p, ";");
+  }
+
+  return n;
+}
+
+static AstIndex parseCompound(Parser *p) {
+  AstIndex n = node(p, AST_COMPOUND, peek(p));
+  List items = {0};
+
+  expect(p, "{");
+
+  while (!is(p, "}") && !atEnd(p)) {
+    AstIndex item =
+        isDeclarationStart(p) ? parseDeclaration(p, 0) : parseStatement(p);
+    listAppend(p, &items, item);
+
+    if (p->panic)
+      synchronize(p);
+  }
+
+  expect(p, "}");
+  N(n)->a = items.head;
+  return n;
+}
+
+static AstIndex parseDeclaration(Parser *p, int external) {
+  Token *start = peek(p);
+  AstIndex decl = node(p, AST_DECLARATION, start);
+  int row = start->row, col = start->col;
+  int storage = 0;
+
+  AstIndex type = parseSpecifiers(p, &storage);
+  if (!type) {
+    /* K&R style `main() { ... }` */
+    type = ast_add(p->ast, AST_TYPE, row, col);
+    N(type)->op = TYPE_INT;
+  }
+
+  N(decl)->flags = storage;
+  N(decl)->a = type;
+
+  if (accept(p, ";"))
+    return decl;
+
+  List list = {0};
+
+  for (;;) {
+    AstIndex d = parseDeclarator(p, 0);
+    listAppend(p, &list, d);
+
+    if (storage & STORAGE_TYPEDEF)
+      addTypedef(p, N(d)->text);
+
+    if (N(d)->kind == AST_FUNCTION && list.head == d && is(p, "{")) {
+      AstIndex body = parseCompound(p);
+      N(d)->b = body;
+      N(decl)->b = list.head;
+      return decl;
+    }
+
+    if (is(p, ":") && !external) {
+      /* bit-field width */
+      advance(p);
+      AstIndex width = parseConditional(p);
+      N(d)->c = width;
+    }
+
+    if (accept(p, "=")) {
+      AstIndex init = parseInitializer(p);
+      N(d)->a = init;
+    }
+
+    if (p->panic || !accept(p, ","))
+      break;
+  }
+
+  N(decl)->b = list.head;
+  expect(p, ";");
+  return decl;
+}
+
+Ast *parseTranslationUnit(TokenSource next, void *ctx, int *errors) {
+  Parser p = {.source = next, .ctx = ctx};
+
+  p.ast = ast_create();
+  p.ast->root = node(&p, AST_TRANSLATION_UNIT, peek(&p));
+
+  List decls = {0};
+
+  while (!atEnd(&p)) {
+    if (accept(&p, ";"))
+      continue;
+
+    AstIndex decl = parseDeclaration(&p, 1);
+    listAppend(&p, &decls, decl);
+
+    if (p.panic) {
+      synchronize(&p);
+      accept(&p, "}");
+    }
+  }
+
+  ast_node(p.ast, p.ast->root)->a = decls.head;
+
+  while (p.count) {
+    token_destroy(p.ahead[p.head]);
+    p.head = (p.head + 1) % LOOKAHEAD;
+    p.count--;
+  }
+
+  token_destroy(p.raw);
+  alloc_free(p.typedefs);
+
+  if (errors)
+    *errors = p.errors;
+  return p.ast;
+}
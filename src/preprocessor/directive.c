@@ -0,0 +1,438 @@
+#include "preprocessor/directive.h"
+#include "alloc.h"
+#include "compiler/stats.h"
+#include "preprocessor/include.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Eval {
+  const PPToken *tokens;
+  int pos, count;
+  int error, unevaluated;
+} Eval;
+
+static long long evalExpr(Eval *ev);
+
+static int isWord(const PPToken *tok, const char *s) {
+  return tok->len == (int)strlen(s) && memcmp(tok->text, s, tok->len) == 0;
+}
+
+static int isOp(const PPToken *tok, const char *s) {
+  return tok->kind == PPT_PUNCT && isWord(tok, s);
+}
+
+static const PPToken *peek(Eval *ev) {
+  static const PPToken none = {"", 0, PPT_NEWLINE, 0, 0, -1, NULL};
+  return ev->pos < ev->count ? &ev->tokens[ev->pos] : &none;
+}
+
+static long long parseNumber(const PPToken *tok, int *error) {
+  char buf[64];
+  int len = tok->len < 63 ? tok->len : 63;
+
+  memcpy(buf, tok->text, len);
+  while (len > 0 && strchr("uUlL", buf[len - 1]))
+    len--;
+  buf[len] = '\0';
+
+  char *end;
+  long long value = (long long)strtoull(buf, &end, 0);
+  if (*end)
+    *error = 1;
+  return value;
+}
+
+static long long parseChar(const PPToken *tok) {
+  const char *p = tok->text + 1;
+
+  if (*p != '\\')
+    return (unsigned char)*p;
+
+  switch (*++p) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case '0':
+    return strtol(p, NULL, 8);
+  case 'x':
+    return strtol(p + 1, NULL, 16);
+  default:
+    return (unsigned char)*p;
+  }
+}
+
+static long long evalUnary(Eval *ev) {
+  const PPToken *tok = peek(ev);
+  ev->pos++;
+
+  if (tok->kind == PPT_NUMBER)
+    return parseNumber(tok, &ev->error);
+  if (tok->kind == PPT_CHAR)
+    return parseChar(tok);
+  if (tok->kind == PPT_IDENT)
+    return 0;
+
+  if (isOp(tok, "(")) {
+    long long value = evalExpr(ev);
+    if (!isOp(peek(ev), ")"))
+      ev->error = 1;
+    ev->pos++;
+    return value;
+  }
+
+  if (isOp(tok, "!"))
+    return !evalUnary(ev);
+  if (isOp(tok, "~"))
+    return ~evalUnary(ev);
+  if (isOp(tok, "-"))
+    return -evalUnary(ev);
+  if (isOp(tok, "+"))
+    return evalUnary(ev);
+
+  ev->error = 1;
+  return 0;
+}
+
+static int precedence(const PPToken *tok) {
+  static const char *ops[][4] = {
+      {"||"},          {"&&"},      {"|"},       {"^"},       {"&"},
+      {"==", "!="},    {"<", ">", "<=", ">="}, {"<<", ">>"}, {"+", "-"},
+      {"*", "/", "%"}};
+
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < 4 && ops[i][j]; j++) {
+      if (isOp(tok, ops[i][j]))
+        return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+static long long apply(Eval *ev, const PPToken *op, long long a, long long b) {
+  const char c = op->text[0], d = op->len > 1 ? op->text[1] : 0;
+
+  if ((c == '/' || c == '%') && b == 0) {
+    if (!ev->unevaluated) {
+      fprintf(stderr, "division by zero in #if\n");
+      ev->error = 1;
+    }
+    return 0;
+  }
+
+  switch (c) {
+  case '|':
+    return d ? a || b : a | b;
+  case '&':
+    return d ? a && b : a & b;
+  case '^':
+    return a ^ b;
+  case '=':
+    return a == b;
+  case '!':
+    return a != b;
+  case '<':
+    return d == '<' ? a << b : d ? a <= b : a < b;
+  case '>':
+    return d == '>' ? a >> b : d ? a >= b : a > b;
+  case '+':
+    return a + b;
+  case '-':
+    return a - b;
+  case '*':
+    return a * b;
+  case '/':
+    return a / b;
+  default:
+    return a % b;
+  }
+}
+
+static long long evalBinary(Eval *ev, int min_prec) {
+  long long lhs = evalUnary(ev);
+
+  for (;;) {
+    const PPToken *op = peek(ev);
+    int prec = precedence(op);
+
+    if (!prec || prec < min_prec)
+      return lhs;
+
+    ev->pos++;
+
+    int shortcut = (isOp(op, "&&") && !lhs) || (isOp(op, "||") && lhs);
+    ev->unevaluated += shortcut;
+    long long rhs = evalBinary(ev, prec + 1);
+    ev->unevaluated -= shortcut;
+
+    lhs = apply(ev, op, lhs, rhs);
+  }
+}
+
+static long long evalExpr(Eval *ev) {
+  long long cond = evalBinary(ev, 1);
+
+  if (!isOp(peek(ev), "?"))
+    return cond;
+
+  ev->pos++;
+  ev->unevaluated += !cond;
+  long long a = evalExpr(ev);
+  ev->unevaluated -= !cond;
+
+  if (!isOp(peek(ev), ":"))
+    ev->error = 1;
+  ev->pos++;
+
+  ev->unevaluated += !!cond;
+  long long b = evalExpr(ev);
+  ev->unevaluated -= !!cond;
+
+  return cond ? a : b;
+}
+
+static void tokenize(const char *text, size_t len, PPTokenList *out) {
+  const char *p = text, *end = text + len;
+  int space = 0;
+  PPToken tok;
+
+  while (p < end) {
+    p += scanPPToken(p, end, 1, &tok);
+
+    if (tok.kind == PPT_SPACE || tok.kind == PPT_NEWLINE) {
+      space = 1;
+      continue;
+    }
+
+    tok.space = space;
+    space = 0;
+    pushPPToken(out, tok);
+  }
+}
+
+static int evalCondition(PPUnit *u, const char *text, size_t len) {
+  PPTokenList raw = {0}, resolved = {0}, expanded = {0};
+
+  tokenize(text, len, &raw);
+
+  for (int i = 0; i < raw.count; i++) {
+    PPToken tok = raw.items[i];
+
+    if (tok.kind == PPT_IDENT && isWord(&tok, "defined")) {
+      int paren = i + 1 < raw.count && isOp(&raw.items[i + 1], "(");
+      int name = i + 1 + paren;
+
+      if (name < raw.count && raw.items[name].kind == PPT_IDENT) {
+        const PPToken *id = &raw.items[name];
+        int defined = findMacro(&u->expander, id->text, id->len) != NULL;
+
+        tok.kind = PPT_NUMBER;
+        tok.text = defined ? "1" : "0";
+        tok.len = 1;
+        i = name + (paren && name + 1 < raw.count &&
+                    isOp(&raw.items[name + 1], ")"));
+      }
+    }
+
+    pushPPToken(&resolved, tok);
+  }
+
+  expandPPTokens(&u->expander, resolved.items, resolved.count, &expanded);
+
+  Eval ev = {expanded.items, 0, expanded.count, expanded.count == 0, 0};
+  long long value = evalExpr(&ev);
+
+  if (ev.error || ev.pos != ev.count) {
+    fprintf(stderr, "invalid #if expression:%.*s\n", (int)len, text);
+    value = 0;
+  }
+
+  freePPTokens(&raw);
+  freePPTokens(&resolved);
+  freePPTokens(&expanded);
+  return value != 0;
+}
+
+void initPPUnit(PPUnit *u, PPConsumer consume, void *ctx) {
+  memset(u, 0, sizeof(*u));
+  initExpander(&u->expander, consume, ctx);
+}
+
+void feedPPUnit(PPUnit *u, const char *text, size_t len) {
+  static char newlines[256];
+
+  if (!u->skipping) {
+    feedExpander(&u->expander, text, len);
+    return;
+  }
+
+  const char *p = text, *end = text + len;
+  int count = 0;
+
+  if (!newlines[0])
+    memset(newlines, '\n', sizeof(newlines));
+
+  while ((p = memchr(p, '\n', end - p))) {
+    p++;
+    if (++count == (int)sizeof(newlines)) {
+      u->expander.consume(newlines, count, u->expander.ctx);
+      count = 0;
+    }
+  }
+
+  if (count)
+    u->expander.consume(newlines, count, u->expander.ctx);
+  STAT_ADD(bytes_skipped, len);
+}
+
+static PPCondition *pushCondition(PPUnit *u) {
+  if (u->condition_count == u->condition_capacity) {
+    u->condition_capacity = u->condition_capacity ? u->condition_capacity * 2
+                                                  : 8;
+    u->conditions =
+        alloc_realloc(ALLOC_PREPROCESSOR, u->conditions,
+                      sizeof(PPCondition) * u->condition_capacity);
+  }
+
+  PPCondition *c = &u->conditions[u->condition_count++];
+  c->parent_active = !u->skipping;
+  return c;
+}
+
+static void updateSkipping(PPUnit *u) {
+  u->skipping = u->condition_count &&
+                !u->conditions[u->condition_count - 1].active;
+}
+
+static int handleConditional(PPUnit *u, const char *word, size_t word_len,
+                             const char *rest, size_t rest_len,
+                             const char *from) {
+  PPToken name;
+  int has_name = 0;
+
+  const char *p = rest, *end = rest + rest_len;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  if (p < end && scanPPToken(p, end, 1, &name) > 0 && name.kind == PPT_IDENT)
+    has_name = 1;
+
+#define IS(s) (word_len == strlen(s) && memcmp(word, s, word_len) == 0)
+
+  if (IS("if") || IS("ifdef") || IS("ifndef")) {
+    PPCondition *c = pushCondition(u);
+    int value = 0;
+
+    if (c->parent_active && IS("if"))
+      value = evalCondition(u, rest, rest_len);
+    else if (c->parent_active)
+      value = has_name && (findMacro(&u->expander, name.text, name.len) !=
+                           NULL) == IS("ifdef");
+
+    c->active = c->parent_active && value;
+    c->taken = !c->parent_active || value;
+  } else if (IS("elif") || IS("else") || IS("endif")) {
+    if (!u->condition_count) {
+      fprintf(stderr, "%s: #%.*s without #if\n", from ? from : "<input>",
+              (int)word_len, word);
+      return 1;
+    }
+
+    PPCondition *c = &u->conditions[u->condition_count - 1];
+
+    if (IS("endif")) {
+      u->condition_count--;
+    } else if (IS("else")) {
+      c->active = c->parent_active && !c->taken;
+      c->taken = 1;
+    } else if (c->parent_active && !c->taken) {
+      c->active = c->taken = evalCondition(u, rest, rest_len);
+    } else {
+      c->active = 0;
+    }
+  } else {
+    return 0;
+  }
+
+#undef IS
+
+  updateSkipping(u);
+  return 1;
+}
+
+static void handleInclude(PPUnit *u, const char *rest, size_t len,
+                          const char *from, Header **target) {
+  const char *p = rest, *end = rest + len;
+
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+
+  if (p == end || (*p != '"' && *p != '<'))
+    return;
+
+  char close = *p == '"' ? '"' : '>';
+  const char *name = p + 1;
+  const char *name_end = memchr(name, close, end - name);
+
+  if (!name_end || name_end == name)
+    return;
+
+  includeFile(u, name, name_end - name, close == '>', from, target);
+}
+
+void handleDirective(PPUnit *u, const char *directive, size_t len,
+                     const char *from, Header **target) {
+  const char *p = directive, *end = directive + len;
+
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+
+  const char *word = p;
+  while (p < end && isalpha((unsigned char)*p))
+    p++;
+
+  size_t word_len = p - word;
+
+  if (!u->skipping)
+    flushExpander(&u->expander);
+
+  if (handleConditional(u, word, word_len, p, end - p, from) || u->skipping)
+    return;
+
+#define IS(s) (word_len == strlen(s) && memcmp(word, s, word_len) == 0)
+
+  if (IS("define")) {
+    defineMacro(&u->expander, p, end - p);
+  } else if (IS("undef")) {
+    PPToken name;
+
+    while (p < end && isspace((unsigned char)*p))
+      p++;
+    if (p < end && scanPPToken(p, end, 1, &name) > 0 &&
+        name.kind == PPT_IDENT)
+      undefineMacro(&u->expander, name.text, name.len);
+  } else if (IS("include")) {
+    handleInclude(u, p, end - p, from, target);
+  } else if (IS("error")) {
+    fprintf(stderr, "%s: #error%.*s\n", from ? from : "<input>",
+            (int)(end - p), p);
+  }
+
+#undef IS
+}
+
+void finishPPUnit(PPUnit *u) {
+  flushExpander(&u->expander);
+
+  if (u->condition_count)
+    fprintf(stderr, "unterminated conditional directive\n");
+
+  destroyExpander(&u->expander);
+  alloc_free(u->conditions);
+  memset(u, 0, sizeof(*u));
+}
@@ -0,0 +1,415 @@
+#include "preprocessor/include.h"
+#include "alloc.h"
+#include "compiler/stats.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct HeaderDirective {
+  size_t offset;
+  char *text;
+  size_t len;
+  Header *target;
+} HeaderDirective;
+
+struct Header {
+  char *path;
+  struct timespec mtime;
+  off_t size;
+
+  char *text;
+  size_t len, capacity;
+
+  HeaderDirective *directives;
+  int directive_count, directive_capacity;
+
+  char *guard;
+  int once, included;
+};
+
+enum {
+  GUARD_NONE,
+  GUARD_EXPECT_IFNDEF,
+  GUARD_EXPECT_DEFINE,
+  GUARD_INSIDE,
+  GUARD_CLOSED
+};
+
+typedef struct HeaderReader {
+  Header *header;
+  int guard_state, depth;
+  size_t guard_start, guard_end;
+} HeaderReader;
+
+static char **include_paths;
+static int include_path_count, include_path_capacity;
+
+static Header **headers;
+static int header_count, header_capacity;
+
+static void *reserve(void *items, int count, int *capacity, size_t size) {
+  if (count < *capacity)
+    return items;
+
+  *capacity = *capacity ? *capacity * 2 : 8;
+  return alloc_realloc(ALLOC_PREPROCESSOR, items, size * *capacity);
+}
+
+static char *copyString(const char *s, size_t len) {
+  char *copy = alloc_malloc(ALLOC_PREPROCESSOR, len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+static const char *nextWord(const char *s, size_t len, size_t *pos,
+                            size_t *word_len) {
+  while (*pos < len && isspace((unsigned char)s[*pos]))
+    (*pos)++;
+
+  size_t start = *pos;
+  while (*pos < len && (isalnum((unsigned char)s[*pos]) || s[*pos] == '_'))
+    (*pos)++;
+
+  *word_len = *pos - start;
+  return s + start;
+}
+
+static int isWord(const char *word, size_t len, const char *expected) {
+  return len == strlen(expected) && strncmp(word, expected, len) == 0;
+}
+
+/* Resolved targets depend on the search path, so they are redone on change */
+static void forgetTargets(void) {
+  for (int i = 0; i < header_count; i++) {
+    for (int j = 0; j < headers[i]->directive_count; j++)
+      headers[i]->directives[j].target = NULL;
+  }
+}
+
+void addIncludePath(const char *dir) {
+  include_paths = reserve(include_paths, include_path_count,
+                          &include_path_capacity, sizeof(char *));
+  include_paths[include_path_count++] = copyString(dir, strlen(dir));
+  forgetTargets();
+}
+
+void clearIncludePaths(void) {
+  for (int i = 0; i < include_path_count; i++)
+    alloc_free(include_paths[i]);
+
+  alloc_free(include_paths);
+  include_paths = NULL;
+  include_path_count = include_path_capacity = 0;
+  forgetTargets();
+}
+
+static char *canonicalPath(const char *path) {
+  char buf[PATH_MAX];
+
+  if (access(path, R_OK) != 0 || !realpath(path, buf))
+    return NULL;
+
+  return copyString(buf, strlen(buf));
+}
+
+static char *resolveInclude(const char *name, int angled, const char *from) {
+  char candidate[PATH_MAX];
+
+  if (name[0] == '/')
+    return canonicalPath(name);
+
+  if (!angled) {
+    const char *slash = from ? strrchr(from, '/') : NULL;
+    int dir_len = slash ? (int)(slash - from) : 0;
+
+    snprintf(candidate, sizeof(candidate), "%.*s%s%s", dir_len,
+             slash ? from : "", slash ? "/" : "", name);
+
+    char *path = canonicalPath(candidate);
+    if (path)
+      return path;
+  }
+
+  for (int i = 0; i < include_path_count; i++) {
+    snprintf(candidate, sizeof(candidate), "%s/%s", include_paths[i], name);
+
+    char *path = canonicalPath(candidate);
+    if (path)
+      return path;
+  }
+
+  return NULL;
+}
+
+static void appendText(const char *block, size_t len, void *ctx) {
+  Header *h = ((HeaderReader *)ctx)->header;
+
+  if (h->len + len > h->capacity) {
+    while (h->len + len > h->capacity)
+      h->capacity = h->capacity ? h->capacity * 2 : PP_BLOCK_SIZE;
+    h->text = alloc_realloc(ALLOC_PREPROCESSOR, h->text, h->capacity);
+  }
+
+  memcpy(h->text + h->len, block, len);
+  h->len += len;
+}
+
+static void scanGuard(HeaderReader *r, const char *word, size_t word_len,
+                      const char *name, size_t name_len) {
+  Header *h = r->header;
+
+  switch (r->guard_state) {
+  case GUARD_EXPECT_IFNDEF:
+    if (isWord(word, word_len, "ifndef") && name_len) {
+      h->guard = copyString(name, name_len);
+      r->guard_start = h->len;
+      r->guard_state = GUARD_EXPECT_DEFINE;
+      return;
+    }
+    break;
+
+  case GUARD_EXPECT_DEFINE:
+    if (isWord(word, word_len, "define") && isWord(name, name_len, h->guard)) {
+      r->guard_state = GUARD_INSIDE;
+      r->depth = 1;
+      return;
+    }
+    break;
+
+  case GUARD_INSIDE:
+    if (isWord(word, word_len, "if") || isWord(word, word_len, "ifdef") ||
+        isWord(word, word_len, "ifndef")) {
+      r->depth++;
+    } else if (isWord(word, word_len, "endif")) {
+      if (--r->depth == 0) {
+        r->guard_end = h->len;
+        r->guard_state = GUARD_CLOSED;
+      }
+    } else if (r->depth == 1 && (isWord(word, word_len, "else") ||
+                                 isWord(word, word_len, "elif"))) {
+      break;
+    }
+    return;
+  }
+
+  r->guard_state = GUARD_NONE;
+}
+
+static void scanDirective(const char *directive, size_t len, void *ctx) {
+  HeaderReader *r = ctx;
+  Header *h = r->header;
+  size_t pos = 0, word_len, name_len;
+
+  const char *word = nextWord(directive, len, &pos, &word_len);
+  const char *name = nextWord(directive, len, &pos, &name_len);
+
+  if (isWord(word, word_len, "pragma") && isWord(name, name_len, "once")) {
+    h->once = 1;
+  } else {
+    h->directives = reserve(h->directives, h->directive_count,
+                            &h->directive_capacity, sizeof(HeaderDirective));
+    h->directives[h->directive_count++] =
+        (HeaderDirective){h->len, copyString(directive, len), len, NULL};
+  }
+
+  scanGuard(r, word, word_len, name, name_len);
+}
+
+static int isBlank(const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (!isspace((unsigned char)s[i]))
+      return 0;
+  }
+
+  return 1;
+}
+
+static Header *findHeader(const char *path) {
+  for (int i = 0; i < header_count; i++) {
+    if (strcmp(headers[i]->path, path) == 0)
+      return headers[i];
+  }
+
+  return NULL;
+}
+
+static Header *loadHeader(char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    alloc_free(path);
+    return NULL;
+  }
+
+  Header *h = alloc_calloc(ALLOC_PREPROCESSOR, 1, sizeof(Header));
+  h->path = path;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    h->mtime = st.st_mtim;
+    h->size = st.st_size;
+  }
+
+  HeaderReader reader = {h, GUARD_EXPECT_IFNDEF, 0, 0, 0};
+  PPStream stream;
+
+  initPPStream(&stream, appendText, &reader);
+  stream.on_directive = scanDirective;
+
+  if (readPPStream(&stream, fd) < 0)
+    perror(path);
+
+  finishPPStream(&stream);
+  close(fd);
+
+  if (h->len < h->capacity) {
+    h->text = alloc_realloc(ALLOC_PREPROCESSOR, h->text, h->len + 1);
+    h->capacity = h->len + 1;
+  }
+
+  if (reader.guard_state != GUARD_CLOSED ||
+      !isBlank(h->text, reader.guard_start) ||
+      !isBlank(h->text + reader.guard_end, h->len - reader.guard_end)) {
+    alloc_free(h->guard);
+    h->guard = NULL;
+  }
+
+  STAT_INC(headers_read);
+
+  headers = reserve(headers, header_count, &header_capacity, sizeof(Header *));
+  headers[header_count++] = h;
+  return h;
+}
+
+static Header *findInclude(const char *name, int angled, const char *from) {
+  char *path = resolveInclude(name, angled, from);
+
+  if (!path) {
+    if (!angled)
+      fprintf(stderr, "%s: cannot find include file '%s'\n",
+              from ? from : "<input>", name);
+    return NULL;
+  }
+
+  Header *h = findHeader(path);
+  if (h) {
+    alloc_free(path);
+    return h;
+  }
+
+  return loadHeader(path);
+}
+
+static void emitHeader(PPUnit *u, Header *h) {
+  if ((h->once && h->included) ||
+      (h->guard && findMacro(&u->expander, h->guard, strlen(h->guard)))) {
+    STAT_INC(includes_skipped);
+    return;
+  }
+
+  if (u->include_depth >= PP_MAX_INCLUDE_DEPTH) {
+    fprintf(stderr, "%s: #include nested depth %d exceeds maximum\n",
+            h->path, u->include_depth);
+    return;
+  }
+
+  h->included = 1;
+  u->include_depth++;
+
+  if (u->on_include)
+    u->on_include(h->path, u->include_ctx);
+
+  size_t pos = 0;
+
+  for (int i = 0; i < h->directive_count; i++) {
+    HeaderDirective *d = &h->directives[i];
+
+    if (d->offset > pos)
+      feedPPUnit(u, h->text + pos, d->offset - pos);
+    pos = d->offset;
+
+    handleDirective(u, d->text, d->len, h->path, &d->target);
+  }
+
+  if (h->len > pos)
+    feedPPUnit(u, h->text + pos, h->len - pos);
+
+  /* Keep the includer's next line from joining the header's last one */
+  if (h->len && h->text[h->len - 1] != '\n')
+    feedPPUnit(u, "\n", 1);
+
+  u->include_depth--;
+
+  if (u->on_include) {
+    flushExpander(&u->expander);
+    u->on_include(NULL, u->include_ctx);
+  }
+}
+
+int includeFile(PPUnit *u, const char *name, size_t len, int angled,
+                const char *from, Header **target) {
+  Header *h = target ? *target : NULL;
+
+  if (!h) {
+    char *file = copyString(name, len);
+    h = findInclude(file, angled, from);
+    alloc_free(file);
+
+    if (!h)
+      return angled ? 0 : -1;
+    if (target)
+      *target = h;
+  }
+
+  emitHeader(u, h);
+  return 1;
+}
+
+void resetIncludedHeaders(void) {
+  for (int i = 0; i < header_count; i++)
+    headers[i]->included = 0;
+}
+
+void clearHeaderCache(void) {
+  for (int i = 0; i < header_count; i++) {
+    Header *h = headers[i];
+
+    for (int j = 0; j < h->directive_count; j++)
+      alloc_free(h->directives[j].text);
+
+    alloc_free(h->directives);
+    alloc_free(h->guard);
+    alloc_free(h->text);
+    alloc_free(h->path);
+    alloc_free(h);
+  }
+
+  alloc_free(headers);
+  headers = NULL;
+  header_count = header_capacity = 0;
+}
+
+int refreshHeaderCache(void) {
+  struct stat st;
+
+  for (int i = 0; i < header_count; i++) {
+    Header *h = headers[i];
+
+    if (stat(h->path, &st) != 0 || st.st_size != h->size ||
+        st.st_mtim.tv_sec != h->mtime.tv_sec ||
+        st.st_mtim.tv_nsec != h->mtime.tv_nsec) {
+      int dropped = header_count;
+      clearHeaderCache();
+      return dropped;
+    }
+  }
+
+  return 0;
+}
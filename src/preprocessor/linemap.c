@@ -0,0 +1,57 @@
+#include "preprocessor/linemap.h"
+#include "alloc.h"
+
+#include <string.h>
+
+/*
+ * A header with no rows leaves two entries on one row. They are kept, so
+ * entries only ever go on the end and a copy can follow by count alone.
+ */
+static void addEntry(LineMap *m, const char *path, uint32_t row,
+                     int32_t delta) {
+  if (m->count == m->capacity) {
+    m->capacity = m->capacity ? m->capacity * 2 : 16;
+    m->entries = alloc_realloc(ALLOC_PREPROCESSOR, m->entries,
+                               sizeof(LineMapEntry) * m->capacity);
+  }
+
+  m->entries[m->count++] = (LineMapEntry){row, delta, path};
+}
+
+void initLineMap(LineMap *m, const char *path) {
+  memset(m, 0, sizeof(*m));
+  addEntry(m, path, 1, 0);
+}
+
+void freeLineMap(LineMap *m) {
+  alloc_free(m->entries);
+  alloc_free(m->frames);
+  memset(m, 0, sizeof(*m));
+}
+
+void appendLineMap(LineMap *m, const LineMapEntry *entries, int count) {
+  for (int i = 0; i < count; i++)
+    addEntry(m, entries[i].path, entries[i].row, entries[i].delta);
+}
+
+void enterLineMap(LineMap *m, const char *path, uint32_t row) {
+  const LineMapEntry *current = &m->entries[m->count - 1];
+
+  if (m->depth == m->frame_capacity) {
+    m->frame_capacity = m->frame_capacity ? m->frame_capacity * 2 : 8;
+    m->frames = alloc_realloc(ALLOC_PREPROCESSOR, m->frames,
+                              sizeof(LineMapFrame) * m->frame_capacity);
+  }
+
+  m->frames[m->depth++] = (LineMapFrame){current->path, row, current->delta};
+  addEntry(m, path, row, row - 1);
+}
+
+void leaveLineMap(LineMap *m, uint32_t row) {
+  if (m->depth == 0)
+    return;
+
+  /* The includer carries on from where it was, past the header's rows */
+  const LineMapFrame *f = &m->frames[--m->depth];
+  addEntry(m, f->path, row, f->delta + (int32_t)(row - f->start));
+}
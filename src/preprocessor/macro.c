@@ -0,0 +1,896 @@
+#include "preprocessor/macro.h"
+#include "alloc.h"
+#include "compiler/stats.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+struct ArenaChunk {
+  ArenaChunk *next;
+  size_t used, size;
+  char data[];
+};
+
+typedef struct Reader {
+  PPTokenList stack;
+
+  const char *src, *end;
+  int final;
+
+  const PPToken *list;
+  int list_pos, list_count;
+
+  int newlines;
+} Reader;
+
+typedef struct ReaderMark {
+  int stack_count;
+  const char *src;
+  int list_pos;
+  int newlines;
+} ReaderMark;
+
+enum { READ_OK, READ_EOF, READ_MORE };
+
+static const char *puncts[] = {"<<=", ">>=", "...", "##", "<<", ">>", "<=",
+                               ">=",  "==",  "!=",  "&&", "||", "->", "++",
+                               "--",  "+=",  "-=",  "*=", "/=", "%=", "&=",
+                               "|=",  "^=",  NULL};
+
+static int isIdentStart(int c) { return isalpha(c) || c == '_' || c == '$'; }
+
+static int isIdentChar(int c) { return isalnum(c) || c == '_' || c == '$'; }
+
+static int isHorizontalSpace(int c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+int scanPPToken(const char *p, const char *end, int final, PPToken *tok) {
+  const char *q = p + 1;
+  unsigned char c = *p;
+
+  tok->text = p;
+  tok->space = 0;
+  tok->noexpand = 0;
+  tok->param = -1;
+  tok->macro = NULL;
+
+  if (c == '\n') {
+    tok->kind = PPT_NEWLINE;
+  } else if (isHorizontalSpace(c)) {
+    while (q < end && isHorizontalSpace(*q))
+      q++;
+    tok->kind = PPT_SPACE;
+  } else if (isIdentStart(c)) {
+    while (q < end && isIdentChar(*q))
+      q++;
+    if (q == end && !final)
+      return -1;
+    tok->kind = PPT_IDENT;
+  } else if (isdigit(c) || (c == '.' && q < end && isdigit(*q))) {
+    while (q < end) {
+      if ((*q == '+' || *q == '-') && strchr("eEpP", q[-1]))
+        q++;
+      else if (isIdentChar(*q) || *q == '.')
+        q++;
+      else
+        break;
+    }
+    if (q == end && !final)
+      return -1;
+    tok->kind = PPT_NUMBER;
+  } else if (c == '"' || c == '\'') {
+    while (q < end && *q != c && *q != '\n') {
+      if (*q == '\\' && q + 1 < end)
+        q++;
+      q++;
+    }
+    if (q == end && !final)
+      return -1;
+    if (q < end && *q == c)
+      q++;
+    tok->kind = c == '"' ? PPT_STRING : PPT_CHAR;
+  } else {
+    if (end - p < 3 && !final)
+      return -1;
+
+    for (int i = 0; puncts[i]; i++) {
+      if (puncts[i][0] != c)
+        continue;
+
+      size_t n = strlen(puncts[i]);
+      if ((size_t)(end - p) >= n && memcmp(p, puncts[i], n) == 0) {
+        q = p + n;
+        break;
+      }
+    }
+    tok->kind = PPT_PUNCT;
+  }
+
+  tok->len = q - p;
+  return tok->len;
+}
+
+void pushPPToken(PPTokenList *list, PPToken tok) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    list->items = alloc_realloc(ALLOC_PREPROCESSOR, list->items,
+                                sizeof(PPToken) * list->capacity);
+  }
+
+  list->items[list->count++] = tok;
+}
+
+void freePPTokens(PPTokenList *list) {
+  alloc_free(list->items);
+  list->items = NULL;
+  list->count = list->capacity = 0;
+}
+
+static int isPunct(const PPToken *tok, const char *s) {
+  return tok->kind == PPT_PUNCT && tok->len == (int)strlen(s) &&
+         memcmp(tok->text, s, tok->len) == 0;
+}
+
+const char *copyToArena(MacroExpander *e, const char *text, size_t len) {
+  ArenaChunk *chunk = e->arena;
+
+  if (!chunk || chunk->used + len > chunk->size) {
+    size_t size = len > 4096 ? len : 4096;
+
+    chunk = alloc_malloc(ALLOC_PREPROCESSOR, sizeof(ArenaChunk) + size);
+    chunk->next = e->arena;
+    chunk->used = 0;
+    chunk->size = size;
+    e->arena = chunk;
+  }
+
+  char *copy = chunk->data + chunk->used;
+  memcpy(copy, text, len);
+  chunk->used += len;
+  return copy;
+}
+
+static void resetArena(MacroExpander *e) {
+  while (e->arena) {
+    ArenaChunk *next = e->arena->next;
+    alloc_free(e->arena);
+    e->arena = next;
+  }
+}
+
+void initExpander(MacroExpander *e, PPConsumer consume, void *ctx) {
+  memset(e, 0, sizeof(*e));
+  e->macros = MacroMap_create(4);
+  e->consume = consume;
+  e->ctx = ctx;
+  e->last = '\n';
+}
+
+static void freeMacro(Macro *m) {
+  alloc_free(m->text);
+  alloc_free(m->body);
+}
+
+Macro *findMacro(MacroExpander *e, const char *name, size_t len) {
+  PPName key = {name, (int)len};
+  return MacroMap_find(e->macros, key);
+}
+
+int undefineMacro(MacroExpander *e, const char *name, size_t len) {
+  Macro *m = findMacro(e, name, len);
+  if (!m)
+    return 0;
+
+  Macro old = *m;
+  MacroMap_remove(e->macros, MACRO_KEY(&old));
+  freeMacro(&old);
+  e->macro_count--;
+  return 1;
+}
+
+static int findParam(PPName *params, int count, const PPToken *tok) {
+  for (int i = 0; i < count; i++) {
+    if (params[i].len == tok->len &&
+        memcmp(params[i].text, tok->text, tok->len) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+static int parseParams(const char *p, const char *end, PPName *params,
+                       int max, int *count, int *variadic, const char **rest) {
+  PPToken tok;
+  int expect_name = 1;
+
+  *count = 0;
+  *variadic = 0;
+  p++;
+
+  while (p < end) {
+    p += scanPPToken(p, end, 1, &tok);
+
+    if (tok.kind == PPT_SPACE)
+      continue;
+
+    if (expect_name && tok.kind == PPT_IDENT && *count < max) {
+      params[(*count)++] = (PPName){tok.text, tok.len};
+      expect_name = 0;
+    } else if (isPunct(&tok, "...") && !*variadic) {
+      if (expect_name) {
+        if (*count == max)
+          return -1;
+        params[(*count)++] = (PPName){"__VA_ARGS__", 11};
+      }
+      *variadic = 1;
+      expect_name = 0;
+    } else if (isPunct(&tok, ",") && !expect_name && !*variadic) {
+      expect_name = 1;
+    } else if (isPunct(&tok, ")") && (!expect_name || *count == 0)) {
+      *rest = p;
+      return 0;
+    } else {
+      return -1;
+    }
+  }
+
+  return -1;
+}
+
+int defineMacro(MacroExpander *e, const char *text, size_t len) {
+  Macro m = {0};
+  PPName params[128];
+  PPTokenList body = {0};
+  PPToken tok;
+
+  m.text = alloc_malloc(ALLOC_PREPROCESSOR, len + 1);
+  memcpy(m.text, text, len);
+  m.text[len] = '\0';
+
+  const char *p = m.text, *end = m.text + len;
+  while (p < end && isHorizontalSpace(*p))
+    p++;
+
+  if (p == end || !isIdentStart(*p)) {
+    fprintf(stderr, "#define: macro name must be an identifier\n");
+    alloc_free(m.text);
+    return -1;
+  }
+
+  p += scanPPToken(p, end, 1, &tok);
+  m.name = (char *)tok.text;
+  m.name_len = tok.len;
+  m.param_count = -1;
+
+  if (p < end && *p == '(' &&
+      parseParams(p, end, params, 128, &m.param_count, &m.variadic, &p) < 0) {
+    fprintf(stderr, "#define %.*s: malformed parameter list\n", m.name_len,
+            m.name);
+    alloc_free(m.text);
+    return -1;
+  }
+
+  int space = 0;
+  while (p < end) {
+    p += scanPPToken(p, end, 1, &tok);
+
+    if (tok.kind == PPT_SPACE || tok.kind == PPT_NEWLINE) {
+      space = 1;
+      continue;
+    }
+
+    tok.space = body.count ? space : 0;
+    space = 0;
+
+    if (tok.kind == PPT_IDENT && m.param_count > 0) {
+      tok.param = findParam(params, m.param_count, &tok);
+      if (tok.param >= 0)
+        tok.kind = PPT_PARAM;
+    } else if (isPunct(&tok, "##")) {
+      tok.kind = PPT_PASTE;
+      m.pastes = 1;
+    } else if (isPunct(&tok, "#") && m.param_count >= 0) {
+      const char *q = p;
+      PPToken next;
+
+      while (q < end && isHorizontalSpace(*q))
+        q++;
+
+      if (q < end) {
+        q += scanPPToken(q, end, 1, &next);
+        int param = findParam(params, m.param_count, &next);
+
+        if (next.kind == PPT_IDENT && param >= 0) {
+          tok.kind = PPT_STRINGIFY;
+          tok.param = param;
+          p = q;
+        }
+      }
+    }
+
+    pushPPToken(&body, tok);
+  }
+
+  if (body.count && body.items[0].kind == PPT_PASTE)
+    memmove(body.items, body.items + 1, sizeof(PPToken) * --body.count);
+  if (body.count && body.items[body.count - 1].kind == PPT_PASTE)
+    body.count--;
+
+  m.body = body.items;
+  m.body_count = body.count;
+
+  undefineMacro(e, m.name, m.name_len);
+  MacroMap_insert(e->macros, &m);
+  e->macro_count++;
+  return 0;
+}
+
+static void deactivateAll(MacroExpander *e) {
+  MacroMap *map = e->macros;
+
+  for (int i = 0; i < map->dir_size; i++) {
+    if (!MacroMap_isFirst(map, i))
+      continue;
+
+    MacroMapBucket *b = map->directory[i];
+    for (int j = 0; j < b->size; j++)
+      b->slots[j].value.active = 0;
+  }
+}
+
+static void reserveOut(MacroExpander *e, size_t len) {
+  if (e->out_len + len <= e->out_capacity)
+    return;
+
+  while (e->out_len + len > e->out_capacity)
+    e->out_capacity = e->out_capacity ? e->out_capacity * 2 : PP_BLOCK_SIZE;
+  e->out = alloc_realloc(ALLOC_PREPROCESSOR, e->out, e->out_capacity);
+}
+
+static void emitRaw(MacroExpander *e, const char *text, size_t len) {
+  if (!len)
+    return;
+
+  reserveOut(e, len);
+  memcpy(e->out + e->out_len, text, len);
+  e->out_len += len;
+  e->last = text[len - 1];
+}
+
+static void flushOut(MacroExpander *e) {
+  if (e->out_len)
+    e->consume(e->out, e->out_len, e->ctx);
+  e->out_len = 0;
+}
+
+static int isMergeable(char c) {
+  return c && strchr("+-*/%<>=!&|^#.:", c) != NULL;
+}
+
+static int needsSpace(char a, char b) {
+  return (isIdentChar(a) && isIdentChar(b)) ||
+         (isMergeable(a) && isMergeable(b));
+}
+
+static void emitToken(MacroExpander *e, PPToken tok, PPTokenList *out) {
+  if (out) {
+    pushPPToken(out, tok);
+    return;
+  }
+
+  if (!tok.len)
+    return;
+
+  if (!isspace((unsigned char)e->last) &&
+      (tok.space || needsSpace(e->last, tok.text[0])))
+    emitRaw(e, " ", 1);
+
+  emitRaw(e, tok.text, tok.len);
+}
+
+static int nextToken(Reader *r, PPToken *tok) {
+  if (r->stack.count) {
+    *tok = r->stack.items[--r->stack.count];
+    return READ_OK;
+  }
+
+  if (r->list) {
+    if (r->list_pos == r->list_count)
+      return READ_EOF;
+    *tok = r->list[r->list_pos++];
+    return READ_OK;
+  }
+
+  if (r->src == r->end)
+    return r->final ? READ_EOF : READ_MORE;
+
+  int n = scanPPToken(r->src, r->end, r->final, tok);
+  if (n < 0)
+    return READ_MORE;
+
+  r->src += n;
+  return READ_OK;
+}
+
+static ReaderMark markReader(const Reader *r) {
+  return (ReaderMark){r->stack.count, r->src, r->list_pos, r->newlines};
+}
+
+static void resetReader(Reader *r, ReaderMark mark) {
+  r->stack.count = mark.stack_count;
+  r->src = mark.src;
+  r->list_pos = mark.list_pos;
+  r->newlines = mark.newlines;
+}
+
+/*
+ * Reads the arguments of an invocation whose '(' was just consumed. Tokens of
+ * argument i are args->items[starts[i]] .. args->items[starts[i + 1]].
+ */
+static int collectArgs(Reader *r, Macro *m, PPTokenList *args, int *starts,
+                       int max, int *argc, PPTokenList *ended) {
+  PPToken tok;
+  int depth = 1, space = 0, st;
+
+  *argc = 0;
+  starts[0] = 0;
+
+  while ((st = nextToken(r, &tok)) == READ_OK) {
+    if (tok.kind == PPT_END) {
+      pushPPToken(ended, tok);
+      continue;
+    }
+
+    if (tok.kind == PPT_SPACE || tok.kind == PPT_NEWLINE) {
+      r->newlines += (tok.kind == PPT_NEWLINE);
+      space = 1;
+      continue;
+    }
+
+    if (isPunct(&tok, "(")) {
+      depth++;
+    } else if (isPunct(&tok, ")") && --depth == 0) {
+      starts[++*argc] = args->count;
+      return READ_OK;
+    } else if (isPunct(&tok, ",") && depth == 1 &&
+               !(m->variadic && *argc == m->param_count - 1)) {
+      if (*argc + 2 >= max)
+        return READ_EOF;
+      starts[++*argc] = args->count;
+      space = 0;
+      continue;
+    }
+
+    tok.space = (space || tok.space) && args->count > starts[*argc];
+    space = 0;
+    pushPPToken(args, tok);
+  }
+
+  return st;
+}
+
+static PPToken stringify(MacroExpander *e, const PPToken *toks, int count) {
+  size_t size = 3;
+  for (int i = 0; i < count; i++)
+    size += 2 * toks[i].len + 1;
+
+  char *buf = alloc_malloc(ALLOC_PREPROCESSOR, size);
+  size_t n = 0;
+
+  buf[n++] = '"';
+  for (int i = 0; i < count; i++) {
+    if (i && toks[i].space)
+      buf[n++] = ' ';
+
+    int quoted = toks[i].kind == PPT_STRING || toks[i].kind == PPT_CHAR;
+    for (int j = 0; j < toks[i].len; j++) {
+      char c = toks[i].text[j];
+      if (quoted && (c == '"' || c == '\\'))
+        buf[n++] = '\\';
+      buf[n++] = c;
+    }
+  }
+  buf[n++] = '"';
+
+  PPToken tok;
+  const char *text = copyToArena(e, buf, n);
+  scanPPToken(text, text + n, 1, &tok);
+  alloc_free(buf);
+  return tok;
+}
+
+static int pasteTokens(MacroExpander *e, PPToken a, PPToken b, PPToken *out) {
+  size_t len = a.len + b.len;
+  char *buf = alloc_malloc(ALLOC_PREPROCESSOR, len);
+
+  memcpy(buf, a.text, a.len);
+  memcpy(buf + a.len, b.text, b.len);
+
+  const char *text = copyToArena(e, buf, len);
+  alloc_free(buf);
+
+  if (scanPPToken(text, text + len, 1, out) != (int)len) {
+    fprintf(stderr, "pasting \"%.*s\" and \"%.*s\" does not give a valid "
+                    "preprocessing token\n",
+            a.len, a.text, b.len, b.text);
+    return -1;
+  }
+
+  out->space = a.space;
+  return 0;
+}
+
+typedef struct Invocation {
+  Macro *m;
+  PPTokenList *args;
+  int *starts;
+  PPTokenList *expanded;
+  int *is_expanded;
+} Invocation;
+
+static void appendOperand(MacroExpander *e, Invocation *inv, PPToken t,
+                          int raw, PPTokenList *result) {
+  int first = result->count;
+
+  if (t.kind == PPT_STRINGIFY) {
+    const PPToken *arg = inv->args->items + inv->starts[t.param];
+    pushPPToken(result, stringify(e, arg, inv->starts[t.param + 1] -
+                                              inv->starts[t.param]));
+  } else if (t.kind == PPT_PARAM) {
+    const PPToken *arg = inv->args->items + inv->starts[t.param];
+    int count = inv->starts[t.param + 1] - inv->starts[t.param];
+
+    if (!raw && !inv->is_expanded[t.param]) {
+      expandPPTokens(e, arg, count, &inv->expanded[t.param]);
+      inv->is_expanded[t.param] = 1;
+    }
+
+    if (!raw) {
+      arg = inv->expanded[t.param].items;
+      count = inv->expanded[t.param].count;
+    }
+
+    for (int i = 0; i < count; i++)
+      pushPPToken(result, arg[i]);
+  } else {
+    pushPPToken(result, t);
+  }
+
+  if (result->count > first)
+    result->items[first].space = t.space;
+}
+
+static void substitute(MacroExpander *e, Invocation *inv,
+                       PPTokenList *result) {
+  Macro *m = inv->m;
+  PPTokenList rhs = {0};
+
+  for (int i = 0; i < m->body_count; i++) {
+    int start = result->count;
+    int raw = i + 1 < m->body_count && m->body[i + 1].kind == PPT_PASTE;
+
+    appendOperand(e, inv, m->body[i], raw, result);
+
+    while (i + 2 < m->body_count && m->body[i + 1].kind == PPT_PASTE) {
+      PPToken right = m->body[i + 2];
+      i += 2;
+
+      rhs.count = 0;
+      appendOperand(e, inv, right, 1, &rhs);
+
+      if (rhs.count == 0) {
+        if (right.kind == PPT_PARAM && m->variadic &&
+            right.param == m->param_count - 1 && result->count > start &&
+            isPunct(&result->items[result->count - 1], ","))
+          result->count--;
+        continue;
+      }
+
+      int from = 0;
+      int comma = right.kind == PPT_PARAM && m->variadic &&
+                  right.param == m->param_count - 1 &&
+                  result->count > start &&
+                  isPunct(&result->items[result->count - 1], ",");
+
+      if (result->count > start && !comma) {
+        PPToken pasted;
+        PPToken left = result->items[--result->count];
+
+        if (pasteTokens(e, left, rhs.items[0], &pasted) == 0) {
+          pushPPToken(result, pasted);
+          from = 1;
+        } else {
+          pushPPToken(result, left);
+        }
+      }
+
+      for (int j = from; j < rhs.count; j++)
+        pushPPToken(result, rhs.items[j]);
+    }
+  }
+
+  freePPTokens(&rhs);
+}
+
+static void pushExpansion(Reader *r, Macro *m, int space,
+                          const PPToken *tokens, int count) {
+  PPToken end = {0};
+  end.kind = PPT_END;
+  end.macro = m;
+  pushPPToken(&r->stack, end);
+
+  for (int i = count - 1; i >= 0; i--) {
+    PPToken tok = tokens[i];
+    if (i == 0)
+      tok.space = space;
+    pushPPToken(&r->stack, tok);
+  }
+
+  m->active = 1;
+  STAT_INC(macro_expansions);
+}
+
+static void endMacros(PPTokenList *ended) {
+  for (int i = 0; i < ended->count; i++)
+    ended->items[i].macro->active = 0;
+  ended->count = 0;
+}
+
+static int invokeMacro(MacroExpander *e, Reader *r, Macro *m, PPToken name) {
+  PPTokenList ended = {0}, args = {0}, result = {0};
+  ReaderMark mark = markReader(r);
+  PPToken tok = {0};
+  int st, argc, open = 0, starts[130];
+
+  while ((st = nextToken(r, &tok)) == READ_OK) {
+    if (tok.kind == PPT_END)
+      pushPPToken(&ended, tok);
+    else if (tok.kind == PPT_NEWLINE)
+      r->newlines++;
+    else if (tok.kind != PPT_SPACE)
+      break;
+  }
+
+  if (st == READ_OK && isPunct(&tok, "(")) {
+    open = 1;
+    st = collectArgs(r, m, &args, starts, 130, &argc, &ended);
+  } else if (st == READ_OK) {
+    st = READ_EOF;
+  }
+
+  if (st == READ_OK) {
+    if (m->variadic && argc == m->param_count - 1)
+      starts[++argc] = args.count;
+
+    if (m->param_count == 0 && argc == 1 && args.count == 0)
+      argc = 0;
+
+    if (argc != m->param_count) {
+      fprintf(stderr, "macro \"%.*s\" requires %d arguments, but %d given\n",
+              m->name_len, m->name, m->param_count, argc);
+      st = READ_EOF;
+    }
+  } else if (st == READ_EOF && open) {
+    fprintf(stderr, "unterminated argument list invoking macro \"%.*s\"\n",
+            m->name_len, m->name);
+  }
+
+  if (st == READ_OK) {
+    PPTokenList expanded[130] = {{0}};
+    int is_expanded[130] = {0};
+    Invocation inv = {m, &args, starts, expanded, is_expanded};
+
+    endMacros(&ended);
+    substitute(e, &inv, &result);
+    pushExpansion(r, m, name.space, result.items, result.count);
+
+    for (int i = 0; i < m->param_count; i++)
+      freePPTokens(&expanded[i]);
+  } else if (st == READ_EOF) {
+    resetReader(r, mark);
+  }
+
+  freePPTokens(&ended);
+  freePPTokens(&args);
+  freePPTokens(&result);
+  return st;
+}
+
+/*
+ * Expands `tok` if it names an enabled macro by pushing its replacement onto
+ * the reader, or emits it otherwise.
+ */
+static int expandToken(MacroExpander *e, Reader *r, PPToken tok,
+                       PPTokenList *out) {
+  if (tok.kind == PPT_IDENT && !tok.noexpand) {
+    Macro *m = findMacro(e, tok.text, tok.len);
+
+    if (m && m->active) {
+      tok.noexpand = 1;
+    } else if (m && m->param_count < 0 && !m->pastes) {
+      pushExpansion(r, m, tok.space, m->body, m->body_count);
+      return READ_OK;
+    } else if (m && m->param_count < 0) {
+      PPTokenList result = {0};
+      Invocation inv = {m, NULL, NULL, NULL, NULL};
+
+      substitute(e, &inv, &result);
+      pushExpansion(r, m, tok.space, result.items, result.count);
+      freePPTokens(&result);
+      return READ_OK;
+    } else if (m) {
+      int st = invokeMacro(e, r, m, tok);
+      if (st != READ_EOF)
+        return st;
+    }
+  }
+
+  emitToken(e, tok, out);
+  return READ_OK;
+}
+
+void expandPPTokens(MacroExpander *e, const PPToken *in, int count,
+                    PPTokenList *out) {
+  Reader r = {0};
+  PPToken tok;
+
+  r.list = in;
+  r.list_count = count;
+
+  while (nextToken(&r, &tok) == READ_OK) {
+    if (tok.kind == PPT_END)
+      tok.macro->active = 0;
+    else
+      expandToken(e, &r, tok, out);
+  }
+
+  freePPTokens(&r.stack);
+}
+
+static int expandSource(MacroExpander *e, const char *src, const char *end,
+                        int final, const char **stop) {
+  Reader r = {0};
+  PPToken tok;
+  int st = READ_OK;
+
+  r.src = src;
+  r.end = end;
+  r.final = final;
+
+  do {
+    if ((st = nextToken(&r, &tok)) != READ_OK)
+      break;
+
+    if (tok.kind == PPT_END)
+      tok.macro->active = 0;
+    else
+      st = expandToken(e, &r, tok, NULL);
+  } while (st == READ_OK && r.stack.count);
+
+  for (int i = 0; i < r.newlines; i++)
+    emitRaw(e, "\n", 1);
+
+  *stop = r.src;
+  freePPTokens(&r.stack);
+  return st;
+}
+
+static size_t process(MacroExpander *e, const char *buf, size_t len,
+                      int final) {
+  const char *p = buf, *run = buf, *end = buf + len;
+
+  if (e->macro_count == 0) {
+    emitRaw(e, buf, len);
+    flushOut(e);
+    return len;
+  }
+
+  while (p < end) {
+    unsigned char c = *p;
+
+    if (isIdentStart(c)) {
+      const char *q = p + 1;
+      while (q < end && isIdentChar(*q))
+        q++;
+      if (q == end && !final)
+        break;
+
+      if (!findMacro(e, p, q - p)) {
+        p = q;
+        continue;
+      }
+
+      emitRaw(e, run, p - run);
+
+      size_t mark = e->out_len;
+      char last = e->last;
+      const char *stop;
+
+      if (expandSource(e, p, end, final, &stop) == READ_MORE) {
+        e->out_len = mark;
+        e->last = last;
+        deactivateAll(e);
+        run = p;
+        break;
+      }
+
+      resetArena(e);
+      p = run = stop;
+
+      if (p < end && !isspace((unsigned char)e->last) &&
+          needsSpace(e->last, *p))
+        emitRaw(e, " ", 1);
+
+      if (e->out_len >= PP_BLOCK_SIZE)
+        flushOut(e);
+    } else if (isdigit(c) || c == '"' || c == '\'' || c == '.') {
+      PPToken tok;
+      int n = scanPPToken(p, end, final, &tok);
+      if (n < 0)
+        break;
+      p += n;
+    } else {
+      p++;
+    }
+  }
+
+  emitRaw(e, run, p - run);
+  flushOut(e);
+  return p - buf;
+}
+
+static void appendPending(MacroExpander *e, const char *text, size_t len) {
+  if (!len)
+    return;
+
+  if (e->pending_len + len > e->pending_capacity) {
+    while (e->pending_len + len > e->pending_capacity)
+      e->pending_capacity = e->pending_capacity ? e->pending_capacity * 2 : 256;
+    e->pending = alloc_realloc(ALLOC_PREPROCESSOR, e->pending,
+                               e->pending_capacity);
+  }
+
+  memcpy(e->pending + e->pending_len, text, len);
+  e->pending_len += len;
+}
+
+void feedExpander(MacroExpander *e, const char *text, size_t len) {
+  if (e->pending_len == 0) {
+    size_t used = process(e, text, len, 0);
+    appendPending(e, text + used, len - used);
+    return;
+  }
+
+  appendPending(e, text, len);
+
+  size_t used = process(e, e->pending, e->pending_len, 0);
+  memmove(e->pending, e->pending + used, e->pending_len - used);
+  e->pending_len -= used;
+}
+
+void flushExpander(MacroExpander *e) {
+  if (e->pending_len)
+    process(e, e->pending, e->pending_len, 1);
+  e->pending_len = 0;
+}
+
+void destroyExpander(MacroExpander *e) {
+  MacroMap *map = e->macros;
+
+  for (int i = 0; i < map->dir_size; i++) {
+    if (!MacroMap_isFirst(map, i))
+      continue;
+
+    MacroMapBucket *b = map->directory[i];
+    for (int j = 0; j < b->size; j++)
+      freeMacro(&b->slots[j].value);
+  }
+
+  MacroMap_destroy(map);
+  resetArena(e);
+  alloc_free(e->pending);
+  alloc_free(e->out);
+  memset(e, 0, sizeof(*e));
+}
@@ -1,120 +1,219 @@
 #include "preprocessor/preprocessor.h"
+#include "alloc.h"
+#include "preprocessor/include.h"
 
-#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
-void skipCommentsAndDirectives(FILE *fp) {
-  FILE *out = fopen("temp.c", "w");
+int preprocessLine(FILE *fp, FILE *out, PPState *state) {
+  PPScanner s = ppScannerAt(*state);
+  char text[2];
+  int c, n;
 
-  int c, next;
-  int in_string = 0, in_char = 0;
-  int start_of_line = 1;
+  /* The state only records a continued directive at the end of its line */
+  s.state.in_directive = 0;
 
   while ((c = fgetc(fp)) != EOF) {
+    n = scanPPChar(&s, c, text, NULL, NULL) & PP_SCAN_COUNT;
+    for (int i = 0; i < n; i++)
+      fputc(text[i], out);
 
-    if (!in_char && c == '"' && !in_string) {
-      in_string = 1;
-      fputc(c, out);
-      continue;
-    } else if (in_string) {
-      fputc(c, out);
-
-      if (c == '\\') {
-        int esc = fgetc(fp);
-        if (esc != EOF)
-          fputc(esc, out);
-        continue;
-      }
+    if (n && text[n - 1] == '\n') {
+      *state = s.state;
+      return 1;
+    }
+  }
 
-      if (c == '"')
-        in_string = 0;
+  n = finishPPScanner(&s, text) & PP_SCAN_COUNT;
+  for (int i = 0; i < n; i++)
+    fputc(text[i], out);
+  *state = s.state;
+  return 0;
+}
 
-      continue;
-    }
+void growDirective(char **text, size_t *capacity, size_t len) {
+  if (len <= *capacity)
+    return;
 
-    if (!in_string && c == '\'' && !in_char) {
-      in_char = 1;
-      fputc(c, out);
-      continue;
-    } else if (in_char) {
-      fputc(c, out);
-
-      if (c == '\\') {
-        int esc = fgetc(fp);
-        if (esc != EOF)
-          fputc(esc, out);
-        continue;
-      }
+  while (*capacity < len)
+    *capacity = *capacity ? *capacity * 2 : 256;
+  *text = alloc_realloc(ALLOC_PREPROCESSOR, *text, *capacity);
+}
 
-      if (c == '\'')
-        in_char = 0;
+void flushPPStream(PPStream *s) {
+  if (s->out_len)
+    s->consume(s->out, s->out_len, s->ctx);
+  s->out_len = 0;
+}
 
-      continue;
-    }
+static inline void emit(PPStream *s, char c) {
+  if (s->out_len == PP_BLOCK_SIZE)
+    flushPPStream(s);
+  s->out[s->out_len++] = c;
+}
 
-    if (!in_string && !in_char && start_of_line) {
-      int temp = c;
+static void endDirective(PPStream *s) {
+  if (s->on_directive) {
+    flushPPStream(s);
+    s->on_directive(s->directive ? s->directive : "", s->scan.directive_len,
+                    s->ctx);
+  }
+}
 
-      while (isspace(temp) && temp != '\n') {
-        fputc(temp, out);
-        temp = fgetc(fp);
-      }
+void initPPStream(PPStream *s, PPConsumer consume, void *ctx) {
+  PPState init = PP_STATE_INIT;
 
-      if (temp == '#') {
-        while ((c = fgetc(fp)) != EOF && c != '\n')
-          fputc(' ', out);
-        fputc('\n', out);
-        start_of_line = 1;
-        continue;
-      }
+  s->scan = ppScannerAt(init);
+  s->consume = consume;
+  s->on_directive = NULL;
+  s->ctx = ctx;
+  s->directive = NULL;
+  s->directive_capacity = 0;
+  s->out_len = 0;
+}
+
+void feedPPStream(PPStream *s, const char *buf, size_t len) {
+  const char *end = buf + len;
 
-      ungetc(temp, fp);
-      c = fgetc(fp);
-      start_of_line = 0;
+  while (buf < end) {
+    if (s->scan.mode == PP_MODE_LINE_COMMENT) {
+      const char *nl = memchr(buf, '\n', end - buf);
+      if (!nl)
+        break;
+      buf = nl;
     }
 
-    if (!in_string && !in_char && c == '/') {
-      next = fgetc(fp);
+    /* Each character yields at most two, written straight to the block */
+    if (s->out_len > PP_BLOCK_SIZE - 2)
+      flushPPStream(s);
 
-      if (next == '/') {
-        while ((c = fgetc(fp)) != EOF && c != '\n')
-          ;
-        fputc('\n', out);
-        start_of_line = 1;
-        continue;
-      }
+    int n = scanPPChar(&s->scan, *buf++, s->out + s->out_len, &s->directive,
+                       &s->directive_capacity);
 
-      if (next == '*') {
-        int prev = 0;
+    s->out_len += n & PP_SCAN_COUNT;
+    if (n & PP_SCAN_DIRECTIVE)
+      endDirective(s);
+  }
+}
 
-        fputc(' ', out);
-        fputc(' ', out);
+void finishPPStream(PPStream *s) {
+  char text[2];
+  int n = finishPPScanner(&s->scan, text);
 
-        while ((c = fgetc(fp)) != EOF) {
+  for (int i = 0; i < (n & PP_SCAN_COUNT); i++)
+    emit(s, text[i]);
+  if (n & PP_SCAN_DIRECTIVE)
+    endDirective(s);
 
-          if (c == '\n') {
-            fputc('\n', out);
-            start_of_line = 1;
-            prev = 0;
-            continue;
-          }
+  flushPPStream(s);
 
-          fputc(' ', out);
+  alloc_free(s->directive);
+  s->directive = NULL;
+  s->scan.directive_len = s->directive_capacity = 0;
+}
 
-          if (prev == '*' && c == '/')
-            break;
+int readPPStream(PPStream *s, int fd) {
+  char block[PP_BLOCK_SIZE];
+  ssize_t n;
 
-          prev = c;
-        }
+  while ((n = read(fd, block, sizeof(block))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
         continue;
-      }
-
-      ungetc(next, fp);
+      return -1;
     }
 
-    fputc(c, out);
-    start_of_line = (c == '\n');
+    feedPPStream(s, block, n);
+  }
+
+  return 0;
+}
+
+int preprocessStream(int fd, PPConsumer consume, void *ctx) {
+  PPStream stream;
+
+  initPPStream(&stream, consume, ctx);
+  int status = readPPStream(&stream, fd);
+  finishPPStream(&stream);
+
+  return status;
+}
+
+typedef struct SourceUnit {
+  PPUnit unit;
+  const char *path;
+
+  PPConsumer consume;
+  void *ctx;
+
+  LineMap *lines;
+  uint32_t rows;
+} SourceUnit;
+
+static void forwardBlock(const char *block, size_t len, void *ctx) {
+  SourceUnit *src = ctx;
+
+  src->consume(block, len, src->ctx);
+
+  if (src->lines) {
+    for (const char *p = block, *end = block + len;
+         (p = memchr(p, '\n', end - p)); p++)
+      src->rows++;
   }
+}
+
+static void feedUnit(const char *block, size_t len, void *ctx) {
+  feedPPUnit(&((SourceUnit *)ctx)->unit, block, len);
+}
+
+static void directiveUnit(const char *directive, size_t len, void *ctx) {
+  SourceUnit *src = ctx;
+  handleDirective(&src->unit, directive, len, src->path, NULL);
+}
+
+static void includeUnit(const char *path, void *ctx) {
+  SourceUnit *src = ctx;
+
+  if (path)
+    enterLineMap(src->lines, path, src->rows + 1);
+  else
+    leaveLineMap(src->lines, src->rows + 1);
+}
+
+int preprocessUnit(int fd, const char *path, PPConsumer consume, void *ctx,
+                   LineMap *lines) {
+  SourceUnit src = {
+      .path = path, .consume = consume, .ctx = ctx, .lines = lines};
+  PPStream stream;
+
+  resetIncludedHeaders();
+  initPPUnit(&src.unit, forwardBlock, &src);
+  initPPStream(&stream, feedUnit, &src);
+  stream.on_directive = directiveUnit;
+
+  if (lines) {
+    src.unit.on_include = includeUnit;
+    src.unit.include_ctx = &src;
+  }
+
+  int status = readPPStream(&stream, fd);
+
+  finishPPStream(&stream);
+  finishPPUnit(&src.unit);
+  return status;
+}
+
+static void writeBlock(const char *block, size_t len, void *ctx) {
+  fwrite(block, 1, len, ctx);
+}
+
+void skipCommentsAndDirectives(FILE *fp, const char *path, LineMap *lines) {
+  FILE *out = fopen("temp.c", "w");
+
+  if (preprocessUnit(fileno(fp), path, writeBlock, out, lines) < 0)
+    perror("preprocess");
 
   fclose(out);
 }
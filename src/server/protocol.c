@@ -0,0 +1,87 @@
+#include "server/protocol.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const char *serverSocketPath(void) {
+  static char path[PATH_MAX];
+  const char *env = getenv(SERVER_SOCKET_ENV);
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+  if (env && *env)
+    return env;
+
+  if (runtime && *runtime)
+    snprintf(path, sizeof(path), "%s/" SERVER_SOCKET_NAME, runtime);
+  else
+    snprintf(path, sizeof(path), "/tmp/compile-%u/" SERVER_SOCKET_NAME,
+             (unsigned)getuid());
+  return path;
+}
+
+int connectServer(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  return fd;
+}
+
+int writeAll(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+int readAll(int fd, void *buf, size_t len) {
+  char *p = buf;
+
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n == 0)
+      return -1;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
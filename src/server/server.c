@@ -0,0 +1,319 @@
+#define _GNU_SOURCE /* struct ucred */
+
+#include "server/server.h"
+#include "compiler/driver.h"
+#include "preprocessor/include.h"
+#include "server/protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Request buffers use plain malloc so --memory only accounts the compile */
+typedef struct Request {
+  char *strings;
+  char **argv;
+  int argc;
+
+  char *source;
+  uint64_t source_len;
+} Request;
+
+static volatile sig_atomic_t stopping;
+static int home = -1;
+
+static void onSignal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static void freeRequest(Request *req) {
+  free(req->strings);
+  free(req->argv);
+  free(req->source);
+  memset(req, 0, sizeof(*req));
+}
+
+static int readRequest(int fd, Request *req) {
+  uint32_t count, size;
+
+  memset(req, 0, sizeof(*req));
+
+  if (readAll(fd, &count, sizeof(count)) < 0 ||
+      readAll(fd, &size, sizeof(size)) < 0 || count < 1 ||
+      count > SERVER_MAX_ARGS || size > SERVER_MAX_ARG_BYTES)
+    return -1;
+
+  req->strings = malloc(size + 1);
+  if (readAll(fd, req->strings, size) < 0)
+    return -1;
+  req->strings[size] = '\0';
+
+  /* argv[0] takes the working directory's slot */
+  req->argv = malloc(sizeof(char *) * (count + 1));
+
+  char *s = req->strings, *end = req->strings + size;
+  for (uint32_t i = 0; i < count; i++) {
+    if (s >= end)
+      return -1;
+    req->argv[i] = s;
+    s += strlen(s) + 1;
+  }
+  req->argv[count] = NULL;
+  req->argc = count;
+
+  if (readAll(fd, &req->source_len, sizeof(req->source_len)) < 0 ||
+      req->source_len > SERVER_MAX_SOURCE)
+    return -1;
+
+  req->source = malloc(req->source_len + 1);
+  if (!req->source)
+    return -1;
+
+  return readAll(fd, req->source, req->source_len);
+}
+
+static int sendFile(int fd, FILE *fp, uint64_t len) {
+  char buf[1 << 16];
+
+  rewind(fp);
+  while (len) {
+    size_t n = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf), fp);
+    if (n == 0 || writeAll(fd, buf, n) < 0)
+      return -1;
+    len -= n;
+  }
+
+  return 0;
+}
+
+static uint64_t fileSize(FILE *fp) {
+  struct stat st;
+  return fstat(fileno(fp), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+/* Runs the request with stdout and stderr redirected into `out` and `err` */
+static int runCaptured(Request *req, FILE *out, FILE *err) {
+  const char *cwd = req->argv[0];
+  int status;
+
+  fflush(stdout);
+  fflush(stderr);
+
+  int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+  dup2(fileno(out), STDOUT_FILENO);
+  dup2(fileno(err), STDERR_FILENO);
+
+  if (chdir(cwd) < 0) {
+    perror(cwd);
+    status = 1;
+  } else {
+    refreshHeaderCache();
+    req->argv[0] = "compile";
+    status = runCompiler(req->argc, req->argv, req->source, req->source_len);
+  }
+
+  if (fchdir(home) < 0)
+    perror("compile server: working directory");
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+
+  return status;
+}
+
+static int isShutdown(const Request *req) {
+  return req->argc == 2 && strcmp(req->argv[1], "--shutdown") == 0;
+}
+
+/* Only the user running the server may submit compiles */
+static int trustedPeer(int client) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+    perror("compile server: SO_PEERCRED");
+    return 0;
+  }
+
+  if (cred.uid != geteuid()) {
+    fprintf(stderr, "compile server: rejected a client with uid %u\n",
+            (unsigned)cred.uid);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void setTimeouts(int client) {
+  struct timeval tv = {.tv_sec = SERVER_TIMEOUT};
+
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void serve(int client) {
+  Request req;
+
+  if (!trustedPeer(client))
+    return;
+
+  setTimeouts(client);
+
+  if (readRequest(client, &req) < 0) {
+    fprintf(stderr, "compile server: malformed request\n");
+    freeRequest(&req);
+    return;
+  }
+
+  FILE *out = tmpfile(), *err = tmpfile();
+  int32_t status = 0;
+
+  if (!out || !err) {
+    perror("tmpfile");
+    status = 1;
+  } else if (isShutdown(&req)) {
+    stopping = 1;
+  } else {
+    status = runCaptured(&req, out, err);
+  }
+
+  uint64_t out_len = out ? fileSize(out) : 0;
+  uint64_t err_len = err ? fileSize(err) : 0;
+
+  if (writeAll(client, &status, sizeof(status)) < 0 ||
+      writeAll(client, &out_len, sizeof(out_len)) < 0 ||
+      writeAll(client, &err_len, sizeof(err_len)) < 0 ||
+      (out_len && sendFile(client, out, out_len) < 0) ||
+      (err_len && sendFile(client, err, err_len) < 0))
+    perror("compile server: reply");
+
+  if (out)
+    fclose(out);
+  if (err)
+    fclose(err);
+  freeRequest(&req);
+}
+
+/*
+ * Creates the socket's directory with mode 0700 if needed, and refuses one
+ * that another user owns or could write to.
+ */
+static int privateDirectory(const char *path) {
+  char buf[PATH_MAX];
+  struct stat st;
+
+  snprintf(buf, sizeof(buf), "%s", path);
+  const char *dir = dirname(buf);
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+    perror(dir);
+    return -1;
+  }
+
+  if (lstat(dir, &st) < 0) {
+    perror(dir);
+    return -1;
+  }
+
+  if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    fprintf(stderr, "%s: socket directory must be owned by this user and "
+                    "not writable by others\n",
+            dir);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int listenOn(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if (privateDirectory(path) < 0)
+    return -1;
+
+  int probe = connectServer(path);
+  if (probe >= 0) {
+    close(probe);
+    fprintf(stderr, "%s: a server is already listening\n", path);
+    return -1;
+  }
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t mask = umask(0077);
+  int bound = fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(mask);
+
+  if (!bound || listen(fd, 16) < 0) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int runServer(const char *path) {
+  int fd = listenOn(path);
+  if (fd < 0)
+    return 1;
+
+  home = open(".", O_RDONLY | O_DIRECTORY);
+  if (home < 0) {
+    perror("compile server: working directory");
+    close(fd);
+    unlink(path);
+    return 1;
+  }
+
+  struct sigaction sa = {.sa_handler = onSignal};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  fprintf(stderr, "compile server listening on %s\n", path);
+
+  while (!stopping) {
+    int client = accept(fd, NULL, NULL);
+
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("accept");
+      break;
+    }
+
+    serve(client);
+    close(client);
+  }
+
+  close(fd);
+  close(home);
+  unlink(path);
+  clearHeaderCache();
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "lexer/fused.h"
+#include "lexer/lexer.h"
+#include "preprocessor/preprocessor.h"
+
+#define SOURCE "fused_test.c.in"
+#define HEADER "fused_test.h"
+
+static const char *fragments[] = {
+    "int ",         "x",           "abc_1",        " ",
+    "\n",           "\t",          "\"",           "'",
+    "\\",           "/",           "*",            "/*",
+    "*/",           "//",          "#",            "\n#",
+    "\n  #",        "\\\n",        "\n#if 0\n",    "\n#if 1\n",
+    "\n#else\n",    "\n#endif\n",  "\n#ifdef Y\n", "\n#define Y 2\n",
+    "\n#define F(a) (a + Y)\n",    "F(",           "Y",
+    "\n#include \"" HEADER "\"\n", "\n#pragma once\n",
+    "(",            ")",           "{",            ";",
+    ",",            "=",           "+=",           "&&",
+    "<",            "1",           "1.5e",         "2e+3",
+    "\"str\\\"ing\"", "'\"'",      "'/*'",         "\"//\"",
+    "for",          "\r",
+};
+
+#define FRAGMENT_COUNT ((int)(sizeof(fragments) / sizeof(fragments[0])))
+
+static void writeFile(const char *path, const char *text) {
+  FILE *out = fopen(path, "w");
+  fputs(text, out);
+  fclose(out);
+}
+
+static int sameToken(const Token *a, const Token *b) {
+  return strcmp(a->token_name, b->token_name) == 0 &&
+         strcmp(a->type, b->type) == 0 && a->row == b->row &&
+         a->col == b->col && a->index == b->index;
+}
+
+/* Lexes SOURCE both ways; the streams must match token for token */
+static int matchesTwoPass(void) {
+  FILE *fp = fopen(SOURCE, "r");
+  skipCommentsAndDirectives(fp, SOURCE, NULL);
+  fclose(fp);
+
+  fp = fopen("temp.c", "r");
+  resetLexer(1, 1, 0);
+
+  FusedLexer *lx = openFusedLexer(SOURCE);
+  int same = fp && lx;
+
+  while (same) {
+    Token *want = getNextToken(fp), *got = getNextFusedToken(lx);
+    int end = strcmp(want->type, "EOF") == 0;
+
+    same = sameToken(want, got);
+    if (!same)
+      fprintf(stderr, "token <%s, %d, %d> != <%s, %d, %d>\n",
+              got->token_name, got->row, got->col, want->token_name,
+              want->row, want->col);
+
+    token_destroy(want);
+    token_destroy(got);
+    if (end)
+      break;
+  }
+
+  if (lx)
+    closeFusedLexer(lx);
+  if (fp)
+    fclose(fp);
+  return same;
+}
+
+static void checkSource(const char *source) {
+  writeFile(SOURCE, source);
+
+  int same = matchesTwoPass();
+  if (!same)
+    fprintf(stderr, "source: %s\n", source);
+  CHECK(same);
+}
+
+static void testFixed(void) {
+  writeFile(HEADER, "#ifndef FUSED_TEST_H\n"
+                    "#define FUSED_TEST_H\n"
+                    "int from_header; /* a\n comment */\n"
+                    "#endif\n");
+
+  checkSource("int a; /* block\n comment */ int b; // line\nint c;\n");
+  checkSource("#include \"" HEADER "\"\n"
+              "#include \"" HEADER "\"\n"
+              "int after = 1;\n");
+  checkSource("#define MAX(a, b) \\\n"
+              "  ((a) > (b) ? (a) : (b))\n"
+              "int x = MAX(1, 2); // max\n"
+              "#if 0\n"
+              "int hidden;\n"
+              "#else\n"
+              "int shown = MAX(x, 3);\n"
+              "#endif\n");
+  checkSource("char *s = \"/* not a comment */\";\n"
+              "  # define N 4\n"
+              "int n[N]; /* one */ /* two */ int m;\n");
+}
+
+static void testRandom(void) {
+  writeFile(HEADER, "int from_header;\n#if 0\nskip\n#endif\n/* c */ char h");
+  srand(34);
+
+  for (int round = 0; round < 300; round++) {
+    char text[4096];
+    size_t len = 0;
+    int pieces = 1 + rand() % 80;
+
+    for (int i = 0; i < pieces; i++) {
+      const char *f = fragments[rand() % FRAGMENT_COUNT];
+      size_t n = strlen(f);
+
+      if (len + n >= sizeof(text))
+        break;
+      memcpy(text + len, f, n);
+      len += n;
+    }
+    text[len] = '\0';
+
+    checkSource(text);
+  }
+}
+
+int main(void) {
+  testFixed();
+  testRandom();
+
+  remove(SOURCE);
+  remove(HEADER);
+  remove("temp.c");
+  return CHECK_DONE();
+}
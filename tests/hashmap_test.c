@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "hashmap_typed.h"
+#include "lexer/symimage.h"
+#include "lexer/symtab.h"
+
+#define INT_KEY(v) (*(v))
+#define SAME_HASH(k) ((void)(k), 0x5a5a5a5au)
+#define INT_EQUAL(a, b) ((a) == (b))
+
+HASHMAP_DEFINE(CollidingMap, int, int, INT_KEY, SAME_HASH, INT_EQUAL)
+
+/* More keys than a bucket holds, all with one hash */
+static void testSameHash(int bucket_limit) {
+  CollidingMap *map = CollidingMap_create(bucket_limit);
+  int count = 4 * map->bucket_limit + 3;
+
+  for (int i = 0; i < count; i++)
+    CHECK(CollidingMap_insert(map, &i));
+
+  for (int i = 0; i < count; i++) {
+    int *found = CollidingMap_find(map, i);
+    CHECK(found && *found == i);
+  }
+
+  CHECK(!CollidingMap_insert(map, &(int){0}));
+  CHECK(CollidingMap_find(map, count) == NULL);
+  CHECK(CollidingMap_maxChain(map) == count);
+  CHECK(map->global_depth <= HASHMAP_MAX_DEPTH);
+
+  CHECK(CollidingMap_remove(map, 1));
+  CHECK(CollidingMap_find(map, 1) == NULL);
+  CHECK(CollidingMap_find(map, 2) != NULL);
+
+  CollidingMap_destroy(map);
+}
+
+/* "ab" and "bA" hash alike, so every name built from them does too */
+static void collidingName(char *name, int bits) {
+  for (int i = 0; i < 4; i++) {
+    name[2 * i] = (bits >> i) & 1 ? 'b' : 'a';
+    name[2 * i + 1] = (bits >> i) & 1 ? 'A' : 'b';
+  }
+  name[8] = '\0';
+}
+
+static void testCollidingSymbols(int bucket_limit) {
+  SymbolTable *table = symtab_create(bucket_limit);
+  char name[9];
+
+  collidingName(name, 0);
+  unsigned int hash = symbol_hash(name);
+
+  for (int bits = 0; bits < 16; bits++) {
+    collidingName(name, bits);
+    CHECK(symbol_hash(name) == hash);
+    CHECK(symtab_insert(table, name, 4, "int", "global"));
+  }
+
+  CHECK(symtab_count(table) == 16);
+  for (int bits = 0; bits < 16; bits++) {
+    collidingName(name, bits);
+    CHECK(symtab_find(table, name) == (uint32_t)bits);
+  }
+
+  /* The image keeps the oversized bucket whole */
+  char path[] = "hashmap_test_XXXXXX";
+  int fd = mkstemp(path);
+  FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+  CHECK(file && symimage_write(table, file) == 0);
+  if (file)
+    fclose(file);
+
+  SymbolImage *img = symimage_open(path);
+  CHECK(img != NULL);
+  for (int bits = 0; img && bits < 16; bits++) {
+    collidingName(name, bits);
+    CHECK(symimage_find(img, name) == (uint32_t)bits);
+  }
+
+  symimage_close(img);
+  remove(path);
+  symtab_destroy(table);
+}
+
+/* Every column reads back what went in; types and scopes are interned */
+static void testSymbolRoundTrip(void) {
+  static const char *types[] = {"int", "char *", "struct very_long_tag_name"};
+  static const char *scopes[] = {"global", "function_with_a_long_name"};
+  SymbolTable *table = symtab_createSized(HASHMAP_BUCKET_AUTO, 100);
+  char name[64];
+
+  /* Names past the old 20-character fields, and more than were expected */
+  for (int i = 0; i < 5000; i++) {
+    snprintf(name, sizeof(name), "a_rather_long_identifier_%d", i);
+    CHECK(symtab_insert(table, name, i, types[i % 3], scopes[i % 2]));
+  }
+
+  CHECK(symtab_count(table) == 5000);
+  CHECK(table->names.count == 5);
+
+  for (uint32_t i = 0; i < 5000; i++) {
+    snprintf(name, sizeof(name), "a_rather_long_identifier_%u", i);
+    CHECK(symtab_find(table, name) == i);
+    CHECK(strcmp(symtab_lexeme(table, i), name) == 0);
+    CHECK(table->sizes[i] == (int32_t)i);
+    CHECK(strcmp(symtab_type(table, i), types[i % 3]) == 0);
+    CHECK(strcmp(symtab_scope(table, i), scopes[i % 2]) == 0);
+    CHECK(table->types[i] == table->types[i % 3]);
+    CHECK(table->scopes[i] == table->scopes[i % 2]);
+  }
+
+  /* The first declaration of a name is the one kept */
+  CHECK(!symtab_insert(table, "a_rather_long_identifier_7", 99, "long",
+                       "global"));
+  CHECK(table->sizes[7] == 7 && strcmp(symtab_type(table, 7), "char *") == 0);
+  CHECK(symtab_count(table) == 5000);
+  CHECK(table->names.count == 5);
+
+  CHECK(symtab_find(table, "a_rather_long_identifier_5000") == STRTAB_NONE);
+  CHECK(symtab_find(table, "") == STRTAB_NONE);
+
+  symtab_destroy(table);
+}
+
+static void writeBytes(const char *path, const void *data, size_t len) {
+  FILE *out = fopen(path, "wb");
+  CHECK(out && fwrite(data, 1, len, out) == len);
+  if (out)
+    fclose(out);
+}
+
+/* Corrupt entries are caught by lookups, not by a scan when opening */
+static void testCorruptImage(void) {
+  SymbolTable *table = symtab_create(HASHMAP_BUCKET_AUTO);
+  char name[16], path[] = "hashmap_test_XXXXXX";
+
+  for (int i = 0; i < 300; i++) {
+    snprintf(name, sizeof(name), "s%d", i);
+    symtab_insert(table, name, i, i % 2 ? "int" : "char", "global");
+  }
+
+  int fd = mkstemp(path);
+  FILE *file = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+  CHECK(file && symimage_write(table, file) == 0);
+  symtab_destroy(table);
+  if (!file)
+    return;
+
+  long len = ftell(file);
+  uint8_t *good = malloc(len), *bad = malloc(len);
+  rewind(file);
+  CHECK(fread(good, 1, len, file) == (size_t)len);
+  fclose(file);
+
+  /* Every directory slot pointing past the buckets: opens, finds nothing */
+  SymbolImageHeader h;
+  memcpy(&h, good, sizeof(h));
+  memcpy(bad, good, len);
+  memset(bad + h.directory, 0xff, sizeof(uint32_t) << h.global_depth);
+  writeBytes(path, bad, len);
+
+  SymbolImage *img = symimage_open(path);
+  CHECK(img && symimage_find(img, "s1") == STRTAB_NONE);
+  symimage_close(img);
+
+  writeBytes(path, good, len - 4);
+  CHECK(symimage_open(path) == NULL);
+
+  int opened = 0;
+  srand(39);
+  for (int round = 0; round < 500; round++) {
+    memcpy(bad, good, len);
+    for (int i = 0; i < 4; i++)
+      bad[rand() % len] ^= 1 + rand() % 255;
+    writeBytes(path, bad, len);
+
+    if (!(img = symimage_open(path)))
+      continue;
+
+    for (int i = 0; i < 300; i++) {
+      snprintf(name, sizeof(name), "s%d", i);
+      uint32_t id = symimage_find(img, name);
+      CHECK(id == STRTAB_NONE || strcmp(symimage_lexeme(img, id), name) == 0);
+    }
+
+    const char *start = img->base, *end = start + img->size;
+    for (uint32_t id = 0; id < symimage_count(img); id++) {
+      const char *text[] = {symimage_lexeme(img, id), symimage_type(img, id),
+                            symimage_scope(img, id)};
+
+      for (int i = 0; i < 3; i++)
+        CHECK(!*text[i] ||
+              (text[i] >= start && text[i] + strlen(text[i]) < end));
+    }
+
+    opened++;
+    symimage_close(img);
+  }
+
+  CHECK(opened > 0);
+  free(good);
+  free(bad);
+  remove(path);
+}
+
+int main(void) {
+  testSameHash(1);
+  testSameHash(3);
+  testSameHash(HASHMAP_BUCKET_AUTO);
+
+  testCollidingSymbols(1);
+  testCollidingSymbols(3);
+  testCollidingSymbols(HASHMAP_BUCKET_AUTO);
+
+  testSymbolRoundTrip();
+  testCorruptImage();
+
+  return CHECK_DONE();
+}
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "check.h"
+#include "lexer/fused.h"
+#include "parser/parser.h"
+
+static Token *pullToken(void *ctx) { return getNextFusedToken(ctx); }
+
+static Ast *parse(const char *text) {
+  FusedLexer *lx = openFusedLexerBuffer("parser_test.c", text, strlen(text));
+  int errors = 0;
+  Ast *ast = parseTranslationUnit(pullToken, lx, &errors);
+
+  closeFusedLexer(lx);
+  CHECK(errors == 0);
+  return ast;
+}
+
+/* The declarator of the only declaration in `text` */
+static const AstNode *declarator(const Ast *ast) {
+  const AstNode *decl = ast_node(ast, ast_node(ast, ast->root)->a);
+  return ast_node(ast, decl->b);
+}
+
+static void testFunctionPointers(void) {
+  Ast *ast = parse("int (*fp)(void);");
+  const AstNode *d = declarator(ast);
+  CHECK(d->kind == AST_VARIABLE && d->flags == 1 && d->op == 1);
+  ast_destroy(ast);
+
+  /* One pointer on the return type, one making it a pointer */
+  ast = parse("char *(*gp)(int a, ...);");
+  d = declarator(ast);
+  CHECK(d->kind == AST_VARIABLE && d->flags == 2 && d->op == 2);
+  CHECK(d->c != AST_NULL && ast_node(ast, d->c)->kind == AST_PARAM);
+  CHECK(ast_node(ast, ast_node(ast, d->c)->next)->kind == AST_ELLIPSIS);
+  ast_destroy(ast);
+
+  ast = parse("int (*table[4])(long);");
+  d = declarator(ast);
+  CHECK(d->kind == AST_VARIABLE && d->op == 1 && d->b != AST_NULL);
+  ast_destroy(ast);
+
+  /* Neither a parenthesized name nor a plain pointer is a function pointer */
+  ast = parse("int (f)(void);");
+  d = declarator(ast);
+  CHECK(d->kind == AST_FUNCTION && d->op == 0);
+  ast_destroy(ast);
+
+  ast = parse("int *(p);");
+  d = declarator(ast);
+  CHECK(d->kind == AST_VARIABLE && d->flags == 1 && d->op == 0);
+  ast_destroy(ast);
+}
+
+int main(void) {
+  testFunctionPointers();
+  return CHECK_DONE();
+}
@@ -0,0 +1,226 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "compiler/compiler.h"
+#include "compiler/pipeline.h"
+#include "lexer/fused.h"
+#include "preprocessor/linemap.h"
+
+#define SOURCE "pipeline_test.c.in"
+#define HEADER "pipeline_test.h"
+#define OUTPUT "pipeline_test.out"
+
+typedef struct Text {
+  char *data;
+  size_t len, capacity;
+} Text;
+
+static void append(Text *t, const char *s) {
+  size_t len = strlen(s);
+
+  if (t->len + len + 1 > t->capacity) {
+    while (t->len + len + 1 > t->capacity)
+      t->capacity = t->capacity ? t->capacity * 2 : 256;
+    t->data = realloc(t->data, t->capacity);
+  }
+
+  memcpy(t->data + t->len, s, len + 1);
+  t->len += len;
+}
+
+static void writeFile(const char *path, const char *text) {
+  FILE *out = fopen(path, "w");
+  fputs(text, out);
+  fclose(out);
+}
+
+static char *readFile(const char *path) {
+  FILE *in = fopen(path, "r");
+  Text t = {0};
+  char line[1024];
+
+  while (in && fgets(line, sizeof(line), in))
+    append(&t, line);
+  if (in)
+    fclose(in);
+  return t.data ? t.data : strdup("");
+}
+
+static int sameToken(const Token *a, const Token *b) {
+  return strcmp(a->token_name, b->token_name) == 0 &&
+         strcmp(a->type, b->type) == 0 && a->row == b->row &&
+         a->col == b->col && a->index == b->index;
+}
+
+/* The pipeline maps rows to their files as compile() does for a lexer */
+static void checkTokens(void) {
+  Pipeline *p = startPipeline(SOURCE);
+  FusedLexer *lx = openFusedLexer(SOURCE);
+  LineMap lines;
+  int same = 1, end = 0, segment = 0;
+
+  initLineMap(&lines, SOURCE);
+  if (lx)
+    trackFusedLines(lx, &lines);
+
+  CHECK(p && lx);
+  while (p && lx && same && !end) {
+    Token *want = getNextFusedToken(lx), *got = pipelineToken(p);
+
+    want->row =
+        lineMapRow(lineMapFind(&lines, &segment, want->row), want->row);
+    end = strcmp(want->type, "EOF") == 0;
+    same = got && sameToken(want, got);
+    if (!same)
+      fprintf(stderr, "token %s at %d:%d differs\n", want->token_name,
+              want->row, want->col);
+
+    token_destroy(want);
+    if (got)
+      token_destroy(got);
+  }
+
+  CHECK(same);
+  if (p) {
+    CHECK(pipelineToken(p) == NULL);
+    finishPipeline(p);
+  }
+  if (lx)
+    closeFusedLexer(lx);
+  freeLineMap(&lines);
+}
+
+/* Everything compile() prints: the tokens, then the symbol table */
+static char *compileOutput(const char *path, int fused, int pipelined,
+                           int *status) {
+  CompileOptions options = {0};
+  int saved = dup(STDOUT_FILENO);
+  int fd = open(OUTPUT, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  options.fused = fused;
+  options.pipelined = pipelined;
+
+  fflush(stdout);
+  dup2(fd, STDOUT_FILENO);
+  close(fd);
+
+  *status = compile(path, &options);
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  return readFile(OUTPUT);
+}
+
+static void checkSource(const char *source) {
+  writeFile(SOURCE, source);
+  checkTokens();
+
+  int status[3];
+  char *pipelined = compileOutput(SOURCE, 0, 1, &status[0]);
+  char *fused = compileOutput(SOURCE, 1, 0, &status[1]);
+  char *two_pass = compileOutput(SOURCE, 0, 0, &status[2]);
+
+  CHECK(status[0] == 0 && status[1] == 0 && status[2] == 0);
+  CHECK(strstr(pipelined, "=== Symbol Table ===") != NULL);
+  CHECK(strcmp(pipelined, fused) == 0);
+  CHECK(strcmp(pipelined, two_pass) == 0);
+
+  free(pipelined);
+  free(fused);
+  free(two_pass);
+}
+
+static void testSmall(void) {
+  checkSource("#include \"" HEADER "\"\n"
+              "#include \"" HEADER "\"\n"
+              "#define SQUARE(x) ((x) * (x))\n"
+              "int a = SQUARE(3); /* block\n comment */ long b; // line\n"
+              "#if 0\n"
+              "int hidden;\n"
+              "#endif\n"
+              "char *s = \"/* kept */\";\n"
+              "int f(int n) { return n + from_header; }\n");
+}
+
+/* Many blocks and batches, so both rings fill up and wrap around */
+static void testLarge(void) {
+  Text source = {0};
+  char line[128];
+
+  append(&source, "#include \"" HEADER "\"\n#define ONE 1\n");
+  for (int i = 0; i < 20000; i++) {
+    snprintf(line, sizeof(line),
+             "int v%d = ONE + %d; /* comment %d */ // tail\n", i, i, i);
+    append(&source, line);
+  }
+
+  checkSource(source.data);
+  free(source.data);
+}
+
+/* Past an include, rows are the includer's again, in every mode */
+static void testRows(void) {
+  Text source = {0};
+  char line[64];
+
+  writeFile("pipeline_rows.h", "int h1;\n\nint h3;\n");
+  for (int i = 0; i < 5000; i++) {
+    snprintf(line, sizeof(line), "int v%d; /* pad the block out */\n", i);
+    append(&source, line);
+  }
+  append(&source, "#include \"pipeline_rows.h\"\nint after;\n");
+  writeFile(SOURCE, source.data);
+
+  for (int mode = 0; mode < 3; mode++) {
+    int status;
+    char *out = compileOutput(SOURCE, mode == 1, mode == 2, &status);
+
+    CHECK(status == 0);
+    CHECK(strstr(out, "<h3, 3, 5, ") != NULL);
+    CHECK(strstr(out, "<after, 5002, 5, ") != NULL);
+    free(out);
+  }
+
+  remove("pipeline_rows.h");
+  free(source.data);
+}
+
+/* A file that cannot be opened or does not parse fails in every mode */
+static void testStatus(void) {
+  int status;
+
+  for (int mode = 0; mode < 3; mode++) {
+    free(compileOutput("pipeline_test.missing", mode == 1, mode == 2,
+                       &status));
+    CHECK(status == 1);
+  }
+
+  writeFile(SOURCE, "int x = ;\n");
+  for (int mode = 0; mode < 3; mode++) {
+    free(compileOutput(SOURCE, mode == 1, mode == 2, &status));
+    CHECK(status == 1);
+  }
+}
+
+int main(void) {
+  writeFile(HEADER, "#ifndef PIPELINE_TEST_H\n"
+                    "#define PIPELINE_TEST_H\n"
+                    "int from_header;\n"
+                    "#endif\n");
+
+  testSmall();
+  testLarge();
+  testRows();
+  testStatus();
+
+  remove(SOURCE);
+  remove(HEADER);
+  remove(OUTPUT);
+  remove("temp.c");
+  return CHECK_DONE();
+}
@@ -0,0 +1,239 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "lexer/fused.h"
+#include "preprocessor/include.h"
+#include "preprocessor/preprocessor.h"
+
+#define SOURCE "preprocessor_test.c.in"
+
+typedef struct Text {
+  char *data;
+  size_t len, capacity;
+} Text;
+
+static void append(Text *t, const char *s, size_t len) {
+  if (t->len + len + 1 > t->capacity) {
+    while (t->len + len + 1 > t->capacity)
+      t->capacity = t->capacity ? t->capacity * 2 : 256;
+    t->data = realloc(t->data, t->capacity);
+  }
+
+  memcpy(t->data + t->len, s, len);
+  t->len += len;
+  t->data[t->len] = '\0';
+}
+
+static void appendBlock(const char *block, size_t len, void *ctx) {
+  append(ctx, block, len);
+}
+
+static void writeFile(const char *path, const char *text) {
+  FILE *out = fopen(path, "w");
+  fputs(text, out);
+  fclose(out);
+}
+
+static void writeSource(const char *text) { writeFile(SOURCE, text); }
+
+/* The preprocessed text, its runs of blanks squeezed to one space */
+static char *preprocessed(int *rows) {
+  Text raw = {0}, squeezed = {0};
+  int fd = open(SOURCE, O_RDONLY);
+
+  CHECK(preprocessUnit(fd, SOURCE, appendBlock, &raw, NULL) == 0);
+  close(fd);
+
+  *rows = 0;
+  for (size_t i = 0; i < raw.len; i++) {
+    if (!isspace((unsigned char)raw.data[i])) {
+      append(&squeezed, &raw.data[i], 1);
+      continue;
+    }
+
+    *rows += raw.data[i] == '\n';
+    if (squeezed.len && squeezed.data[squeezed.len - 1] != ' ')
+      append(&squeezed, " ", 1);
+  }
+
+  if (squeezed.len && squeezed.data[squeezed.len - 1] == ' ')
+    squeezed.data[--squeezed.len] = '\0';
+
+  free(raw.data);
+  return squeezed.data ? squeezed.data : strdup("");
+}
+
+/* The fused lexer's tokens joined by spaces, and the row of the last one */
+static char *fusedTokens(int *last_row) {
+  FusedLexer *lx = openFusedLexer(SOURCE);
+  Text out = {0};
+  Token *tok;
+
+  CHECK(lx != NULL);
+  while (lx && (tok = getNextFusedToken(lx)) && strcmp(tok->type, "EOF")) {
+    if (out.len)
+      append(&out, " ", 1);
+    append(&out, tok->token_name, strlen(tok->token_name));
+    *last_row = tok->row;
+    token_destroy(tok);
+  }
+
+  if (lx) {
+    token_destroy(tok);
+    closeFusedLexer(lx);
+  }
+
+  return out.data ? out.data : strdup("");
+}
+
+static void checkExpansion(const char *source, const char *text,
+                           const char *tokens, int rows, int last_row) {
+  int got_rows = 0, got_last = 0;
+
+  writeSource(source);
+
+  char *got = preprocessed(&got_rows);
+  if (strcmp(got, text) != 0)
+    fprintf(stderr, "preprocessed: %s\n", got);
+  CHECK(strcmp(got, text) == 0);
+  CHECK(got_rows == rows);
+  free(got);
+
+  got = fusedTokens(&got_last);
+  if (strcmp(got, tokens) != 0)
+    fprintf(stderr, "fused: %s\n", got);
+  CHECK(strcmp(got, tokens) == 0);
+  CHECK(got_last == last_row);
+  free(got);
+}
+
+static void testContinuedDefine(void) {
+  checkExpansion("#define MAX(a, b) \\\n"
+                 "  ((a) > (b) ? (a) : (b))\n"
+                 "int x = MAX(1, 2);\n",
+                 "int x = ((1) > (2) ? (1) : (2));",
+                 "int x = ( ( 1 ) > ( 2 ) ? ( 1 ) : ( 2 ) ) ;", 3, 3);
+
+  checkExpansion("#define ONE \\\r\n1\r\n#if ONE \\\n  > 0\nint y;\n#endif\n",
+                 "int y;", "int y ;", 6, 5);
+}
+
+static void testLongDefine(void) {
+  Text source = {0}, expected = {0};
+  const char *head = "#define SUM 0";
+
+  append(&source, head, strlen(head));
+  append(&expected, "int sum = 0", 11);
+  for (int i = 0; i < 3000; i++) {
+    append(&source, " + 1", 4);
+    append(&expected, " + 1", 4);
+  }
+  append(&source, "\nint sum = SUM;\n", 16);
+  append(&expected, ";", 1);
+
+  int rows = 0;
+  writeSource(source.data);
+
+  char *got = preprocessed(&rows);
+  CHECK(strcmp(got, expected.data) == 0);
+  CHECK(rows == 2);
+  free(got);
+
+  int last_row = 0;
+  expected.data[--expected.len] = '\0';
+  append(&expected, " ;", 2);
+
+  got = fusedTokens(&last_row);
+  CHECK(strcmp(got, expected.data) == 0);
+  CHECK(last_row == 2);
+  free(got);
+
+  free(source.data);
+  free(expected.data);
+}
+
+static void testPasteRescan(void) {
+  checkExpansion("#define hash_hash # ## #\n"
+                 "#define mkstr(a) # a\n"
+                 "#define in_between(a) mkstr(a)\n"
+                 "#define join(c, d) in_between(c hash_hash d)\n"
+                 "#define IN_STR(x) mkstr(x)\n"
+                 "char p[] = join(x, y);\n"
+                 "char q[] = IN_STR(hash_hash);\n",
+                 "char p[] = \"x ## y\"; char q[] = \"##\";",
+                 "char p [ ] = \"x ## y\" ; char q [ ] = \"##\" ;", 7, 7);
+}
+
+/* Comments cut by a read at every point; 64 KiB is what read() asks for */
+static void testBlockBoundary(void) {
+  const char *tail = "/* c\n */ int b; // t\nint c;\n";
+  char *source = malloc(PP_BLOCK_SIZE + 64);
+
+  for (int cut = 1; cut <= (int)strlen(tail); cut++) {
+    size_t pad = PP_BLOCK_SIZE - cut - 1;
+
+    memcpy(source, "int a;", 6);
+    memset(source + 6, ' ', pad - 6);
+    source[pad] = '\n';
+    strcpy(source + pad + 1, tail);
+
+    checkExpansion(source, "int a; int b; int c;", "int a ; int b ; int c ;",
+                   4, 4);
+  }
+
+  free(source);
+}
+
+/* A second #include of a guarded or #pragma once header adds nothing */
+static void testIncludeOnce(void) {
+  writeFile("pp_guard.h",
+            "#ifndef PP_GUARD_H\n#define PP_GUARD_H\nint guarded;\n#endif\n");
+  writeFile("pp_once.h", "#pragma once\nint once;\n");
+  writeFile("pp_plain.h", "int plain;\n");
+
+  mkdir("pp_include", 0755);
+  writeFile("pp_include/pp_angled.h",
+            "#ifndef PP_ANGLED_H\n#define PP_ANGLED_H\nint angled;\n#endif\n");
+  addIncludePath("pp_include");
+
+  /* 9 rows of its own, each header's once and pp_plain.h's twice */
+  checkExpansion("#include \"pp_guard.h\"\n"
+                 "#include \"pp_once.h\"\n"
+                 "#include <pp_angled.h>\n"
+                 "#include \"pp_plain.h\"\n"
+                 "#include \"pp_guard.h\"\n"
+                 "#include \"pp_once.h\"\n"
+                 "#include <pp_angled.h>\n"
+                 "#include \"pp_plain.h\"\n"
+                 "int after;\n",
+                 "int guarded; int once; int angled; int plain; int plain; "
+                 "int after;",
+                 "int guarded ; int once ; int angled ; int plain ; int plain ; "
+                 "int after ;",
+                 21, 21);
+
+  clearIncludePaths();
+  remove("pp_guard.h");
+  remove("pp_once.h");
+  remove("pp_plain.h");
+  remove("pp_include/pp_angled.h");
+  rmdir("pp_include");
+}
+
+int main(void) {
+  testContinuedDefine();
+  testLongDefine();
+  testPasteRescan();
+  testBlockBoundary();
+  testIncludeOnce();
+
+  remove(SOURCE);
+  remove("temp.c");
+  return CHECK_DONE();
+}
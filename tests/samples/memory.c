@@ -0,0 +1,9 @@
+#include "memory.h"
+#define AREA(w, h) ((w) * (h))
+/* shapes */
+struct point { int x; int y; };
+int area = AREA(3, 4); // twelve
+#if 0
+int hidden;
+#endif
+int scale(int n, long factor) { return n * factor + from_header; }
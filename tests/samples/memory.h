@@ -0,0 +1,6 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+int from_header;
+
+#endif
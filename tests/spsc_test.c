@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "spsc.h"
+
+#define COUNT 100000
+
+static void pushInt(SpscQueue *q, int value) {
+  *(int *)spsc_reserve(q) = value;
+  spsc_push(q);
+}
+
+static int popInt(SpscQueue *q) {
+  int value = *(int *)spsc_front(q);
+  spsc_pop(q);
+  return value;
+}
+
+static void *produce(void *arg) {
+  SpscQueue *q = arg;
+
+  for (int i = 0; i < COUNT; i++)
+    pushInt(q, i);
+  spsc_close(q);
+  return NULL;
+}
+
+static void testOrder(void) {
+  SpscQueue *q = spsc_create(3, sizeof(int));
+
+  /* Rounded up to four slots, which wrap around as they are reused */
+  CHECK(q->mask == 3);
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 4; i++)
+      pushInt(q, round * 4 + i);
+    for (int i = 0; i < 4; i++)
+      CHECK(popInt(q) == round * 4 + i);
+  }
+  spsc_destroy(q);
+
+  /* Across threads through a ring much smaller than the run */
+  q = spsc_create(16, sizeof(int));
+  pthread_t producer;
+  int *slot, next = 0;
+
+  CHECK(pthread_create(&producer, NULL, produce, q) == 0);
+  while ((slot = spsc_front(q))) {
+    if (*slot != next)
+      break;
+    next++;
+    spsc_pop(q);
+  }
+  pthread_join(producer, NULL);
+
+  CHECK(next == COUNT);
+  spsc_destroy(q);
+}
+
+typedef struct Blocked {
+  SpscQueue *q;
+  atomic_int pushed;
+} Blocked;
+
+static void *pushOneMore(void *arg) {
+  Blocked *b = arg;
+
+  pushInt(b->q, 4);
+  atomic_store(&b->pushed, 1);
+  return NULL;
+}
+
+static void testBackpressure(void) {
+  Blocked b = {spsc_create(4, sizeof(int)), 0};
+  pthread_t producer;
+
+  for (int i = 0; i < 4; i++)
+    pushInt(b.q, i);
+  CHECK(b.q->full_waits == 0);
+
+  /* A full ring holds the producer until the consumer takes a slot */
+  CHECK(pthread_create(&producer, NULL, pushOneMore, &b) == 0);
+  usleep(50 * 1000);
+  CHECK(!atomic_load(&b.pushed));
+
+  CHECK(popInt(b.q) == 0);
+  pthread_join(producer, NULL);
+  CHECK(atomic_load(&b.pushed));
+  CHECK(b.q->full_waits == 1);
+
+  for (int i = 1; i <= 4; i++)
+    CHECK(popInt(b.q) == i);
+  spsc_destroy(b.q);
+}
+
+static void testCloseDrain(void) {
+  SpscQueue *q = spsc_create(8, sizeof(int));
+
+  pushInt(q, 1);
+  pushInt(q, 2);
+  spsc_close(q);
+
+  /* What was pushed before closing is still read, then nothing */
+  CHECK(popInt(q) == 1);
+  CHECK(popInt(q) == 2);
+  CHECK(spsc_front(q) == NULL);
+  CHECK(spsc_front(q) == NULL);
+  spsc_destroy(q);
+
+  q = spsc_create(8, sizeof(int));
+  spsc_close(q);
+  CHECK(spsc_front(q) == NULL);
+  spsc_destroy(q);
+}
+
+int main(void) {
+  testOrder();
+  testBackpressure();
+  testCloseDrain();
+  return CHECK_DONE();
+}
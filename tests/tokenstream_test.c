@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "lexer/tokenstream.h"
+
+static const char *fragments[] = {
+    "int ",        "x",          "abc_1",      " ",      "\n",
+    "\n",          "\t",         "\"",         "'",      "\\",
+    "/",           "*",          "/*",         "*/",     "//",
+    "#",           "\n#",        "\n#define A \\\n", "\\\n", "\"a\\\nb\"",
+    "(",           ")",          "{",          "}",      ";",
+    "=",           "+",          "1",          "2.5",    "'\"'",
+    "\"/*\"",      "\n#if 0\n",  "\n#endif\n", "for",    "y1",
+};
+
+#define FRAGMENT_COUNT ((int)(sizeof(fragments) / sizeof(fragments[0])))
+
+typedef struct Text {
+  char *data;
+  size_t len;
+} Text;
+
+static void randomText(Text *t, int pieces) {
+  t->len = 0;
+  for (int i = 0; i < pieces; i++) {
+    const char *f = fragments[rand() % FRAGMENT_COUNT];
+    size_t n = strlen(f);
+
+    t->data = realloc(t->data, t->len + n + 1);
+    memcpy(t->data + t->len, f, n);
+    t->len += n;
+    t->data[t->len] = '\0';
+  }
+}
+
+static void applyEdit(Text *t, size_t offset, size_t removed,
+                      const char *inserted, size_t inserted_len) {
+  char *data = malloc(t->len - removed + inserted_len + 1);
+
+  memcpy(data, t->data, offset);
+  memcpy(data + offset, inserted, inserted_len);
+  memcpy(data + offset + inserted_len, t->data + offset + removed,
+         t->len - offset - removed);
+
+  free(t->data);
+  t->data = data;
+  t->len += inserted_len - removed;
+  t->data[t->len] = '\0';
+}
+
+static int sameToken(const Token *a, const Token *b) {
+  return strcmp(a->token_name, b->token_name) == 0 &&
+         strcmp(a->type, b->type) == 0 && a->row == b->row &&
+         a->col == b->col && a->index == b->index;
+}
+
+/* The edited stream must match lexing the final text from scratch */
+static int matchesFullLex(TokenStream *ts, const Text *t) {
+  TokenStream *full = tokenstream_create(t->data, t->len);
+  int same = ts->count == full->count;
+
+  for (int i = 0; same && i < ts->count; i++) {
+    Token *a = tokenstream_token(ts, i), *b = tokenstream_token(full, i);
+
+    if (!sameToken(a, b)) {
+      fprintf(stderr, "token %d: <%s %d:%d %d> vs <%s %d:%d %d>\n", i,
+              a->token_name, a->row, a->col, a->index, b->token_name, b->row,
+              b->col, b->index);
+      same = 0;
+    }
+  }
+
+  tokenstream_destroy(full);
+  return same;
+}
+
+static void edit(TokenStream *ts, Text *t, size_t offset, size_t removed,
+                 const char *inserted) {
+  size_t n = strlen(inserted);
+
+  tokenstream_edit(ts, offset, removed, inserted, n);
+  applyEdit(t, offset, removed, inserted, n);
+}
+
+static void testRandomEdits(void) {
+  Text t = {0}, piece = {0};
+
+  srand(26);
+  for (int round = 0; round < 300; round++) {
+    randomText(&t, 1 + rand() % 80);
+    TokenStream *ts = tokenstream_create(t.data, t.len);
+
+    for (int step = 0; step < 8; step++) {
+      size_t offset = t.len ? rand() % (t.len + 1) : 0;
+      size_t removed = rand() % 3 ? 0 : rand() % (t.len - offset + 1);
+
+      randomText(&piece, rand() % 4);
+      tokenstream_edit(ts, offset, removed, piece.data, piece.len);
+      applyEdit(&t, offset, removed, piece.data, piece.len);
+
+      if (!matchesFullLex(ts, &t)) {
+        fprintf(stderr, "round %d step %d\n", round, step);
+        CHECK(0);
+        step = 8;
+      }
+    }
+
+    tokenstream_destroy(ts);
+  }
+
+  free(t.data);
+  free(piece.data);
+}
+
+/* Edits that change how every following line lexes */
+static void testStateChanges(void) {
+  Text t = {0};
+  const char *source = "int a;\n"
+                       "#define B 1\n"
+                       "char *s = \"x\";\n"
+                       "int c; /* note */ int d;\n"
+                       "int e;\n";
+
+  applyEdit(&t, 0, 0, source, strlen(source));
+  TokenStream *ts = tokenstream_create(t.data, t.len);
+
+  edit(ts, &t, 0, 0, "/*");
+  CHECK(matchesFullLex(ts, &t));
+  edit(ts, &t, 0, 2, "");
+  CHECK(matchesFullLex(ts, &t));
+
+  /* A backslash that continues the directive over the next line */
+  size_t eol = strstr(t.data, "B 1\n") + 3 - t.data;
+  edit(ts, &t, eol, 0, " \\");
+  CHECK(matchesFullLex(ts, &t));
+  edit(ts, &t, eol, 2, "");
+  CHECK(matchesFullLex(ts, &t));
+
+  /* Opening and closing a string; a string continued by a backslash */
+  size_t quote = strchr(t.data, '"') - t.data;
+  edit(ts, &t, quote, 1, "");
+  CHECK(matchesFullLex(ts, &t));
+  edit(ts, &t, quote, 0, "\"");
+  CHECK(matchesFullLex(ts, &t));
+  edit(ts, &t, quote + 2, 0, "\\\n");
+  CHECK(matchesFullLex(ts, &t));
+
+  /* Removing a comment's end */
+  size_t end = strstr(t.data, "*/") - t.data;
+  edit(ts, &t, end, 2, "");
+  CHECK(matchesFullLex(ts, &t));
+
+  tokenstream_destroy(ts);
+  free(t.data);
+}
+
+/* An edit in the middle of a long file leaves the far tokens alone */
+static void testLocalEdit(void) {
+  Text t = {0};
+  char line[64];
+
+  for (int i = 0; i < 2000; i++) {
+    int n = snprintf(line, sizeof(line), "int v%d = %d;\n", i, i);
+    applyEdit(&t, t.len, 0, line, n);
+  }
+
+  TokenStream *ts = tokenstream_create(t.data, t.len);
+  Token *head = tokenstream_token(ts, 0);
+  Token *tail = tokenstream_token(ts, ts->count - 1);
+  int count = ts->count;
+
+  size_t middle = strstr(t.data, "int v1000 ") - t.data;
+  edit(ts, &t, middle, 0, "int w;\n");
+
+  CHECK(ts->count == count + 3);
+  CHECK(tokenstream_token(ts, 0) == head);
+  CHECK(tokenstream_token(ts, ts->count - 1) == tail);
+  CHECK(tail->row == 2001);
+  CHECK(tokenstream_token(ts, ts->count - 4)->index == 2000);
+  CHECK(matchesFullLex(ts, &t));
+
+  tokenstream_destroy(ts);
+  free(t.data);
+}
+
+int main(void) {
+  testStateChanges();
+  testLocalEdit();
+  testRandomEdits();
+  return CHECK_DONE();
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "lexer/xref.h"
+
+#define ONLY_IN_A 100
+
+static XrefIndex *sampleIndex(const char *long_name) {
+  XrefIndex *index = xref_create();
+  uint32_t a = xref_file(index, "a.c"), b = xref_file(index, "b.h");
+  char name[16];
+
+  for (int i = 0; i < ONLY_IN_A; i++) {
+    snprintf(name, sizeof(name), "n%d", i);
+    xref_add(index, xref_name(index, name), a, i + 1, 5);
+  }
+
+  uint32_t shared = xref_name(index, "shared");
+  xref_add(index, shared, a, 1, 1);
+  xref_add(index, shared, b, 2, 3);
+  xref_add(index, shared, a, 7, 9);
+  xref_add(index, shared, b, 4, 1);
+
+  xref_add(index, xref_name(index, long_name), b, 10, 2);
+  return index;
+}
+
+static int occurrences(const XrefIndex *index, const char *name,
+                       XrefOccurrence *out, int max) {
+  XrefCursor cursor;
+  int n = 0;
+
+  xref_begin(index, xref_find(index, name), &cursor);
+  while (n < max && xref_next(&cursor, &out[n]))
+    n++;
+  return n;
+}
+
+static void testRemoveFiles(void) {
+  char *long_name = malloc(5001);
+  memset(long_name, 'q', 5000);
+  long_name[5000] = '\0';
+
+  XrefIndex *index = sampleIndex(long_name);
+  const uint8_t *untouched[ONLY_IN_A];
+  uint8_t flags[2] = {0, 1};
+  XrefOccurrence at[4];
+
+  for (int i = 0; i < ONLY_IN_A; i++)
+    untouched[i] = index->lists[i].data;
+
+  xref_removeFiles(index, flags);
+
+  /* Names that never occur in b.h keep their encoded lists */
+  for (int i = 0; i < ONLY_IN_A; i++)
+    CHECK(index->lists[i].data == untouched[i]);
+
+  CHECK(occurrences(index, "shared", at, 4) == 2);
+  CHECK(at[0].file == 0 && at[0].row == 1 && at[1].row == 7);
+  CHECK(xref_count(index, xref_find(index, long_name)) == 0);
+
+  /* Re-adding after removal keeps the per-file names current */
+  xref_add(index, xref_find(index, "shared"), 1, 5, 5);
+  xref_removeFiles(index, flags);
+  CHECK(occurrences(index, "shared", at, 4) == 2);
+
+  xref_destroy(index);
+  free(long_name);
+}
+
+static void testSaveLoad(void) {
+  char *long_name = malloc(5001);
+  memset(long_name, 'q', 5000);
+  long_name[5000] = '\0';
+
+  XrefIndex *index = sampleIndex(long_name);
+  XrefOccurrence at[4];
+  FILE *file = tmpfile();
+
+  CHECK(file && xref_save(index, file) == 0);
+  xref_destroy(index);
+  if (!file) {
+    free(long_name);
+    return;
+  }
+
+  rewind(file);
+  index = xref_load(file);
+  CHECK(index != NULL);
+  if (index) {
+    CHECK(index->names.count == ONLY_IN_A + 2);
+    CHECK(occurrences(index, "shared", at, 4) == 4);
+    CHECK(at[3].file == 1 && at[3].row == 4 && at[3].col == 1);
+    CHECK(occurrences(index, long_name, at, 4) == 1);
+
+    /* A loaded index can still drop a file without a full rewrite */
+    uint8_t flags[2] = {1, 0};
+    xref_removeFiles(index, flags);
+    CHECK(occurrences(index, "shared", at, 4) == 2);
+    CHECK(occurrences(index, "n3", at, 4) == 0);
+    xref_destroy(index);
+  }
+
+  const char *queries[] = {"shared", "n42", "n0", "n99", "zz", "", "n"};
+  int counts[] = {4, 1, 1, 1, 0, 0, 0};
+
+  for (int i = 0; i < 7; i++) {
+    index = xref_loadName(file, queries[i]);
+    CHECK(index != NULL);
+    if (index) {
+      CHECK(occurrences(index, queries[i], at, 4) == counts[i]);
+      xref_destroy(index);
+    }
+  }
+
+  index = xref_loadName(file, long_name);
+  CHECK(index && occurrences(index, long_name, at, 4) == 1);
+  CHECK(index && strcmp(xref_fileName(index, at[0].file), "b.h") == 0);
+  xref_destroy(index);
+
+  /* A truncated image is refused by both readers */
+  fflush(file);
+  CHECK(ftruncate(fileno(file), 40) == 0);
+  CHECK(xref_load(file) == NULL);
+  CHECK(xref_loadName(file, "shared") == NULL);
+
+  fclose(file);
+  free(long_name);
+}
+
+int main(void) {
+  testRemoveFiles();
+  testSaveLoad();
+  return CHECK_DONE();
+}